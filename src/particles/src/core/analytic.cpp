@@ -0,0 +1,97 @@
+#include "core/analytic.h"
+#include "core/profiler.h"
+
+#include <cstring>
+
+namespace {
+inline bool recordAlive(const SpawnRecord &record, float time)
+{
+    return time - record.spawnTime < record.lifetime;
+}
+} // namespace
+
+AnalyticEmitter *createAnalyticEmitter(unsigned seed, int capacity)
+{
+    AnalyticEmitter *emitter = new AnalyticEmitter();
+
+    emitter->capacity = capacity;
+    emitter->records = new SpawnRecord[capacity];
+    emitter->spawned = createParticles(seed, capacity);
+
+    resetAnalyticEmitter(emitter);
+
+    return emitter;
+}
+
+void destroyAnalyticEmitter(AnalyticEmitter *emitter)
+{
+    destroyParticles(emitter->spawned);
+    delete[] emitter->records;
+    delete emitter;
+}
+
+void resetAnalyticEmitter(AnalyticEmitter *emitter)
+{
+    emitter->head = 0;
+    emitter->written = 0;
+    emitter->time = 0.0;
+    resetParticles(emitter->spawned);
+}
+
+int spawnAnalytic(AnalyticEmitter *emitter, const EmitterParams &params, float timeDelta)
+{
+    ProfileScope scope(PHASE_SPAWN);
+    float delta = timeDelta * STRETCH;
+
+    // New particles start at the beginning of the step, so that by the end
+    // of it they have aged as much as the simulation's after their first
+    // step
+    float start = float(emitter->time);
+    emitter->time += delta;
+    float now = float(emitter->time);
+
+    // Only the pool is emptied, the fraction of a particle owed to the next
+    // step is kept
+    Particles *newborn = emitter->spawned;
+    newborn->numParticles = 0;
+    spawnParticles(newborn, params, delta);
+
+    int spawned = 0;
+    for (; spawned < newborn->numParticles; spawned++) {
+        SpawnRecord *record = &emitter->records[emitter->head];
+
+        // The ring is full until the oldest particle dies
+        if (emitter->head < emitter->written && recordAlive(*record, now)) {
+            break;
+        }
+
+        record->origin[0] = newborn->posX[spawned];
+        record->origin[1] = newborn->posY[spawned];
+        record->origin[2] = newborn->posZ[spawned];
+        record->spawnTime = start;
+        record->velocity[0] = newborn->speedX[spawned];
+        record->velocity[1] = newborn->speedY[spawned];
+        record->velocity[2] = newborn->speedZ[spawned];
+        record->lifetime = newborn->initLives[spawned];
+        memcpy(record->colour, &newborn->colours[4*spawned], 4);
+
+        emitter->head = (emitter->head + 1) % emitter->capacity;
+        if (emitter->written < emitter->capacity) {
+            emitter->written++;
+        }
+    }
+
+    return spawned;
+}
+
+int countAnalyticLive(const AnalyticEmitter *emitter)
+{
+    float now = float(emitter->time);
+    int live = 0;
+    for (int i = 0; i < emitter->written; i++) {
+        if (recordAlive(emitter->records[i], now)) {
+            live++;
+        }
+    }
+    return live;
+}
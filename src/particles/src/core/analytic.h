@@ -0,0 +1,53 @@
+#pragma once
+
+// Stateless particles. With constant gravity and a wind that grows linearly
+// with age, a particle's position is a closed-form function of where and
+// how fast it started and how long ago, so only the record it was spawned
+// with has to be kept. The vertex shader evaluates the position, size and
+// age of every record from the current time, and the CPU only writes the
+// records of newly born particles.
+//
+// The records form a ring in spawn order. A particle's slot is reused once
+// it has died; while the oldest particle is still alive new ones are
+// dropped, as they are when the dense pool is full.
+
+#include "core/simulation.h"
+
+#include <cstdint>
+
+struct SpawnRecord {
+    float origin[3];
+    float spawnTime;  // Simulated seconds
+    float velocity[3];
+    float lifetime;   // Simulated seconds
+    uint8_t colour[4];
+};
+
+struct AnalyticEmitter {
+    int capacity;
+    SpawnRecord *records;
+
+    int head;     // Slot the next particle is written to
+    int written;  // Slots that have held a particle, at most the capacity
+
+    double time;  // Simulated seconds since the emitter was reset
+
+    // Newborn particles of the current step, emitted by spawnParticles so
+    // that both representations emit the same particles
+    Particles *spawned;
+};
+
+AnalyticEmitter *createAnalyticEmitter(unsigned seed, int capacity = DEFAULT_CAPACITY);
+
+void destroyAnalyticEmitter(AnalyticEmitter *emitter);
+
+void resetAnalyticEmitter(AnalyticEmitter *emitter);
+
+// Advance the clock by `timeDelta` seconds of wall time and write the
+// particles born in that step. Returns the number written, starting at the
+// slot that was `head` before the call and wrapping around the ring.
+int spawnAnalytic(AnalyticEmitter *emitter, const EmitterParams &params, float timeDelta);
+
+// Number of records alive at the current time. Walks the whole ring, meant
+// for statistics only.
+int countAnalyticLive(const AnalyticEmitter *emitter);
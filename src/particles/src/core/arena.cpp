@@ -0,0 +1,84 @@
+#include "core/arena.h"
+#include "core/simulation.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace {
+size_t roundUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+// Map the arena with room to align it to a huge page boundary. Anonymous
+// mappings are already zeroed.
+bool mapArena(Arena *arena, size_t size)
+{
+    size_t mappingSize = roundUp(size, HUGE_PAGE_SIZE) + HUGE_PAGE_SIZE;
+    void *mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    char *data = reinterpret_cast<char *>(roundUp(reinterpret_cast<uintptr_t>(mapping),
+                                                  HUGE_PAGE_SIZE));
+    arena->data = data;
+    arena->mapping = mapping;
+    arena->mappingSize = mappingSize;
+    arena->hugePages = madvise(data, roundUp(size, HUGE_PAGE_SIZE), MADV_HUGEPAGE) == 0;
+    return true;
+}
+#endif
+} // namespace
+
+Arena *createArena(size_t size, bool hugePages)
+{
+    Arena *arena = new Arena();
+    arena->size = size;
+    arena->hugePages = false;
+    arena->mapping = NULL;
+    arena->mappingSize = 0;
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (hugePages && size >= HUGE_PAGE_SIZE && mapArena(arena, size)) {
+        return arena;
+    }
+#else
+    (void)hugePages;
+#endif
+
+    void *data = NULL;
+    if (posix_memalign(&data, PARTICLE_ALIGNMENT, size) != 0) {
+        fprintf(stderr, "Failed to allocate %zx bytes of memory. Exiting.", size);
+        exit(-1);
+    }
+    memset(data, 0, size);
+    arena->data = static_cast<char *>(data);
+    return arena;
+}
+
+void destroyArena(Arena *arena)
+{
+    if (arena == NULL) {
+        return;
+    }
+
+#ifdef __linux__
+    if (arena->mapping != NULL) {
+        munmap(arena->mapping, arena->mappingSize);
+    } else {
+        free(arena->data);
+    }
+#else
+    free(arena->data);
+#endif
+    delete arena;
+}
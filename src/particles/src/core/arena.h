@@ -0,0 +1,28 @@
+#pragma once
+
+// One zeroed, aligned block of memory that the particle arrays are carved
+// out of. Large arenas are mapped directly and, where the OS supports it,
+// backed by transparent huge pages so that walking tens of millions of
+// particles does not spend its time on TLB misses.
+
+#include <cstddef>
+
+// Arenas at least this large are mapped and aligned to huge pages
+#define HUGE_PAGE_SIZE (2 << 20)
+
+struct Arena {
+    char *data;
+    size_t size;
+    bool hugePages;  // The OS accepted the huge page advice
+
+    // The underlying mapping, NULL when allocated with posix_memalign
+    void *mapping;
+    size_t mappingSize;
+};
+
+// Allocate `size` zeroed bytes aligned to at least PARTICLE_ALIGNMENT. With
+// `hugePages` large arenas ask for transparent huge pages. Exits on failure
+// like the other allocations.
+Arena *createArena(size_t size, bool hugePages);
+
+void destroyArena(Arena *arena);
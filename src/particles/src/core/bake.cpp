@@ -0,0 +1,583 @@
+#include "core/bake.h"
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+// Zeros that end a run of literals in a delta frame. Shorter runs cost
+// more to mark than to store.
+#define MIN_ZERO_RUN 4
+
+void appendVarint(vector<unsigned char> *out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out->push_back((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out->push_back(value);
+}
+
+// Returns false past `end`
+bool readVarint(const unsigned char **in, const unsigned char *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; *in < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*in)++;
+        *value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// XOR `size` bytes of instances with the previous frame's, zeros past its
+// end, and store byte b of every instance together. The planes go out as
+// runs of zeros and of literals. Slots only line up while the particles
+// keep their order, which sorting and removal break every frame.
+void encodeDelta(const unsigned char *instances, size_t size, size_t stride,
+                 const vector<unsigned char> &previous, vector<unsigned char> *planes,
+                 vector<unsigned char> *out)
+{
+    size_t count = size / stride;
+    planes->resize(size);
+    size_t common = min(size, previous.size());
+    for (size_t b = 0; b < stride; b++) {
+        unsigned char *plane = &(*planes)[b * count];
+        for (size_t i = 0; i < count; i++) {
+            size_t j = i * stride + b;
+            plane[i] = instances[j] ^ (j < common ? previous[j] : 0);
+        }
+    }
+
+    const unsigned char *bytes = planes->data();
+    size_t i = 0;
+    while (i < size) {
+        size_t zeros = 0;
+        while (i + zeros < size && bytes[i + zeros] == 0) {
+            zeros++;
+        }
+        i += zeros;
+
+        size_t begin = i;
+        int run = 0;
+        while (i < size) {
+            run = bytes[i] == 0 ? run + 1 : 0;
+            i++;
+            if (run == MIN_ZERO_RUN) {
+                i -= MIN_ZERO_RUN;
+                break;
+            }
+        }
+
+        appendVarint(out, zeros);
+        appendVarint(out, i - begin);
+        out->insert(out->end(), bytes + begin, bytes + i);
+    }
+}
+
+// Turn `instances`, the frame before, into the frame of `size` bytes
+// encoded in [in, end)
+void decodeDelta(const unsigned char *in, const unsigned char *end, size_t size,
+                 size_t stride, vector<unsigned char> *planes, vector<unsigned char> *instances)
+{
+    planes->assign(size, 0);
+    size_t i = 0;
+    while (in < end && i < size) {
+        uint64_t zeros;
+        uint64_t literals;
+        if (!readVarint(&in, end, &zeros) || !readVarint(&in, end, &literals)) {
+            break;
+        }
+        i = min<uint64_t>(i + zeros, size);
+        literals = min<uint64_t>(min<uint64_t>(literals, size - i), end - in);
+        memcpy(planes->data() + i, in, literals);
+        in += literals;
+        i += literals;
+    }
+
+    // Past the end of the frame before, the bytes were XORed with zeros
+    instances->resize(size, 0);
+    size_t count = size / stride;
+    for (size_t b = 0; b < stride; b++) {
+        const unsigned char *plane = planes->data() + b * count;
+        for (size_t k = 0; k < count; k++) {
+            (*instances)[k * stride + b] ^= plane[k];
+        }
+    }
+}
+
+struct PendingFrame {
+    BakeFrameHeader header;
+    vector<int32_t> segments;
+    vector<unsigned char> instances;
+};
+} // namespace
+
+struct BakeWriter {
+    FILE *file;
+    BakeHeader header;
+    size_t stride;
+    int frames;  // Queued
+
+    thread worker;
+    mutex queueMutex;
+    condition_variable queued;  // A frame was queued or the writer closes
+    condition_variable taken;   // A frame was taken off the queue
+    deque<PendingFrame> queue;
+    bool closing;
+
+    // Only the worker touches these until it is joined
+    vector<unsigned char> previous;
+    vector<unsigned char> planes;
+    vector<unsigned char> encoded;
+    vector<uint64_t> offsets;
+    uint64_t position;
+
+    atomic<bool> failed;
+    atomic<uint64_t> written;
+    atomic<uint64_t> raw;
+};
+
+namespace {
+bool writeBytes(BakeWriter *writer, const void *data, size_t size)
+{
+    if (size > 0 && fwrite(data, 1, size, writer->file) != size) {
+        return false;
+    }
+    writer->position += size;
+    writer->written += size;
+    return true;
+}
+
+void writeFrame(BakeWriter *writer, PendingFrame *frame)
+{
+    size_t size = frame->instances.size();
+    bool keyframe = writer->header.encoding == BAKE_RAW ||
+                    writer->offsets.size() % writer->header.keyframeInterval == 0;
+
+    frame->header.checksum = bakeChecksum(frame->instances.data(), size);
+
+    const unsigned char *payload = frame->instances.data();
+    if (!keyframe) {
+        writer->encoded.clear();
+        encodeDelta(frame->instances.data(), size, writer->stride, writer->previous,
+                    &writer->planes, &writer->encoded);
+        payload = writer->encoded.data();
+        size = writer->encoded.size();
+    }
+    frame->header.encodedSize = size;
+
+    // Every frame, and the index after them, starts on 8 bytes
+    const char padding[8] = {};
+
+    writer->offsets.push_back(writer->position);
+    bool written = writeBytes(writer, &frame->header, sizeof(frame->header)) &&
+                   writeBytes(writer, frame->segments.data(),
+                              frame->segments.size() * sizeof(int32_t)) &&
+                   writeBytes(writer, payload, size) &&
+                   writeBytes(writer, padding, (8 - writer->position % 8) % 8);
+    writer->raw += sizeof(frame->header) + frame->segments.size() * sizeof(int32_t) +
+                   frame->instances.size();
+    if (!written) {
+        writer->failed = true;
+    }
+
+    writer->previous.swap(frame->instances);
+}
+
+void runWriter(BakeWriter *writer)
+{
+    for (;;) {
+        PendingFrame frame;
+        {
+            unique_lock<mutex> lock(writer->queueMutex);
+            writer->queued.wait(lock, [&]() { return !writer->queue.empty() || writer->closing; });
+            if (writer->queue.empty()) {
+                return;
+            }
+            frame = std::move(writer->queue.front());
+            writer->queue.pop_front();
+        }
+        writer->taken.notify_one();
+        writeFrame(writer, &frame);
+    }
+}
+} // namespace
+
+uint64_t bakeChecksum(const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+const char *bakeEncodingName(BakeEncoding encoding)
+{
+    switch (encoding) {
+    case BAKE_RAW: return "raw";
+    case BAKE_DELTA: return "delta";
+    default: return "unknown";
+    }
+}
+
+BakeWriter *createBakeWriter(const char *path, const EmitterRegistry *registry,
+                             InstanceFormat format, BakeEncoding encoding,
+                             int keyframeInterval)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    BakeWriter *writer = new BakeWriter();
+    writer->file = file;
+    writer->stride = instanceStride(format);
+    writer->frames = 0;
+    writer->closing = false;
+    writer->position = 0;
+    writer->failed = false;
+    writer->written = 0;
+    writer->raw = 0;
+
+    BakeHeader &header = writer->header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BAKE_MAGIC;
+    header.version = BAKE_VERSION;
+    header.paramsSize = sizeof(EmitterParams);
+    header.format = format;
+    header.encoding = encoding;
+    header.keyframeInterval = max(keyframeInterval, 1);
+    header.numEmitters = registry->emitters.size();
+
+    // The header is written again with the frame count on close
+    bool written = writeBytes(writer, &header, sizeof(header));
+    for (size_t i = 0; i < registry->emitters.size() && written; i++) {
+        const Emitter &emitter = registry->emitters[i];
+        BakeEmitter record;
+        memset(&record, 0, sizeof(record));
+        record.params = emitter.params;
+        record.origin[0] = emitter.origin.x;
+        record.origin[1] = emitter.origin.y;
+        record.origin[2] = emitter.origin.z;
+        written = writeBytes(writer, &record, sizeof(record));
+    }
+    const char padding[8] = {};
+    written = written && writeBytes(writer, padding, (8 - writer->position % 8) % 8);
+    writer->failed = !written;
+
+    writer->worker = thread(runWriter, writer);
+    return writer;
+}
+
+bool writeBakeFrame(BakeWriter *writer, const EmitterBatches &batches,
+                    const void *instances)
+{
+    PendingFrame frame;
+    memset(&frame.header, 0, sizeof(frame.header));
+    frame.header.numInstances = batches.numInstances;
+    frame.header.numSegments = batches.segments.size();
+    for (int group = 0; group <= NUM_BLEND_GROUPS; group++) {
+        frame.header.groupBegin[group] = batches.groupBegin[group];
+    }
+    for (size_t i = 0; i < batches.segments.size(); i++) {
+        const EmitterSegment &segment = batches.segments[i];
+        frame.segments.push_back(segment.emitter);
+        frame.segments.push_back(segment.first);
+        frame.segments.push_back(segment.count);
+    }
+    const unsigned char *bytes = static_cast<const unsigned char *>(instances);
+    frame.instances.assign(bytes, bytes + batches.numInstances * writer->stride);
+
+    {
+        unique_lock<mutex> lock(writer->queueMutex);
+        writer->taken.wait(lock, [&]() { return writer->queue.size() < BAKE_QUEUE_FRAMES; });
+        writer->queue.push_back(std::move(frame));
+    }
+    writer->queued.notify_one();
+    writer->frames++;
+    return !writer->failed;
+}
+
+int bakeWriterFrames(const BakeWriter *writer)
+{
+    return writer->frames;
+}
+
+void bakeWriterSizes(const BakeWriter *writer, uint64_t *written, uint64_t *raw)
+{
+    *written = writer->written;
+    *raw = writer->raw;
+}
+
+bool closeBakeWriter(BakeWriter *writer, uint64_t *written, uint64_t *raw)
+{
+    {
+        lock_guard<mutex> lock(writer->queueMutex);
+        writer->closing = true;
+    }
+    writer->queued.notify_one();
+    writer->worker.join();
+
+    BakeHeader &header = writer->header;
+    header.numFrames = writer->offsets.size();
+    header.indexOffset = writer->position;
+    bool closed = !writer->failed &&
+                  writeBytes(writer, writer->offsets.data(),
+                             writer->offsets.size() * sizeof(uint64_t)) &&
+                  fseek(writer->file, 0, SEEK_SET) == 0 &&
+                  fwrite(&header, sizeof(header), 1, writer->file) == 1;
+    closed = fclose(writer->file) == 0 && closed;
+
+    if (written != NULL) {
+        bakeWriterSizes(writer, written, raw);
+    }
+    delete writer;
+    return closed;
+}
+
+struct BakeReader {
+    const char *data;
+    size_t size;
+    BakeHeader header;
+    const BakeEmitter *emitters;
+    const uint64_t *offsets;
+    size_t stride;
+
+    int decoded;  // The frame in `instances`, -1 for none
+    vector<unsigned char> instances;
+    vector<unsigned char> planes;
+};
+
+namespace {
+const BakeFrameHeader *frameHeader(const BakeReader *reader, int frame)
+{
+    return reinterpret_cast<const BakeFrameHeader *>(reader->data + reader->offsets[frame]);
+}
+
+// The encoded instances of `frame`
+const unsigned char *framePayload(const BakeReader *reader, int frame)
+{
+    const BakeFrameHeader *header = frameHeader(reader, frame);
+    return reinterpret_cast<const unsigned char *>(header + 1) +
+           header->numSegments * 3 * sizeof(int32_t);
+}
+
+// Whether frame `frame` lies inside the file and draws what it has
+bool validFrame(const BakeReader *reader, int frame)
+{
+    uint64_t offset = reader->offsets[frame];
+    if (offset % 8 != 0 || offset > reader->size ||
+        reader->size - offset < sizeof(BakeFrameHeader)) {
+        return false;
+    }
+    const BakeFrameHeader *header = frameHeader(reader, frame);
+    uint64_t size = sizeof(BakeFrameHeader) + uint64_t(header->numSegments) * 3 * sizeof(int32_t) +
+                    header->encodedSize;
+    bool keyframe = reader->header.encoding == BAKE_RAW ||
+                    frame % reader->header.keyframeInterval == 0;
+    if (reader->size - offset < size ||
+        (keyframe && header->encodedSize != header->numInstances * reader->stride) ||
+        header->groupBegin[0] != 0 ||
+        header->groupBegin[NUM_BLEND_GROUPS] != header->numSegments) {
+        return false;
+    }
+    for (int group = 0; group < NUM_BLEND_GROUPS; group++) {
+        if (header->groupBegin[group] > header->groupBegin[group + 1]) {
+            return false;
+        }
+    }
+
+    // A group is drawn as one run of instances from its first segment on
+    const int32_t *segments = reinterpret_cast<const int32_t *>(header + 1);
+    for (int group = 0; group < NUM_BLEND_GROUPS; group++) {
+        for (uint32_t i = header->groupBegin[group]; i < header->groupBegin[group + 1]; i++) {
+            const int32_t *segment = segments + 3 * i;
+            if (segment[0] < 0 || uint32_t(segment[0]) >= reader->header.numEmitters ||
+                segment[1] < 0 || segment[2] < 0 ||
+                uint64_t(segment[1]) + segment[2] > header->numInstances) {
+                return false;
+            }
+            const int32_t *previous = segment - 3;
+            if (i > header->groupBegin[group] && segment[1] != previous[1] + previous[2]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Decode `frame` into reader->instances, which holds the frame before it
+// unless `frame` starts a chunk
+void decodeFrame(BakeReader *reader, int frame)
+{
+    const BakeFrameHeader *header = frameHeader(reader, frame);
+    const unsigned char *payload = framePayload(reader, frame);
+    if (frame % reader->header.keyframeInterval == 0) {
+        reader->instances.assign(payload, payload + header->encodedSize);
+    } else {
+        decodeDelta(payload, payload + header->encodedSize,
+                    header->numInstances * reader->stride, reader->stride, &reader->planes,
+                    &reader->instances);
+    }
+    reader->decoded = frame;
+}
+} // namespace
+
+BakeReader *openBake(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < off_t(sizeof(BakeHeader))) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    // Played front to back
+    madvise(data, status.st_size, MADV_SEQUENTIAL);
+
+    BakeReader *reader = new BakeReader();
+    reader->data = static_cast<const char *>(data);
+    reader->size = status.st_size;
+    reader->decoded = -1;
+    memcpy(&reader->header, reader->data, sizeof(BakeHeader));
+
+    const BakeHeader &header = reader->header;
+    uint64_t emittersEnd = sizeof(BakeHeader) + uint64_t(header.numEmitters) * sizeof(BakeEmitter);
+    bool valid = header.magic == BAKE_MAGIC && header.version == BAKE_VERSION &&
+                 header.paramsSize == sizeof(EmitterParams) &&
+                 header.format < NUM_INSTANCE_FORMATS && header.encoding < NUM_BAKE_ENCODINGS &&
+                 header.keyframeInterval > 0 && header.numFrames > 0 &&
+                 emittersEnd <= reader->size && header.indexOffset % sizeof(uint64_t) == 0 &&
+                 header.indexOffset <= reader->size &&
+                 (reader->size - header.indexOffset) / sizeof(uint64_t) >= header.numFrames;
+    if (valid) {
+        reader->emitters = reinterpret_cast<const BakeEmitter *>(reader->data + sizeof(BakeHeader));
+        reader->offsets = reinterpret_cast<const uint64_t *>(reader->data + header.indexOffset);
+        reader->stride = instanceStride(InstanceFormat(header.format));
+        for (uint32_t frame = 0; frame < header.numFrames && valid; frame++) {
+            valid = validFrame(reader, frame);
+        }
+    }
+    if (!valid) {
+        closeBake(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+void closeBake(BakeReader *reader)
+{
+    munmap((void *)reader->data, reader->size);
+    delete reader;
+}
+
+int bakeFrames(const BakeReader *reader)
+{
+    return reader->header.numFrames;
+}
+
+InstanceFormat bakeFormat(const BakeReader *reader)
+{
+    return InstanceFormat(reader->header.format);
+}
+
+BakeEncoding bakeEncoding(const BakeReader *reader)
+{
+    return BakeEncoding(reader->header.encoding);
+}
+
+void restoreBakeEmitters(const BakeReader *reader, EmitterRegistry *registry)
+{
+    int count = reader->header.numEmitters;
+    while (numEmitters(registry) > count) {
+        removeEmitter(registry, numEmitters(registry) - 1);
+    }
+    while (numEmitters(registry) < count) {
+        addEmitter(registry, reader->emitters[0].params, glm::vec3(0.0f));
+    }
+    for (int i = 0; i < count; i++) {
+        const BakeEmitter &record = reader->emitters[i];
+        registry->emitters[i].params = record.params;
+        registry->emitters[i].origin = glm::vec3(record.origin[0], record.origin[1],
+                                                 record.origin[2]);
+    }
+    resetEmitters(registry);
+}
+
+const void *readBakeFrame(BakeReader *reader, int frame, EmitterBatches *batches)
+{
+    // Decoding takes the place of packing
+    ProfileScope scope(PHASE_PACK);
+    const BakeFrameHeader *header = frameHeader(reader, frame);
+
+    batches->segments.resize(header->numSegments);
+    const int32_t *segments = reinterpret_cast<const int32_t *>(header + 1);
+    for (uint32_t i = 0; i < header->numSegments; i++) {
+        EmitterSegment &segment = batches->segments[i];
+        segment.emitter = segments[3 * i];
+        segment.first = segments[3 * i + 1];
+        segment.count = segments[3 * i + 2];
+        segment.firstRange = 0;
+        segment.numRanges = 0;
+    }
+    for (int group = 0; group <= NUM_BLEND_GROUPS; group++) {
+        batches->groupBegin[group] = header->groupBegin[group];
+    }
+    batches->ranges.clear();
+    batches->numInstances = header->numInstances;
+    batches->numCulled = 0;
+    batches->numChunks = 0;
+    batches->numCulledChunks = 0;
+
+    if (reader->header.encoding == BAKE_RAW) {
+        return framePayload(reader, frame);
+    }
+
+    // Carry on from the last decoded frame when it is in the same chunk
+    int interval = reader->header.keyframeInterval;
+    int first = frame - frame % interval;
+    if (reader->decoded >= first && reader->decoded <= frame) {
+        first = reader->decoded + 1;
+    }
+    for (int f = first; f <= frame; f++) {
+        decodeFrame(reader, f);
+    }
+    return reader->instances.data();
+}
+
+uint64_t bakeFrameChecksum(const BakeReader *reader, int frame)
+{
+    return frameHeader(reader, frame)->checksum;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+// Baked particle caches: the packed instances of every frame of a run,
+// written to disk once and played back any number of times without
+// simulating. A frame is what the renderer uploads, its EmitterBatches
+// segments and the instances packed in their order, so playback only has
+// to copy it to the GPU.
+//
+// The file starts with a BakeHeader and a BakeEmitter per emitter, followed
+// by the frames and an index of where each frame starts. Frames come in
+// chunks of `keyframeInterval`: the first one of a chunk is stored as is,
+// the others, with BAKE_DELTA, as the difference to the frame before it.
+// Instances in INSTANCE_HALF are the quantized form. Seeking decodes from
+// the start of the chunk. Every frame keeps a checksum of its instances as
+// they were packed, to check the decoded ones against.
+//
+// The writer copies each frame and hands it to a background thread that
+// encodes and writes it, so recording costs the simulation one copy. The
+// reader maps the file.
+
+#include "core/emitters.h"
+#include "core/pack.h"
+
+#include <cstdint>
+
+#define BAKE_MAGIC 0x454b4142  // "BAKE"
+#define BAKE_VERSION 2
+
+// Frames per chunk when none is given
+#define BAKE_KEYFRAME_INTERVAL 30
+
+// Frames the writer queues before writeBakeFrame waits for it
+#define BAKE_QUEUE_FRAMES 8
+
+enum BakeEncoding {
+    BAKE_RAW,    // Every frame as it was packed
+    BAKE_DELTA,  // Frames XORed with the one before, in byte planes, with the
+                 // runs of zeros left out. Saves little: the particles are
+                 // reordered every frame, so slots rarely match.
+    NUM_BAKE_ENCODINGS
+};
+
+const char *bakeEncodingName(BakeEncoding encoding);
+
+struct BakeHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t paramsSize;  // sizeof(EmitterParams) of the build that wrote it
+    uint32_t format;      // InstanceFormat
+    uint32_t encoding;    // BakeEncoding
+    uint32_t keyframeInterval;
+    uint32_t numEmitters;
+    uint32_t numFrames;   // 0 until the writer is closed
+    uint64_t indexOffset; // Of the frame offsets, one uint64_t per frame
+};
+
+// An emitter as it was when the bake started, for its colours and sizes
+struct BakeEmitter {
+    EmitterParams params;
+    float origin[3];
+};
+
+// Followed by the segments, three int32_t each (emitter, first instance,
+// count), and `encodedSize` bytes of instances, padded to 8 bytes
+struct BakeFrameHeader {
+    uint32_t numInstances;
+    uint32_t numSegments;
+    uint32_t groupBegin[NUM_BLEND_GROUPS + 1];
+    uint32_t encodedSize;
+    uint64_t checksum;  // bakeChecksum of the instances before encoding
+};
+
+// 64-bit FNV-1a of `size` bytes, eight at a time
+uint64_t bakeChecksum(const void *data, size_t size);
+
+struct BakeWriter;
+
+// Start a bake of the emitters of `registry` at `path`, or NULL when the
+// file cannot be created
+BakeWriter *createBakeWriter(const char *path, const EmitterRegistry *registry,
+                             InstanceFormat format, BakeEncoding encoding,
+                             int keyframeInterval = BAKE_KEYFRAME_INTERVAL);
+
+// Queue the `batches.numInstances` instances at `instances`, packed by
+// packEmitters in the writer's format, as the next frame. Returns false
+// once a write has failed.
+bool writeBakeFrame(BakeWriter *writer, const EmitterBatches &batches,
+                    const void *instances);
+
+// Frames queued so far
+int bakeWriterFrames(const BakeWriter *writer);
+
+// Bytes written so far, and what the frames would have taken unencoded
+void bakeWriterSizes(const BakeWriter *writer, uint64_t *written, uint64_t *raw);
+
+// Write the remaining frames and the index and close the file, with the
+// final sizes of bakeWriterSizes. Returns false when any of it failed.
+bool closeBakeWriter(BakeWriter *writer, uint64_t *written = NULL, uint64_t *raw = NULL);
+
+struct BakeReader;
+
+// Map the bake at `path`, or NULL when it cannot be read or is not a bake
+// of this build
+BakeReader *openBake(const char *path);
+
+void closeBake(BakeReader *reader);
+
+int bakeFrames(const BakeReader *reader);
+
+InstanceFormat bakeFormat(const BakeReader *reader);
+
+BakeEncoding bakeEncoding(const BakeReader *reader);
+
+// Set the emitters of `registry` to the ones the bake was recorded with.
+// Their pools are emptied, playback does not simulate.
+void restoreBakeEmitters(const BakeReader *reader, EmitterRegistry *registry);
+
+// Frame `frame`: its segments go to `batches`, without ranges, and the
+// returned instances stay valid until the next call. Raw frames point into
+// the mapping, delta frames are decoded from the closest earlier frame
+// already decoded or from the start of their chunk.
+const void *readBakeFrame(BakeReader *reader, int frame, EmitterBatches *batches);
+
+// The checksum frame `frame` was recorded with
+uint64_t bakeFrameChecksum(const BakeReader *reader, int frame);
@@ -0,0 +1,80 @@
+#include "core/cull.h"
+#include "core/jobs.h"
+#include "core/simulation.h"
+
+#include <cfloat>
+
+using namespace glm;
+
+namespace {
+void growBounds(ChunkBounds *bounds, const float *x, const float *y, const float *z,
+                int begin, int end)
+{
+    for (int i = begin; i < end; i++) {
+        bounds->min[0] = glm::min(bounds->min[0], x[i]);
+        bounds->min[1] = glm::min(bounds->min[1], y[i]);
+        bounds->min[2] = glm::min(bounds->min[2], z[i]);
+        bounds->max[0] = glm::max(bounds->max[0], x[i]);
+        bounds->max[1] = glm::max(bounds->max[1], y[i]);
+        bounds->max[2] = glm::max(bounds->max[2], z[i]);
+    }
+}
+} // namespace
+
+int numBounds(int count)
+{
+    return (count + BOUNDS_CHUNK - 1) / BOUNDS_CHUNK;
+}
+
+void updateBounds(Particles *particles, bool previous)
+{
+    int numParticles = particles->numParticles;
+
+    parallelFor(particles->jobPool, 0, numParticles, SIMULATION_CHUNK,
+                [=](int, int begin, int end) {
+        for (int first = begin; first < end; first += BOUNDS_CHUNK) {
+            int last = glm::min(first + BOUNDS_CHUNK, end);
+            ChunkBounds *bounds = &particles->bounds[first / BOUNDS_CHUNK];
+            for (int axis = 0; axis < 3; axis++) {
+                bounds->min[axis] = FLT_MAX;
+                bounds->max[axis] = -FLT_MAX;
+            }
+            growBounds(bounds, particles->posX, particles->posY, particles->posZ, first, last);
+            if (previous) {
+                growBounds(bounds, particles->prevPosX, particles->prevPosY,
+                           particles->prevPosZ, first, last);
+            }
+        }
+    });
+}
+
+void extractFrustum(const mat4 &viewProjection, Frustum *frustum)
+{
+    // Gribb and Hartmann: each plane is the last row of the matrix plus or
+    // minus one of the others. glm matrices are indexed by column.
+    vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i],
+                       viewProjection[3][i]);
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        frustum->planes[2 * axis] = rows[3] + rows[axis];
+        frustum->planes[2 * axis + 1] = rows[3] - rows[axis];
+    }
+}
+
+bool boxInFrustum(const Frustum &frustum, vec3 min, vec3 max)
+{
+    for (int i = 0; i < 6; i++) {
+        const vec4 &plane = frustum.planes[i];
+
+        // The corner farthest along the plane's normal
+        vec3 corner(plane.x >= 0.0f ? max.x : min.x,
+                    plane.y >= 0.0f ? max.y : min.y,
+                    plane.z >= 0.0f ? max.z : min.z);
+        if (dot(vec3(plane), corner) + plane.w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// View frustum culling of the particles. The simulation keeps an
+// axis-aligned box around the positions of every BOUNDS_CHUNK consecutive
+// particles, and the renderer packs and draws only the chunks whose box
+// may intersect the view frustum. Sorted pools are ordered back to front,
+// so their chunks are slabs of depth rather than tight clusters, but
+// whatever is behind the camera or off to the sides still drops out.
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+struct Particles;
+
+// Particles per bounding box. A divisor of SIMULATION_CHUNK.
+#define BOUNDS_CHUNK 1024
+
+struct ChunkBounds {
+    float min[3];
+    float max[3];
+};
+
+// Number of boxes for `count` particles
+int numBounds(int count);
+
+// Recompute the box of every chunk of live particles. With `previous` the
+// boxes also hold the positions before the last step, for interpolated
+// rendering.
+void updateBounds(Particles *particles, bool previous);
+
+// The six planes of the frustum of a view-projection matrix, normals
+// pointing inwards, as (a, b, c, d) with ax + by + cz + d >= 0 inside
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+void extractFrustum(const glm::mat4 &viewProjection, Frustum *frustum);
+
+// Whether any part of the box [min, max] may lie inside the frustum.
+// Conservative: a box near a corner of the frustum can pass without being
+// visible.
+bool boxInFrustum(const Frustum &frustum, glm::vec3 min, glm::vec3 max);
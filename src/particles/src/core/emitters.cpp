@@ -0,0 +1,327 @@
+#include "core/emitters.h"
+#include "core/jobs.h"
+#include "core/timestep.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+
+using namespace std;
+using namespace glm;
+
+namespace {
+// Small pools work on the calling thread, inside their batch's job. Set
+// whenever an emitter's capacity or the registry's job pool changes, never
+// while stepping, so culling and packing thread the same way.
+void assignJobPool(const EmitterRegistry *registry, Emitter *emitter)
+{
+    bool large = emitter->particles->capacity > SIMULATION_CHUNK;
+    emitter->particles->jobPool = large ? registry->jobPool : NULL;
+}
+
+// Run `fn` on every item of `emitters`, which lists emitter indices. The
+// small pools are grouped into batches of at most SIMULATION_CHUNK
+// particles of capacity that run in parallel, one job each. The large ones
+// are split across the job pool one at a time after that.
+void runBatched(EmitterRegistry *registry, const vector<int> &emitters,
+                const function<void(int item)> &fn)
+{
+    vector<int> small;
+    vector<int> large;
+    vector<int> batchBegin;
+    int batchCapacity = 0;
+
+    for (size_t item = 0; item < emitters.size(); item++) {
+        int capacity = registry->emitters[emitters[item]].particles->capacity;
+        if (capacity > SIMULATION_CHUNK) {
+            large.push_back(item);
+            continue;
+        }
+        if (small.empty() || batchCapacity + capacity > SIMULATION_CHUNK) {
+            batchBegin.push_back(small.size());
+            batchCapacity = 0;
+        }
+        small.push_back(item);
+        batchCapacity += capacity;
+    }
+    batchBegin.push_back(small.size());
+
+    int numBatches = batchBegin.size() - 1;
+    parallelFor(registry->jobPool, 0, numBatches, 1, [&](int, int begin, int end) {
+        for (int batch = begin; batch < end; batch++) {
+            for (int i = batchBegin[batch]; i < batchBegin[batch + 1]; i++) {
+                fn(small[i]);
+            }
+        }
+    });
+
+    for (size_t i = 0; i < large.size(); i++) {
+        fn(large[i]);
+    }
+}
+
+vector<int> allEmitters(const EmitterRegistry *registry)
+{
+    vector<int> emitters(registry->emitters.size());
+    for (size_t i = 0; i < emitters.size(); i++) {
+        emitters[i] = i;
+    }
+    return emitters;
+}
+
+// The parameters emitter `index` is stepped with
+EmitterParams stepParams(const EmitterRegistry *registry, int index)
+{
+    EmitterParams params = registry->emitters[index].params;
+    params.sortParticles = params.sortParticles && !registry->skipSort;
+    return params;
+}
+
+void sumSortTime(EmitterRegistry *registry)
+{
+    registry->sortTime = 0.0;
+    for (size_t i = 0; i < registry->emitters.size(); i++) {
+        if (stepParams(registry, i).sortParticles) {
+            registry->sortTime += registry->emitters[i].particles->sortTime;
+        }
+    }
+}
+} // namespace
+
+EmitterRegistry *createEmitterRegistry(unsigned seed, JobPool *jobPool)
+{
+    EmitterRegistry *registry = new EmitterRegistry();
+
+    registry->nextSeed = seed;
+    registry->jobPool = jobPool;
+    registry->sortMode = SORT_RADIX;
+    registry->sortTime = 0.0;
+    registry->skipSort = false;
+
+    return registry;
+}
+
+void destroyEmitterRegistry(EmitterRegistry *registry)
+{
+    for (size_t i = 0; i < registry->emitters.size(); i++) {
+        destroyParticles(registry->emitters[i].particles);
+    }
+    delete registry;
+}
+
+int addEmitter(EmitterRegistry *registry, const EmitterParams &params, vec3 origin,
+               int capacity, bool hugePages)
+{
+    Emitter emitter;
+    emitter.params = params;
+    emitter.origin = origin;
+    emitter.particles = createParticles(registry->nextSeed++, capacity, hugePages);
+    emitter.particles->sortMode = registry->sortMode;
+    assignJobPool(registry, &emitter);
+
+    registry->emitters.push_back(emitter);
+    return registry->emitters.size() - 1;
+}
+
+void removeEmitter(EmitterRegistry *registry, int index)
+{
+    destroyParticles(registry->emitters[index].particles);
+    registry->emitters.erase(registry->emitters.begin() + index);
+}
+
+int numEmitters(const EmitterRegistry *registry)
+{
+    return registry->emitters.size();
+}
+
+void resetEmitters(EmitterRegistry *registry)
+{
+    for (size_t i = 0; i < registry->emitters.size(); i++) {
+        resetParticles(registry->emitters[i].particles);
+    }
+}
+
+void resizeEmitters(EmitterRegistry *registry, int capacity)
+{
+    for (size_t i = 0; i < registry->emitters.size(); i++) {
+        resizeParticles(registry->emitters[i].particles, capacity);
+        assignJobPool(registry, &registry->emitters[i]);
+    }
+}
+
+void setEmitterJobPool(EmitterRegistry *registry, JobPool *jobPool)
+{
+    registry->jobPool = jobPool;
+    for (size_t i = 0; i < registry->emitters.size(); i++) {
+        assignJobPool(registry, &registry->emitters[i]);
+    }
+}
+
+int countEmitterParticles(const EmitterRegistry *registry)
+{
+    int count = 0;
+    for (size_t i = 0; i < registry->emitters.size(); i++) {
+        count += registry->emitters[i].particles->numParticles;
+    }
+    return count;
+}
+
+int emitterCapacity(const EmitterRegistry *registry)
+{
+    int capacity = 0;
+    for (size_t i = 0; i < registry->emitters.size(); i++) {
+        capacity += registry->emitters[i].particles->capacity;
+    }
+    return capacity;
+}
+
+vec3 emitterGridPosition(int index, int count, float spacing)
+{
+    int side = int(std::ceil(std::sqrt(float(count))));
+    float centre = (side - 1) * 0.5f;
+    return vec3((index / side - centre) * spacing, (index % side - centre) * spacing, 0.0f);
+}
+
+void simulateEmitters(EmitterRegistry *registry, vec3 cameraPos, float timeDelta)
+{
+    runBatched(registry, allEmitters(registry), [&](int item) {
+        Emitter *emitter = &registry->emitters[item];
+        emitter->particles->sortMode = registry->sortMode;
+        simulateParticles(emitter->particles, stepParams(registry, item),
+                          cameraPos - emitter->origin, timeDelta);
+    });
+    sumSortTime(registry);
+}
+
+void simulateEmittersFixed(EmitterRegistry *registry, vec3 cameraPos, Timestep *timestep,
+                           float timeDelta)
+{
+    int steps = advanceTimestep(timestep, timeDelta);
+
+    runBatched(registry, allEmitters(registry), [&](int item) {
+        Emitter *emitter = &registry->emitters[item];
+        emitter->particles->sortMode = registry->sortMode;
+        stepParticlesFixed(emitter->particles, stepParams(registry, item),
+                           cameraPos - emitter->origin, steps, timestep->step);
+    });
+    sumSortTime(registry);
+}
+
+void prewarmEmitters(EmitterRegistry *registry, vec3 cameraPos, float seconds, float substep)
+{
+    runBatched(registry, allEmitters(registry), [&](int item) {
+        Emitter *emitter = &registry->emitters[item];
+        emitter->particles->sortMode = registry->sortMode;
+        prewarmParticles(emitter->particles, stepParams(registry, item),
+                         cameraPos - emitter->origin, seconds, substep);
+    });
+    sumSortTime(registry);
+}
+
+void batchEmitters(const EmitterRegistry *registry, vec3 cameraPos, EmitterBatches *batches,
+                   const Frustum *frustum)
+{
+    // Farthest first, ties in registry order
+    vector<pair<float, int> > blended;
+    vector<int> added;
+    for (size_t i = 0; i < registry->emitters.size(); i++) {
+        const Emitter &emitter = registry->emitters[i];
+        if (emitter.particles->numParticles == 0) {
+            continue;
+        }
+        if (emitter.params.add) {
+            added.push_back(i);
+        } else {
+            blended.push_back(make_pair(-distance(cameraPos, emitter.origin), int(i)));
+        }
+    }
+    sort(blended.begin(), blended.end());
+
+    batches->segments.clear();
+    batches->ranges.clear();
+    batches->numInstances = 0;
+    batches->numCulled = 0;
+    batches->numChunks = 0;
+    batches->numCulledChunks = 0;
+
+    for (int group = 0; group < NUM_BLEND_GROUPS; group++) {
+        batches->groupBegin[group] = batches->segments.size();
+        size_t count = group == BLEND_ALPHA ? blended.size() : added.size();
+        for (size_t i = 0; i < count; i++) {
+            int index = group == BLEND_ALPHA ? blended[i].second : added[i];
+            const Emitter &emitter = registry->emitters[index];
+            const Particles *particles = emitter.particles;
+
+            EmitterSegment segment;
+            segment.emitter = index;
+            segment.first = batches->numInstances;
+            segment.count = 0;
+            segment.firstRange = batches->ranges.size();
+
+            // Half the diagonal of the largest billboard, as particle.vert
+            // sizes them
+            float size = glm::max(emitter.params.initSize, emitter.params.finalSize);
+            vec3 margin(size * (0.5f / 0.9f) * 1.4142136f);
+
+            int chunks = numBounds(particles->numParticles);
+            for (int chunk = 0; chunk < chunks; chunk++) {
+                int begin = chunk * BOUNDS_CHUNK;
+                int end = glm::min(begin + BOUNDS_CHUNK, particles->numParticles);
+
+                if (frustum != NULL) {
+                    const ChunkBounds &bounds = particles->bounds[chunk];
+                    vec3 min = emitter.origin + vec3(bounds.min[0], bounds.min[1], bounds.min[2]);
+                    vec3 max = emitter.origin + vec3(bounds.max[0], bounds.max[1], bounds.max[2]);
+                    if (!boxInFrustum(*frustum, min - margin, max + margin)) {
+                        batches->numCulled += end - begin;
+                        batches->numCulledChunks++;
+                        continue;
+                    }
+                }
+
+                // Neighbouring visible chunks make one range
+                if (batches->ranges.size() > size_t(segment.firstRange) &&
+                    batches->ranges.back().end == begin) {
+                    batches->ranges.back().end = end;
+                } else {
+                    ParticleRange range = { begin, end };
+                    batches->ranges.push_back(range);
+                }
+                segment.count += end - begin;
+            }
+            batches->numChunks += chunks;
+
+            segment.numRanges = batches->ranges.size() - segment.firstRange;
+            if (segment.count > 0) {
+                batches->segments.push_back(segment);
+                batches->numInstances += segment.count;
+            }
+        }
+    }
+    batches->groupBegin[NUM_BLEND_GROUPS] = batches->segments.size();
+}
+
+void packEmitters(EmitterRegistry *registry, const EmitterBatches &batches,
+                  InstanceFormat format, void *instances, float alpha)
+{
+    vector<int> emitters(batches.segments.size());
+    for (size_t i = 0; i < emitters.size(); i++) {
+        emitters[i] = batches.segments[i].emitter;
+    }
+
+    unsigned char *out = static_cast<unsigned char *>(instances);
+    size_t stride = instanceStride(format);
+    runBatched(registry, emitters, [&](int item) {
+        const EmitterSegment &segment = batches.segments[item];
+        Particles *particles = registry->emitters[segment.emitter].particles;
+
+        int instance = segment.first;
+        for (int i = segment.firstRange; i < segment.firstRange + segment.numRanges; i++) {
+            const ParticleRange &range = batches.ranges[i];
+            packParticleRange(particles, format, out + instance * stride, range.begin,
+                              range.end, alpha);
+            instance += range.end - range.begin;
+        }
+    });
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+// A registry of emitters that are simulated and drawn together. Every
+// emitter owns its parameters and its particle pool, and simulates its
+// particles relative to its origin: the forces do not depend on where the
+// particles are, so moving an emitter moves its particles with it and the
+// render pass adds the origin back.
+//
+// Simulation is batched across the emitters. Pools no larger than a
+// simulation chunk are grouped into batches of about SIMULATION_CHUNK
+// particles, one job each, and the larger pools are split across the job
+// pool one emitter at a time as before.
+
+#include "core/cull.h"
+#include "core/pack.h"
+#include "core/simulation.h"
+
+#include <vector>
+
+struct Emitter {
+    EmitterParams params;
+    glm::vec3 origin;
+    Particles *particles;
+};
+
+struct EmitterRegistry {
+    std::vector<Emitter> emitters;
+
+    // Seed of the next emitter's pool
+    unsigned nextSeed;
+
+    // Worker threads, NULL runs everything on the calling thread. Not owned,
+    // change it with setEmitterJobPool.
+    JobPool *jobPool;
+
+    SortMode sortMode;
+    double sortTime;  // Milliseconds the last step spent sorting, summed
+
+    // Leave every pool unsorted, for a renderer that does not depend on the
+    // draw order
+    bool skipSort;
+};
+
+// The emitters added to an empty registry get the seeds `seed`, `seed + 1`
+// and so on, so the first one emits the same particles as a pool created
+// with `seed`
+EmitterRegistry *createEmitterRegistry(unsigned seed, JobPool *jobPool = NULL);
+
+void destroyEmitterRegistry(EmitterRegistry *registry);
+
+// Add an emitter at `origin` with room for `capacity` particles, returns its
+// index
+int addEmitter(EmitterRegistry *registry, const EmitterParams &params, glm::vec3 origin,
+               int capacity = DEFAULT_CAPACITY, bool hugePages = true);
+
+// Remove emitter `index`, the ones after it move down by one
+void removeEmitter(EmitterRegistry *registry, int index);
+
+int numEmitters(const EmitterRegistry *registry);
+
+// Start every emitter over
+void resetEmitters(EmitterRegistry *registry);
+
+// Give every emitter room for `capacity` particles
+void resizeEmitters(EmitterRegistry *registry, int capacity);
+
+// Run the emitters on `jobPool` from now on. The pools larger than a
+// simulation chunk keep it for culling and packing as well.
+void setEmitterJobPool(EmitterRegistry *registry, JobPool *jobPool);
+
+int countEmitterParticles(const EmitterRegistry *registry);
+
+int emitterCapacity(const EmitterRegistry *registry);
+
+// Origin of emitter `index` of `count` on a square grid in the ground plane,
+// `spacing` apart and centred on the world origin
+glm::vec3 emitterGridPosition(int index, int count, float spacing);
+
+// simulateParticles for every emitter
+void simulateEmitters(EmitterRegistry *registry, glm::vec3 cameraPos, float timeDelta);
+
+// simulateParticlesFixed for every emitter, all on the same timestep
+void simulateEmittersFixed(EmitterRegistry *registry, glm::vec3 cameraPos,
+                           Timestep *timestep, float timeDelta);
+
+// prewarmParticles for every emitter, the small pools in parallel
+void prewarmEmitters(EmitterRegistry *registry, glm::vec3 cameraPos, float seconds,
+                     float substep = PREWARM_SUBSTEP);
+
+// How the particles of an emitter are blended into the frame
+enum BlendGroup {
+    BLEND_ALPHA,
+    BLEND_ADD,
+    NUM_BLEND_GROUPS
+};
+
+// Slots [begin, end) of an emitter's pool
+struct ParticleRange {
+    int begin;
+    int end;
+};
+
+// The instances of one emitter in the packed instance data
+struct EmitterSegment {
+    int emitter;
+    int first;  // Index of the first instance
+    int count;
+
+    // The visible particles, packed one range after the other
+    int firstRange;
+    int numRanges;
+};
+
+// The order the emitters are packed and drawn in. The segments of a blend
+// group are contiguous, so each group is drawn with one instanced call.
+struct EmitterBatches {
+    // The segments of group g are [groupBegin[g], groupBegin[g + 1]) and
+    // their instances follow each other
+    std::vector<EmitterSegment> segments;
+    int groupBegin[NUM_BLEND_GROUPS + 1];
+    std::vector<ParticleRange> ranges;
+    int numInstances;
+
+    // What culling left out
+    int numCulled;
+    int numChunks;
+    int numCulledChunks;
+};
+
+// Order the emitters with visible particles for drawing. Additive blending
+// does not depend on the order; the alpha blended emitters are ordered
+// back to front by the distance of their origin, each one sorts its own
+// particles.
+//
+// With a frustum only the chunks whose bounds, grown by the emitter's
+// largest billboard, intersect it are kept. Without one every live
+// particle is.
+void batchEmitters(const EmitterRegistry *registry, glm::vec3 cameraPos,
+                   EmitterBatches *batches, const Frustum *frustum = NULL);
+
+// packParticleRange for every range of every segment of `batches`, each
+// segment from its first instance on
+void packEmitters(EmitterRegistry *registry, const EmitterBatches &batches,
+                  InstanceFormat format, void *instances, float alpha = 1.0f);
@@ -0,0 +1,178 @@
+#include "core/integrate.h"
+#include "core/simulation.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define PARTICLES_X86 1
+#endif
+
+IntegrateResult integrateScalar(Particles *particles, int begin, int end,
+                                const IntegrateParams &params)
+{
+    const float *speedX = particles->speedX;
+    const float *speedY = particles->speedY;
+    float *speedZ = particles->speedZ;
+    float *cameraDistance = particles->cameraDistance;
+    float *posX = particles->posX;
+    float *posY = particles->posY;
+    float *posZ = particles->posZ;
+    float *sizes = particles->sizes;
+    float *lives = particles->lives;
+    const float *initLives = particles->initLives;
+
+    float delta = params.delta;
+    float gravity = params.gravity * delta * 0.5f;
+
+    IntegrateResult result = { 0, 0 };
+
+    for (int i = begin; i < end; i++) {
+
+        if (lives[i] > 0.0f) {
+
+            lives[i] -= delta;
+
+            // Normalized age
+            float age = (initLives[i] - lives[i]) / initLives[i];
+
+            float wind = params.wind * age;
+
+            speedZ[i] += gravity;
+
+            posX[i] += speedX[i] * delta;
+            posY[i] += (speedY[i] + wind) * delta;
+            posZ[i] += speedZ[i] * delta;
+
+            float dx = posX[i] - params.cameraX;
+            float dy = posY[i] - params.cameraY;
+            float dz = posZ[i] - params.cameraZ;
+            cameraDistance[i] = dx*dx + dy*dy + dz*dz;
+
+            sizes[i] = (1-age) * params.initSize + age * params.finalSize;
+
+            result.numParticles++;
+            if (lives[i] <= 0.0f) {
+                result.numExpired++;
+            }
+
+        } else {
+            cameraDistance[i] = -1.0f;
+        }
+    }
+
+    return result;
+}
+
+const char *simdLevelName(SimdLevel level)
+{
+    switch (level) {
+    case SIMD_SCALAR: return "scalar";
+    case SIMD_SSE2: return "sse2";
+    case SIMD_AVX2: return "avx2";
+    case SIMD_AVX512: return "avx512";
+    default: return "unknown";
+    }
+}
+
+namespace {
+#ifdef PARTICLES_X86
+// Which register states the operating system saves on context switches
+unsigned long long readXCR0()
+{
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+}
+#endif
+
+SimdLevel queryCPU()
+{
+#ifdef PARTICLES_X86
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return SIMD_SCALAR;
+    }
+
+    SimdLevel level = SIMD_SCALAR;
+    if (edx & bit_SSE2) {
+        level = SIMD_SSE2;
+    }
+
+    // AVX needs the OS to save the YMM registers
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+        return level;
+    }
+    unsigned long long xcr0 = readXCR0();
+    if ((xcr0 & 0x6) != 0x6) {
+        return level;
+    }
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return level;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (ebx & bit_AVX2) {
+        level = SIMD_AVX2;
+    }
+    // AVX-512 additionally needs the opmask and ZMM state
+    if ((ebx & bit_AVX512F) && (xcr0 & 0xe6) == 0xe6) {
+        level = SIMD_AVX512;
+    }
+    return level;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+// F16C has its own CPUID bit, which a hypervisor may clear while it
+// reports AVX2
+bool queryF16C()
+{
+#ifdef PARTICLES_X86
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C);
+#else
+    return false;
+#endif
+}
+
+SimdLevel activeLevel = NUM_SIMD_LEVELS;
+} // namespace
+
+SimdLevel detectSimdLevel()
+{
+    static SimdLevel detected = queryCPU();
+    return detected;
+}
+
+bool detectF16C()
+{
+    static bool detected = queryF16C();
+    return detected;
+}
+
+IntegrateKernel integrateKernel(SimdLevel level)
+{
+    if (level > detectSimdLevel()) {
+        level = detectSimdLevel();
+    }
+
+    switch (level) {
+    case SIMD_SSE2: return integrateSSE2;
+    case SIMD_AVX2: return integrateAVX2;
+    case SIMD_AVX512: return integrateAVX512;
+    default: return integrateScalar;
+    }
+}
+
+SimdLevel activeSimdLevel()
+{
+    if (activeLevel == NUM_SIMD_LEVELS) {
+        activeLevel = detectSimdLevel();
+    }
+    return activeLevel;
+}
+
+void setActiveSimdLevel(SimdLevel level)
+{
+    activeLevel = level > detectSimdLevel() ? detectSimdLevel() : level;
+}
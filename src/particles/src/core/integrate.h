@@ -0,0 +1,61 @@
+#pragma once
+
+// Per-particle integration kernels. Every kernel performs exactly the same
+// arithmetic as the scalar reference, in the same order, so all of them
+// produce bit-identical results.
+
+struct Particles;
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    NUM_SIMD_LEVELS
+};
+
+struct IntegrateParams {
+    float delta;
+    float gravity;
+    float wind;
+    float initSize;
+    float finalSize;
+    float cameraX;
+    float cameraY;
+    float cameraZ;
+};
+
+struct IntegrateResult {
+    int numParticles;  // Particles that were live at the start of the step
+    int numExpired;    // Of those, the ones whose life ran out during it
+};
+
+// Integrate the slots [begin, end) of `particles`
+typedef IntegrateResult (*IntegrateKernel)(Particles *particles, int begin, int end,
+                                           const IntegrateParams &params);
+
+IntegrateResult integrateScalar(Particles *particles, int begin, int end,
+                                const IntegrateParams &params);
+IntegrateResult integrateSSE2(Particles *particles, int begin, int end,
+                              const IntegrateParams &params);
+IntegrateResult integrateAVX2(Particles *particles, int begin, int end,
+                              const IntegrateParams &params);
+IntegrateResult integrateAVX512(Particles *particles, int begin, int end,
+                                const IntegrateParams &params);
+
+const char *simdLevelName(SimdLevel level);
+
+// Highest level supported by both the CPU and the operating system
+SimdLevel detectSimdLevel();
+
+// Whether the CPU converts to and from half floats (F16C). Its 256-bit
+// forms also need the YMM state of SIMD_AVX2.
+bool detectF16C();
+
+// Kernel for `level`, which must not exceed detectSimdLevel()
+IntegrateKernel integrateKernel(SimdLevel level);
+
+// The level simulateParticles uses. Defaults to detectSimdLevel(); requests
+// above what the CPU supports are clamped.
+SimdLevel activeSimdLevel();
+void setActiveSimdLevel(SimdLevel level);
@@ -0,0 +1,297 @@
+// Vectorized versions of integrateScalar. Each function is compiled for its
+// own instruction set with target attributes and only called after
+// detectSimdLevel() has confirmed support.
+//
+// Free lanes are computed along with the live ones and then discarded, so
+// the live lanes see exactly the operations of the scalar loop.
+
+#include "core/integrate.h"
+#include "core/simulation.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+namespace {
+// Count the live and the expiring lanes of a vector
+inline void accumulate(IntegrateResult *result, unsigned live, unsigned expired)
+{
+    result->numParticles += __builtin_popcount(live);
+    result->numExpired += __builtin_popcount(expired);
+}
+
+inline void merge(IntegrateResult *result, const IntegrateResult &tail)
+{
+    result->numParticles += tail.numParticles;
+    result->numExpired += tail.numExpired;
+}
+
+__attribute__((target("sse2")))
+inline __m128 select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+} // namespace
+
+__attribute__((target("sse2")))
+IntegrateResult integrateSSE2(Particles *particles, int begin, int end,
+                              const IntegrateParams &params)
+{
+    const float *speedX = particles->speedX;
+    const float *speedY = particles->speedY;
+    float *speedZ = particles->speedZ;
+    float *cameraDistance = particles->cameraDistance;
+    float *posX = particles->posX;
+    float *posY = particles->posY;
+    float *posZ = particles->posZ;
+    float *sizes = particles->sizes;
+    float *lives = particles->lives;
+    const float *initLives = particles->initLives;
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 freeDistance = _mm_set1_ps(-1.0f);
+    const __m128 delta = _mm_set1_ps(params.delta);
+    const __m128 gravity = _mm_set1_ps(params.gravity * params.delta * 0.5f);
+    const __m128 windY = _mm_set1_ps(params.wind);
+    const __m128 initSize = _mm_set1_ps(params.initSize);
+    const __m128 finalSize = _mm_set1_ps(params.finalSize);
+    const __m128 cameraX = _mm_set1_ps(params.cameraX);
+    const __m128 cameraY = _mm_set1_ps(params.cameraY);
+    const __m128 cameraZ = _mm_set1_ps(params.cameraZ);
+
+    IntegrateResult result = { 0, 0 };
+
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 life = _mm_loadu_ps(lives + i);
+        __m128 live = _mm_cmpgt_ps(life, zero);
+        unsigned mask = _mm_movemask_ps(live);
+
+        if (mask == 0) {
+            _mm_storeu_ps(cameraDistance + i, freeDistance);
+            continue;
+        }
+
+        __m128 initLife = _mm_loadu_ps(initLives + i);
+        life = _mm_sub_ps(life, delta);
+        __m128 age = _mm_div_ps(_mm_sub_ps(initLife, life), initLife);
+        __m128 wind = _mm_mul_ps(windY, age);
+
+        __m128 oldSpeedZ = _mm_loadu_ps(speedZ + i);
+        __m128 vz = _mm_add_ps(oldSpeedZ, gravity);
+
+        __m128 oldX = _mm_loadu_ps(posX + i);
+        __m128 oldY = _mm_loadu_ps(posY + i);
+        __m128 oldZ = _mm_loadu_ps(posZ + i);
+        __m128 x = _mm_add_ps(oldX, _mm_mul_ps(_mm_loadu_ps(speedX + i), delta));
+        __m128 y = _mm_add_ps(oldY, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(speedY + i), wind), delta));
+        __m128 z = _mm_add_ps(oldZ, _mm_mul_ps(vz, delta));
+
+        __m128 dx = _mm_sub_ps(x, cameraX);
+        __m128 dy = _mm_sub_ps(y, cameraY);
+        __m128 dz = _mm_sub_ps(z, cameraZ);
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                     _mm_mul_ps(dz, dz));
+
+        __m128 size = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, age), initSize),
+                                 _mm_mul_ps(age, finalSize));
+
+        _mm_storeu_ps(lives + i, select(live, life, _mm_loadu_ps(lives + i)));
+        _mm_storeu_ps(speedZ + i, select(live, vz, oldSpeedZ));
+        _mm_storeu_ps(posX + i, select(live, x, oldX));
+        _mm_storeu_ps(posY + i, select(live, y, oldY));
+        _mm_storeu_ps(posZ + i, select(live, z, oldZ));
+        _mm_storeu_ps(sizes + i, select(live, size, _mm_loadu_ps(sizes + i)));
+        _mm_storeu_ps(cameraDistance + i, select(live, distance, freeDistance));
+
+        accumulate(&result, mask, _mm_movemask_ps(_mm_and_ps(live, _mm_cmple_ps(life, zero))));
+    }
+
+    merge(&result, integrateScalar(particles, i, end, params));
+
+    return result;
+}
+
+__attribute__((target("avx2")))
+IntegrateResult integrateAVX2(Particles *particles, int begin, int end,
+                              const IntegrateParams &params)
+{
+    const float *speedX = particles->speedX;
+    const float *speedY = particles->speedY;
+    float *speedZ = particles->speedZ;
+    float *cameraDistance = particles->cameraDistance;
+    float *posX = particles->posX;
+    float *posY = particles->posY;
+    float *posZ = particles->posZ;
+    float *sizes = particles->sizes;
+    float *lives = particles->lives;
+    const float *initLives = particles->initLives;
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 freeDistance = _mm256_set1_ps(-1.0f);
+    const __m256 delta = _mm256_set1_ps(params.delta);
+    const __m256 gravity = _mm256_set1_ps(params.gravity * params.delta * 0.5f);
+    const __m256 windY = _mm256_set1_ps(params.wind);
+    const __m256 initSize = _mm256_set1_ps(params.initSize);
+    const __m256 finalSize = _mm256_set1_ps(params.finalSize);
+    const __m256 cameraX = _mm256_set1_ps(params.cameraX);
+    const __m256 cameraY = _mm256_set1_ps(params.cameraY);
+    const __m256 cameraZ = _mm256_set1_ps(params.cameraZ);
+
+    IntegrateResult result = { 0, 0 };
+
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 oldLife = _mm256_loadu_ps(lives + i);
+        __m256 live = _mm256_cmp_ps(oldLife, zero, _CMP_GT_OQ);
+        unsigned mask = _mm256_movemask_ps(live);
+
+        if (mask == 0) {
+            _mm256_storeu_ps(cameraDistance + i, freeDistance);
+            continue;
+        }
+
+        __m256 initLife = _mm256_loadu_ps(initLives + i);
+        __m256 life = _mm256_sub_ps(oldLife, delta);
+        __m256 age = _mm256_div_ps(_mm256_sub_ps(initLife, life), initLife);
+        __m256 wind = _mm256_mul_ps(windY, age);
+
+        __m256 oldSpeedZ = _mm256_loadu_ps(speedZ + i);
+        __m256 vz = _mm256_add_ps(oldSpeedZ, gravity);
+
+        __m256 oldX = _mm256_loadu_ps(posX + i);
+        __m256 oldY = _mm256_loadu_ps(posY + i);
+        __m256 oldZ = _mm256_loadu_ps(posZ + i);
+        __m256 x = _mm256_add_ps(oldX, _mm256_mul_ps(_mm256_loadu_ps(speedX + i), delta));
+        __m256 y = _mm256_add_ps(oldY, _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(speedY + i), wind), delta));
+        __m256 z = _mm256_add_ps(oldZ, _mm256_mul_ps(vz, delta));
+
+        __m256 dx = _mm256_sub_ps(x, cameraX);
+        __m256 dy = _mm256_sub_ps(y, cameraY);
+        __m256 dz = _mm256_sub_ps(z, cameraZ);
+        __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                        _mm256_mul_ps(dz, dz));
+
+        __m256 size = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, age), initSize),
+                                    _mm256_mul_ps(age, finalSize));
+
+        _mm256_storeu_ps(lives + i, _mm256_blendv_ps(oldLife, life, live));
+        _mm256_storeu_ps(speedZ + i, _mm256_blendv_ps(oldSpeedZ, vz, live));
+        _mm256_storeu_ps(posX + i, _mm256_blendv_ps(oldX, x, live));
+        _mm256_storeu_ps(posY + i, _mm256_blendv_ps(oldY, y, live));
+        _mm256_storeu_ps(posZ + i, _mm256_blendv_ps(oldZ, z, live));
+        _mm256_storeu_ps(sizes + i, _mm256_blendv_ps(_mm256_loadu_ps(sizes + i), size, live));
+        _mm256_storeu_ps(cameraDistance + i, _mm256_blendv_ps(freeDistance, distance, live));
+
+        accumulate(&result, mask,
+                   _mm256_movemask_ps(_mm256_and_ps(live, _mm256_cmp_ps(life, zero, _CMP_LE_OQ))));
+    }
+
+    merge(&result, integrateScalar(particles, i, end, params));
+
+    return result;
+}
+
+__attribute__((target("avx512f")))
+IntegrateResult integrateAVX512(Particles *particles, int begin, int end,
+                                const IntegrateParams &params)
+{
+    const float *speedX = particles->speedX;
+    const float *speedY = particles->speedY;
+    float *speedZ = particles->speedZ;
+    float *cameraDistance = particles->cameraDistance;
+    float *posX = particles->posX;
+    float *posY = particles->posY;
+    float *posZ = particles->posZ;
+    float *sizes = particles->sizes;
+    float *lives = particles->lives;
+    const float *initLives = particles->initLives;
+
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 freeDistance = _mm512_set1_ps(-1.0f);
+    const __m512 delta = _mm512_set1_ps(params.delta);
+    const __m512 gravity = _mm512_set1_ps(params.gravity * params.delta * 0.5f);
+    const __m512 windY = _mm512_set1_ps(params.wind);
+    const __m512 initSize = _mm512_set1_ps(params.initSize);
+    const __m512 finalSize = _mm512_set1_ps(params.finalSize);
+    const __m512 cameraX = _mm512_set1_ps(params.cameraX);
+    const __m512 cameraY = _mm512_set1_ps(params.cameraY);
+    const __m512 cameraZ = _mm512_set1_ps(params.cameraZ);
+
+    IntegrateResult result = { 0, 0 };
+
+    // The tail is handled with a partial lane mask instead of a scalar loop
+    for (int i = begin; i < end; i += 16) {
+        __mmask16 lanes = end - i >= 16 ? 0xffff : (__mmask16)((1u << (end - i)) - 1);
+
+        __m512 life = _mm512_maskz_loadu_ps(lanes, lives + i);
+        __mmask16 live = _mm512_mask_cmp_ps_mask(lanes, life, zero, _CMP_GT_OQ);
+
+        if (live == 0) {
+            _mm512_mask_storeu_ps(cameraDistance + i, lanes, freeDistance);
+            continue;
+        }
+
+        __m512 initLife = _mm512_maskz_loadu_ps(live, initLives + i);
+        life = _mm512_sub_ps(life, delta);
+        __m512 age = _mm512_maskz_div_ps(live, _mm512_sub_ps(initLife, life), initLife);
+        __m512 wind = _mm512_mul_ps(windY, age);
+
+        __m512 vz = _mm512_add_ps(_mm512_maskz_loadu_ps(live, speedZ + i), gravity);
+
+        __m512 x = _mm512_add_ps(_mm512_maskz_loadu_ps(live, posX + i),
+                                 _mm512_mul_ps(_mm512_maskz_loadu_ps(live, speedX + i), delta));
+        __m512 y = _mm512_add_ps(_mm512_maskz_loadu_ps(live, posY + i),
+                                 _mm512_mul_ps(_mm512_add_ps(_mm512_maskz_loadu_ps(live, speedY + i), wind), delta));
+        __m512 z = _mm512_add_ps(_mm512_maskz_loadu_ps(live, posZ + i), _mm512_mul_ps(vz, delta));
+
+        __m512 dx = _mm512_sub_ps(x, cameraX);
+        __m512 dy = _mm512_sub_ps(y, cameraY);
+        __m512 dz = _mm512_sub_ps(z, cameraZ);
+        __m512 distance = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+                                        _mm512_mul_ps(dz, dz));
+
+        __m512 size = _mm512_add_ps(_mm512_mul_ps(_mm512_sub_ps(one, age), initSize),
+                                    _mm512_mul_ps(age, finalSize));
+
+        _mm512_mask_storeu_ps(lives + i, live, life);
+        _mm512_mask_storeu_ps(speedZ + i, live, vz);
+        _mm512_mask_storeu_ps(posX + i, live, x);
+        _mm512_mask_storeu_ps(posY + i, live, y);
+        _mm512_mask_storeu_ps(posZ + i, live, z);
+        _mm512_mask_storeu_ps(sizes + i, live, size);
+        _mm512_mask_storeu_ps(cameraDistance + i, lanes,
+                              _mm512_mask_blend_ps(live, freeDistance, distance));
+
+        accumulate(&result, live, _mm512_mask_cmp_ps_mask(live, life, zero, _CMP_LE_OQ));
+    }
+
+    return result;
+}
+
+#else
+
+// No vector kernels on other architectures, detectSimdLevel() never reports
+// them but the symbols still have to exist
+IntegrateResult integrateSSE2(Particles *particles, int begin, int end,
+                              const IntegrateParams &params)
+{
+    return integrateScalar(particles, begin, end, params);
+}
+
+IntegrateResult integrateAVX2(Particles *particles, int begin, int end,
+                              const IntegrateParams &params)
+{
+    return integrateScalar(particles, begin, end, params);
+}
+
+IntegrateResult integrateAVX512(Particles *particles, int begin, int end,
+                                const IntegrateParams &params)
+{
+    return integrateScalar(particles, begin, end, params);
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include "core/jobs.h"
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Job {
+    const ChunkFunction *fn;
+    int chunk;
+    int begin;
+    int end;
+    std::atomic<int> *remaining;
+};
+
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+} // namespace
+
+struct JobPool {
+    int numThreads;
+    std::vector<std::thread> workers;
+
+    // One queue per thread, queue 0 belongs to the thread calling parallelFor
+    std::vector<WorkQueue> queues;
+
+    // Sleeping workers wait for queued jobs or shutdown
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<int> queued;
+    bool quit;
+
+    JobPool(int threads) : numThreads(threads), queues(threads), queued(0), quit(false) {}
+};
+
+namespace {
+// Take a job from our own queue, or steal one from another thread
+bool takeJob(JobPool *pool, int self, Job *job)
+{
+    {
+        WorkQueue &own = pool->queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            *job = own.jobs.back();
+            own.jobs.pop_back();
+            pool->queued--;
+            return true;
+        }
+    }
+
+    for (int i = 1; i < pool->numThreads; i++) {
+        WorkQueue &victim = pool->queues[(self + i) % pool->numThreads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            *job = victim.jobs.front();
+            victim.jobs.pop_front();
+            pool->queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void runJob(const Job &job)
+{
+    {
+        ProfileScope scope(PHASE_JOB);
+        (*job.fn)(job.chunk, job.begin, job.end);
+    }
+    job.remaining->fetch_sub(1);
+}
+
+void workerLoop(JobPool *pool, int self)
+{
+    for (;;) {
+        Job job;
+        if (takeJob(pool, self, &job)) {
+            runJob(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(pool->sleepMutex);
+        pool->wake.wait(lock, [pool]() { return pool->quit || pool->queued > 0; });
+        if (pool->quit) {
+            return;
+        }
+    }
+}
+} // namespace
+
+JobPool *createJobPool(int numThreads)
+{
+    if (numThreads < 1) {
+        numThreads = 1;
+    }
+
+    JobPool *pool = new JobPool(numThreads);
+    for (int i = 1; i < numThreads; i++) {
+        pool->workers.push_back(std::thread(workerLoop, pool, i));
+    }
+    return pool;
+}
+
+void destroyJobPool(JobPool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->sleepMutex);
+        pool->quit = true;
+    }
+    pool->wake.notify_all();
+
+    for (size_t i = 0; i < pool->workers.size(); i++) {
+        pool->workers[i].join();
+    }
+    delete pool;
+}
+
+int jobPoolThreads(const JobPool *pool)
+{
+    return pool == NULL ? 1 : pool->numThreads;
+}
+
+int numChunks(int begin, int end, int chunkSize)
+{
+    return end > begin ? (end - begin + chunkSize - 1) / chunkSize : 0;
+}
+
+void parallelFor(JobPool *pool, int begin, int end, int chunkSize,
+                 const ChunkFunction &fn)
+{
+    int chunks = numChunks(begin, end, chunkSize);
+
+    if (pool == NULL || pool->numThreads == 1 || chunks <= 1) {
+        for (int chunk = 0; chunk < chunks; chunk++) {
+            int chunkBegin = begin + chunk * chunkSize;
+            fn(chunk, chunkBegin, std::min(chunkBegin + chunkSize, end));
+        }
+        return;
+    }
+
+    std::atomic<int> remaining(chunks);
+
+    // Give every thread a contiguous run of chunks, idle threads steal the
+    // rest
+    int numThreads = pool->numThreads;
+    for (int thread = 0; thread < numThreads; thread++) {
+        int first = chunks * thread / numThreads;
+        int last = chunks * (thread + 1) / numThreads;
+
+        WorkQueue &queue = pool->queues[thread];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        // Pushed in reverse so the owner, which pops from the back, walks
+        // its run front to back
+        for (int chunk = last - 1; chunk >= first; chunk--) {
+            int chunkBegin = begin + chunk * chunkSize;
+            Job job = { &fn, chunk, chunkBegin, std::min(chunkBegin + chunkSize, end), &remaining };
+            queue.jobs.push_back(job);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->sleepMutex);
+        pool->queued += chunks;
+    }
+    pool->wake.notify_all();
+
+    // Help out until every chunk is done
+    while (remaining > 0) {
+        Job job;
+        if (takeJob(pool, 0, &job)) {
+            runJob(job);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// A small work-stealing thread pool. Each worker owns a queue of jobs, takes
+// work from the back of its own queue and steals from the front of the
+// others when it runs dry.
+
+#include <functional>
+
+struct JobPool;
+
+// Called with the chunk index and the [begin, end) range of the chunk
+typedef std::function<void(int chunk, int begin, int end)> ChunkFunction;
+
+// A pool with `numThreads` threads in total, counting the thread that calls
+// parallelFor. With one thread everything runs on the calling thread.
+JobPool *createJobPool(int numThreads);
+
+void destroyJobPool(JobPool *pool);
+
+int jobPoolThreads(const JobPool *pool);
+
+// Number of chunks parallelFor splits [begin, end) into
+int numChunks(int begin, int end, int chunkSize);
+
+// Run `fn` on every `chunkSize` sized piece of [begin, end) and wait for all
+// of them to finish. The calling thread works on chunks as well. `pool` may
+// be NULL to run serially. Must not be called from inside a job.
+void parallelFor(JobPool *pool, int begin, int end, int chunkSize,
+                 const ChunkFunction &fn);
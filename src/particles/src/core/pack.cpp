@@ -0,0 +1,194 @@
+#include "core/pack.h"
+#include "core/integrate.h"
+#include "core/jobs.h"
+#include "core/profiler.h"
+#include "core/simulation.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PARTICLES_X86 1
+#endif
+
+namespace {
+inline uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline float bitsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline uint16_t lifeFraction(float life, float initLife)
+{
+    float fraction = glm::clamp(life / initLife, 0.0f, 1.0f);
+    return uint16_t(fraction * 65535.0f + 0.5f);
+}
+
+// Where the packed positions come from: the current positions, or a point
+// between the previous and the current ones
+struct PositionSource {
+    const float *pos[3];
+    const float *prevPos[3];
+    float alpha;
+    bool interpolate;
+
+    float at(int axis, int i) const
+    {
+        if (!interpolate) {
+            return pos[axis][i];
+        }
+        return prevPos[axis][i] + (pos[axis][i] - prevPos[axis][i]) * alpha;
+    }
+};
+
+// The kernels write slot i of [begin, end) to out[i - begin]
+void packHalf(const Particles *particles, const PositionSource &source, int begin, int end,
+              InstanceHalf *out)
+{
+    for (int i = begin; i < end; i++) {
+        InstanceHalf *instance = &out[i - begin];
+        instance->position[0] = floatToHalf(source.at(0, i));
+        instance->position[1] = floatToHalf(source.at(1, i));
+        instance->position[2] = floatToHalf(source.at(2, i));
+        instance->life = lifeFraction(particles->lives[i], particles->initLives[i]);
+        memcpy(instance->colour, particles->colours + 4 * i, 4);
+    }
+}
+
+void packFloat(const Particles *particles, const PositionSource &source, int begin, int end,
+               InstanceFloat *out)
+{
+    for (int i = begin; i < end; i++) {
+        InstanceFloat *instance = &out[i - begin];
+        instance->position[0] = source.at(0, i);
+        instance->position[1] = source.at(1, i);
+        instance->position[2] = source.at(2, i);
+        instance->life = lifeFraction(particles->lives[i], particles->initLives[i]);
+        instance->padding = 0;
+        memcpy(instance->colour, particles->colours + 4 * i, 4);
+    }
+}
+
+#ifdef PARTICLES_X86
+// Convert eight positions at a time with F16C, on CPUs with AVX2 that
+// report it. Its round to nearest even matches floatToHalf bit for bit, and the
+// interpolation is the same arithmetic as PositionSource::at.
+__attribute__((target("avx2,f16c")))
+void packHalfF16C(const Particles *particles, const PositionSource &source, int begin, int end,
+                  InstanceHalf *out)
+{
+    const __m256 alpha = _mm256_set1_ps(source.alpha);
+
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        uint16_t halves[3][8];
+        for (int axis = 0; axis < 3; axis++) {
+            __m256 pos = _mm256_loadu_ps(source.pos[axis] + i);
+            if (source.interpolate) {
+                __m256 prev = _mm256_loadu_ps(source.prevPos[axis] + i);
+                pos = _mm256_add_ps(prev, _mm256_mul_ps(_mm256_sub_ps(pos, prev), alpha));
+            }
+            _mm_storeu_si128((__m128i *)halves[axis], _mm256_cvtps_ph(pos, 0));
+        }
+
+        for (int j = 0; j < 8; j++) {
+            InstanceHalf *instance = &out[i + j - begin];
+            instance->position[0] = halves[0][j];
+            instance->position[1] = halves[1][j];
+            instance->position[2] = halves[2][j];
+            instance->life = lifeFraction(particles->lives[i + j], particles->initLives[i + j]);
+            memcpy(instance->colour, particles->colours + 4 * (i + j), 4);
+        }
+    }
+    packHalf(particles, source, i, end, out + (i - begin));
+}
+#endif
+} // namespace
+
+const char *instanceFormatName(InstanceFormat format)
+{
+    switch (format) {
+    case INSTANCE_FLOAT: return "float position";
+    case INSTANCE_HALF: return "half position";
+    default: return "unknown";
+    }
+}
+
+int instanceStride(InstanceFormat format)
+{
+    return format == INSTANCE_HALF ? sizeof(InstanceHalf) : sizeof(InstanceFloat);
+}
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits = floatBits(value);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    // Too large for a half, or already infinite or NaN
+    if (bits >= 0x47800000) {
+        return sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+
+    // Subnormal halves: adding 0.5 lines the mantissa up with the half's
+    // and lets the FPU do the rounding
+    if (bits < 0x38800000) {
+        const uint32_t magic = 126 << 23;
+        return sign | (floatBits(bitsFloat(bits) + bitsFloat(magic)) - magic);
+    }
+
+    // Rebias the exponent and round the mantissa to nearest, ties to even
+    uint32_t odd = (bits >> 13) & 1;
+    bits = bits - ((127 - 15) << 23) + 0xfff + odd;
+    return sign | (bits >> 13);
+}
+
+void packParticles(Particles *particles, InstanceFormat format, void *instances, float alpha)
+{
+    packParticleRange(particles, format, instances, 0, particles->numParticles, alpha);
+}
+
+void packParticleRange(Particles *particles, InstanceFormat format, void *instances,
+                       int first, int last, float alpha)
+{
+    PositionSource source;
+    source.pos[0] = particles->posX;
+    source.pos[1] = particles->posY;
+    source.pos[2] = particles->posZ;
+    source.prevPos[0] = particles->prevPosX;
+    source.prevPos[1] = particles->prevPosY;
+    source.prevPos[2] = particles->prevPosZ;
+    source.alpha = alpha;
+    source.interpolate = alpha < 1.0f;
+
+    bool f16c = false;
+#ifdef PARTICLES_X86
+    f16c = activeSimdLevel() >= SIMD_AVX2 && detectF16C();
+#endif
+
+    parallelFor(particles->jobPool, first, last, SIMULATION_CHUNK,
+                [=](int, int begin, int end) {
+        ProfileScope scope(PHASE_PACK);
+        if (format == INSTANCE_HALF) {
+            InstanceHalf *out = static_cast<InstanceHalf *>(instances) + (begin - first);
+#ifdef PARTICLES_X86
+            if (f16c) {
+                packHalfF16C(particles, source, begin, end, out);
+                return;
+            }
+#endif
+            packHalf(particles, source, begin, end, out);
+        } else {
+            packFloat(particles, source, begin, end,
+                      static_cast<InstanceFloat *>(instances) + (begin - first));
+        }
+    });
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// Packing of the render arrays into one interleaved, quantized instance
+// buffer. A particle's size and colour over its life follow from its life
+// fraction and the emitter parameters, so only the position, the life
+// fraction and the particle's own colour are uploaded.
+
+#include <cstdint>
+
+struct Particles;
+
+enum InstanceFormat {
+    INSTANCE_FLOAT,  // 32-bit float position, 20 bytes per particle
+    INSTANCE_HALF,   // 16-bit float position, 12 bytes per particle
+    NUM_INSTANCE_FORMATS
+};
+
+struct InstanceFloat {
+    float position[3];
+    uint16_t life;  // Remaining life over initial life, normalized
+    uint16_t padding;
+    uint8_t colour[4];
+};
+
+struct InstanceHalf {
+    uint16_t position[3];  // Half floats
+    uint16_t life;
+    uint8_t colour[4];
+};
+
+const char *instanceFormatName(InstanceFormat format);
+
+// Bytes per particle
+int instanceStride(InstanceFormat format);
+
+// Round to the nearest half float, ties to even
+uint16_t floatToHalf(float value);
+
+// Write the live particles to `instances` in `format`, split across the
+// job pool. Positions are placed `alpha` of the way from the previous to
+// the current ones; at 1 the previous positions are not read.
+void packParticles(Particles *particles, InstanceFormat format, void *instances,
+                   float alpha = 1.0f);
+
+// packParticles for the slots [first, last) only, slot `first` goes to the
+// start of `instances`
+void packParticleRange(Particles *particles, InstanceFormat format, void *instances,
+                       int first, int last, float alpha = 1.0f);
@@ -0,0 +1,204 @@
+#include "core/presets.h"
+
+#define PI 3.1415926535897932384626433832795
+
+void presetFountain(EmitterParams *params)
+{
+    params->max_life = 4.0f;
+    params->min_life = 3.0f;
+
+    params->spread = 0.2f;
+
+    params->min_speed = 1.0f;
+    params->max_speed = 2.0f;
+
+    params->sortParticles = true;
+
+    params->spawnRate = 10.0f;
+
+    params->gravity = -9.82f;
+    params->wind = 0.2f;
+
+    params->initColour[0] = 102.0f/255.0f;
+    params->initColour[1] = 141.0f/255.0f;
+    params->initColour[2] = 181.0f/255.0f;
+    params->initColour[3] = 25.0f/255.0f;
+
+    params->finalColour[0] = 197.0f/255.0f;
+    params->finalColour[1] = 231.0f/255.0f;
+    params->finalColour[2] = 1.0f;
+    params->finalColour[3] = 0.0f;
+
+    params->initSize = 0.01f;
+    params->finalSize = 0.1f;
+
+    params->initFuzz = 0.0f;
+    params->finalFuzz = 0.0f;
+
+    params->add = false;
+}
+
+void presetSmoke(EmitterParams *params)
+{
+    params->max_life = 7.0f;
+    params->min_life = 4.0f;
+
+    params->spread = PI;
+
+    params->min_speed = 0.0f;
+    params->max_speed = 0.3f;
+
+    params->sortParticles = true;
+
+    params->spawnRate = 10.0f;
+
+    params->gravity = 3.5f;
+    params->wind = -0.2f;
+
+    params->initColour[0] = 145.0f/255.0f;
+    params->initColour[1] = 145.0f/255.0f;
+    params->initColour[2] = 145.0f/255.0f;
+    params->initColour[3] = 70.0f/255.0f;
+
+    params->finalColour[0] = 51.0f/255.0f;
+    params->finalColour[1] = 51.0f/255.0f;
+    params->finalColour[2] = 51.0f/255.0f;
+    params->finalColour[3] = 10.0f/255.0f;
+
+    params->initSize = 0.0f;
+    params->finalSize = 0.2f;
+
+    params->initFuzz = 0.5f;
+    params->finalFuzz = 0.9f;
+
+    params->add = false;
+}
+
+void presetToonTorch(EmitterParams *params)
+{
+    params->max_life = 5.0f;
+    params->min_life = 3.0f;
+
+    params->spread = 0.2f;
+
+    params->min_speed = 0.611f;
+    params->max_speed = 1.137f;
+
+    params->sortParticles = true;
+
+    params->spawnRate = 2.0f;
+
+    params->gravity = -1.0f;
+    params->wind = 0.0f;
+
+    params->initColour[0] = 200.0f/255.0f;
+    params->initColour[1] = 0.0f;
+    params->initColour[2] = 0.0f;
+    params->initColour[3] = 1.0f;
+
+    params->finalColour[0] = 0.0f;
+    params->finalColour[1] = 0.0f;
+    params->finalColour[2] = 0.0f;
+    params->finalColour[3] = 1.0f;
+
+    params->initSize = 0.2f;
+    params->finalSize = 0.0f;
+
+    params->initFuzz = 0.0f;
+    params->finalFuzz = 0.0f;
+
+    params->add = false;
+}
+
+void presetComet(EmitterParams *params)
+{
+    params->max_life = 0.873f;
+    params->min_life = 4.128f;
+
+    params->spread = 1.269f;
+
+    params->min_speed = 0.0f;
+    params->max_speed = 0.718f;
+
+    params->sortParticles = true;
+
+    params->spawnRate = 20.0f;
+
+    params->gravity = 20.0f;
+    params->wind = 0.0f;
+
+    params->initColour[0] = 134.0f/255.0f;
+    params->initColour[1] = 1.0f;
+    params->initColour[2] = 0.5f;
+    params->initColour[3] = 28.0f/255.0f;
+
+    params->finalColour[0] = 0.0f;
+    params->finalColour[1] = 91.0f/255.0f;
+    params->finalColour[2] = 9.0f/255.0f;
+    params->finalColour[3] = 99.0f/255.0f;
+
+    params->initSize = 0.047f;
+    params->finalSize = 0.0f;
+
+    params->initFuzz = 0.5f;
+    params->finalFuzz = 0.0f;
+
+    params->add = true;
+}
+
+void presetFire(EmitterParams *params)
+{
+    params->max_life = 5.0f;
+    params->min_life = 3.0f;
+
+    params->spread = 0.2f;
+
+    params->min_speed = 0.611f;
+    params->max_speed = 1.137f;
+
+    params->sortParticles = true;
+
+    params->spawnRate = 10.0f;
+
+    params->gravity = -2.388;
+    params->wind = 0.1f;
+
+    params->initColour[0] = 1.0f;
+    params->initColour[1] = 131.0f/255.0f;
+    params->initColour[2] = 64.0f/255.0f;
+    params->initColour[3] = 47.0f/255.0f;
+
+    params->finalColour[0] = 0.0f;
+    params->finalColour[1] = 0.0f;
+    params->finalColour[2] = 0.0f;
+    params->finalColour[3] = 7.0f/255.0f;
+
+    params->initSize = 0.01f;
+    params->finalSize = 0.1f;
+
+    params->initFuzz = 0.05f;
+    params->finalFuzz = 0.4f;
+
+    params->add = true;
+}
+
+// In the order they appear in the GUI
+const Preset PRESETS[] = {
+    { "fire", "Realistic fire", presetFire, false },
+    { "torch", "Toon torch", presetToonTorch, false },
+    { "fountain", "Fountain", presetFountain, false },
+    { "comet", "Green comet", presetComet, true },
+    { "smoke", "Smoke", presetSmoke, false },
+};
+
+const int NUM_PRESETS = sizeof(PRESETS) / sizeof(PRESETS[0]);
+
+const Preset *findPreset(const std::string &name)
+{
+    for (int i = 0; i < NUM_PRESETS; i++) {
+        if (name == PRESETS[i].name) {
+            return &PRESETS[i];
+        }
+    }
+    return NULL;
+}
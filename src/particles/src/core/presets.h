@@ -0,0 +1,24 @@
+#pragma once
+
+#include "core/simulation.h"
+
+#include <string>
+
+void presetFountain(EmitterParams *params);
+void presetSmoke(EmitterParams *params);
+void presetToonTorch(EmitterParams *params);
+void presetComet(EmitterParams *params);
+void presetFire(EmitterParams *params);
+
+struct Preset {
+    const char *name;   // Short name used on the command line
+    const char *label;  // Name shown in the GUI
+    void (*apply)(EmitterParams *params);
+    bool shake;         // Whether the viewer should shake the camera
+};
+
+extern const Preset PRESETS[];
+extern const int NUM_PRESETS;
+
+// Returns the preset called `name`, or NULL if there is none
+const Preset *findPreset(const std::string &name);
@@ -0,0 +1,323 @@
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+typedef chrono::steady_clock Clock;
+
+// Track of the times added with addProfileTime, the threads follow it
+#define ADDED_TRACK 0
+
+struct TraceEvent {
+    int phase;
+    int track;
+    ProfileSource source;
+    double start;  // Microseconds of profileClock
+    double duration;
+};
+
+// What one thread recorded since the last endProfileFrame
+struct ThreadRecord {
+    int track;
+    string name;
+    double phaseTime[NUM_PROFILE_PHASES];  // Milliseconds
+    vector<TraceEvent> events;
+};
+
+// The last PROFILE_HISTORY values, oldest overwritten first
+struct History {
+    double values[PROFILE_HISTORY];
+    int count;
+    int head;
+};
+
+void pushHistory(History *history, double value)
+{
+    history->values[history->head] = value;
+    history->head = (history->head + 1) % PROFILE_HISTORY;
+    history->count = min(history->count + 1, PROFILE_HISTORY);
+}
+
+ProfilePercentiles percentiles(const History &history)
+{
+    ProfilePercentiles result = { history.count, 0.0, 0.0, 0.0 };
+    if (history.count == 0) {
+        return result;
+    }
+
+    vector<double> sorted(history.values, history.values + history.count);
+    sort(sorted.begin(), sorted.end());
+    // Nearest rank
+    double *ranks[] = { &result.p50, &result.p95, &result.p99 };
+    const double fractions[] = { 0.5, 0.95, 0.99 };
+    for (int i = 0; i < 3; i++) {
+        int rank = int(ceil(fractions[i] * history.count)) - 1;
+        *ranks[i] = sorted[max(rank, 0)];
+    }
+    return result;
+}
+
+atomic<Profiler *> active(nullptr);
+atomic<unsigned> generations(0);
+
+// The calling thread's record, valid while threadGeneration is the
+// profiler's
+thread_local ThreadRecord *threadRecord = nullptr;
+thread_local unsigned threadGeneration = 0;
+} // namespace
+
+struct Profiler {
+    Clock::time_point epoch;
+    unsigned generation;  // Tells the records of an earlier profiler apart
+    thread::id creator;
+
+    mutex threadsMutex;
+    vector<ThreadRecord *> threads;
+
+    double frameStart;
+    History frames;
+    History phases[NUM_PROFILE_SOURCES][NUM_PROFILE_PHASES];
+
+    atomic<bool> tracing;
+    vector<TraceEvent> trace;  // Of the closed frames
+};
+
+namespace {
+double microseconds(const Profiler *profiler, Clock::time_point time)
+{
+    return chrono::duration<double, micro>(time - profiler->epoch).count();
+}
+
+// The calling thread's record in `profiler`, added on its first scope
+ThreadRecord *recordOf(Profiler *profiler)
+{
+    if (threadGeneration == profiler->generation) {
+        return threadRecord;
+    }
+
+    ThreadRecord *record = new ThreadRecord();
+    for (int i = 0; i < NUM_PROFILE_PHASES; i++) {
+        record->phaseTime[i] = 0.0;
+    }
+
+    lock_guard<mutex> lock(profiler->threadsMutex);
+    record->track = profiler->threads.size() + 1;
+    if (this_thread::get_id() == profiler->creator) {
+        record->name = "main";
+    } else {
+        record->name = "thread " + to_string(record->track);
+    }
+    profiler->threads.push_back(record);
+
+    threadRecord = record;
+    threadGeneration = profiler->generation;
+    return record;
+}
+
+void addTraceEvent(Profiler *profiler, const TraceEvent &event)
+{
+    profiler->trace.push_back(event);
+    if (profiler->trace.size() >= PROFILE_TRACE_LIMIT) {
+        profiler->tracing = false;
+    }
+}
+} // namespace
+
+const char *profilePhaseName(ProfilePhase phase)
+{
+    switch (phase) {
+    case PHASE_SPAWN: return "spawn";
+    case PHASE_INTEGRATE: return "integrate";
+    case PHASE_SORT: return "sort";
+    case PHASE_PACK: return "pack";
+    case PHASE_UPLOAD: return "upload";
+    case PHASE_DRAW: return "draw";
+    case PHASE_GUI: return "gui";
+    case PHASE_JOB: return "job";
+    default: return "unknown";
+    }
+}
+
+Profiler *createProfiler()
+{
+    Profiler *profiler = new Profiler();
+    profiler->epoch = Clock::now();
+    profiler->generation = ++generations;
+    profiler->creator = this_thread::get_id();
+    profiler->frameStart = -1.0;
+    profiler->frames.count = 0;
+    profiler->frames.head = 0;
+    for (int source = 0; source < NUM_PROFILE_SOURCES; source++) {
+        for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+            profiler->phases[source][phase].count = 0;
+            profiler->phases[source][phase].head = 0;
+        }
+    }
+    profiler->tracing = false;
+    return profiler;
+}
+
+void destroyProfiler(Profiler *profiler)
+{
+    if (active == profiler) {
+        active = nullptr;
+    }
+    for (size_t i = 0; i < profiler->threads.size(); i++) {
+        delete profiler->threads[i];
+    }
+    delete profiler;
+}
+
+void setActiveProfiler(Profiler *profiler)
+{
+    active = profiler;
+}
+
+Profiler *activeProfiler()
+{
+    return active;
+}
+
+double profileClock(const Profiler *profiler)
+{
+    return microseconds(profiler, Clock::now());
+}
+
+void endProfileFrame(Profiler *profiler)
+{
+    double now = profileClock(profiler);
+    if (profiler->frameStart >= 0.0) {
+        pushHistory(&profiler->frames, (now - profiler->frameStart) * 1e-3);
+    }
+    profiler->frameStart = now;
+
+    double totals[NUM_PROFILE_PHASES] = {};
+    lock_guard<mutex> lock(profiler->threadsMutex);
+    for (size_t i = 0; i < profiler->threads.size(); i++) {
+        ThreadRecord *record = profiler->threads[i];
+        for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+            totals[phase] += record->phaseTime[phase];
+            record->phaseTime[phase] = 0.0;
+        }
+        for (size_t j = 0; j < record->events.size() && profiler->tracing; j++) {
+            addTraceEvent(profiler, record->events[j]);
+        }
+        record->events.clear();
+    }
+    for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+        pushHistory(&profiler->phases[PROFILE_CPU][phase], totals[phase]);
+    }
+}
+
+void addProfileTime(Profiler *profiler, ProfilePhase phase, ProfileSource source,
+                    double start, double milliseconds)
+{
+    pushHistory(&profiler->phases[source][phase], milliseconds);
+    if (profiler->tracing) {
+        TraceEvent event = { phase, ADDED_TRACK, source, start, milliseconds * 1e3 };
+        addTraceEvent(profiler, event);
+    }
+}
+
+ProfilePercentiles profilePercentiles(const Profiler *profiler, ProfilePhase phase,
+                                      ProfileSource source)
+{
+    return percentiles(profiler->phases[source][phase]);
+}
+
+ProfilePercentiles frameTimePercentiles(const Profiler *profiler)
+{
+    return percentiles(profiler->frames);
+}
+
+void startProfileTrace(Profiler *profiler)
+{
+    profiler->trace.clear();
+    profiler->tracing = true;
+}
+
+void stopProfileTrace(Profiler *profiler)
+{
+    profiler->tracing = false;
+}
+
+bool profileTracing(const Profiler *profiler)
+{
+    return profiler->tracing;
+}
+
+int profileTraceEvents(const Profiler *profiler)
+{
+    return profiler->trace.size();
+}
+
+bool writeProfileTrace(const Profiler *profiler, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    // Name the process and every track first
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                  "\"args\":{\"name\":\"particles\"}}", ADDED_TRACK);
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                  "\"args\":{\"name\":\"GPU\"}}", ADDED_TRACK);
+    for (size_t i = 0; i < profiler->threads.size(); i++) {
+        const ThreadRecord *record = profiler->threads[i];
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                      "\"args\":{\"name\":\"%s\"}}", record->track, record->name.c_str());
+    }
+
+    for (size_t i = 0; i < profiler->trace.size(); i++) {
+        const TraceEvent &event = profiler->trace[i];
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                      "\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                profilePhaseName(ProfilePhase(event.phase)),
+                event.source == PROFILE_GPU ? "gpu" : "cpu", event.start, event.duration,
+                event.track);
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    return fclose(file) == 0;
+}
+
+ProfileScope::ProfileScope(ProfilePhase phase) : profiler(active), phase(phase)
+{
+    // Job pool chunks only matter to a trace
+    if (profiler != nullptr && phase == PHASE_JOB && !profiler->tracing) {
+        profiler = nullptr;
+    }
+    if (profiler != nullptr) {
+        start = Clock::now();
+    }
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (profiler == nullptr) {
+        return;
+    }
+    Clock::time_point end = Clock::now();
+
+    ThreadRecord *record = recordOf(profiler);
+    if (phase < NUM_PROFILE_PHASES) {
+        record->phaseTime[phase] += chrono::duration<double, milli>(end - start).count();
+    }
+    if (profiler->tracing) {
+        double begin = microseconds(profiler, start);
+        TraceEvent event = { phase, record->track, PROFILE_CPU, begin,
+                             microseconds(profiler, end) - begin };
+        record->events.push_back(event);
+    }
+}
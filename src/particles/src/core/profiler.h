@@ -0,0 +1,105 @@
+#pragma once
+
+// Frame phase profiler. ProfileScope times a phase of the frame on the
+// thread it runs on and adds it to that phase's total for the frame, so
+// phases that run on several threads at once add up to their CPU time.
+// Work split with parallelFor is timed inside its chunks, never around the
+// call, so a phase is CPU time summed over the threads whether its pools
+// are split across the job pool or batched into one job.
+// The renderer adds the GPU times of its phases as they come back. Every
+// phase keeps the totals of its last PROFILE_HISTORY frames for
+// percentiles.
+//
+// While a trace is recorded, every scope and every job pool chunk is kept
+// as an event on its thread's track as well, and the trace is written in
+// the Chrome trace event format that chrome://tracing and Perfetto open.
+//
+// The scopes record into the active profiler; with none they do nothing.
+
+#include <chrono>
+
+enum ProfilePhase {
+    PHASE_SPAWN,
+    PHASE_INTEGRATE,
+    PHASE_SORT,
+    PHASE_PACK,
+    PHASE_UPLOAD,
+    PHASE_DRAW,
+    PHASE_GUI,
+    NUM_PROFILE_PHASES,
+    PHASE_JOB = NUM_PROFILE_PHASES  // A job pool chunk, traced only
+};
+
+enum ProfileSource {
+    PROFILE_CPU,
+    PROFILE_GPU,
+    NUM_PROFILE_SOURCES
+};
+
+// Frames of history the percentiles are taken over
+#define PROFILE_HISTORY 300
+
+// Events a trace holds before it stops recording
+#define PROFILE_TRACE_LIMIT 4000000
+
+const char *profilePhaseName(ProfilePhase phase);
+
+struct Profiler;
+
+Profiler *createProfiler();
+
+void destroyProfiler(Profiler *profiler);
+
+// The profiler the scopes record into, NULL for none. Set it while no
+// scopes are running.
+void setActiveProfiler(Profiler *profiler);
+
+Profiler *activeProfiler();
+
+// Microseconds since the profiler was created
+double profileClock(const Profiler *profiler);
+
+// Close the frame: add up its scopes per phase and start the next one.
+// Must be called between frames, when no other thread is in a scope.
+void endProfileFrame(Profiler *profiler);
+
+// Add `milliseconds` of `phase` measured elsewhere, such as on the GPU, to
+// the history. `start` places it in the trace, in profileClock time.
+void addProfileTime(Profiler *profiler, ProfilePhase phase, ProfileSource source,
+                    double start, double milliseconds);
+
+struct ProfilePercentiles {
+    int samples;  // 0 until the phase has been measured
+    double p50;   // Milliseconds per frame
+    double p95;
+    double p99;
+};
+
+ProfilePercentiles profilePercentiles(const Profiler *profiler, ProfilePhase phase,
+                                      ProfileSource source);
+
+// Of the whole frame, from one endProfileFrame to the next
+ProfilePercentiles frameTimePercentiles(const Profiler *profiler);
+
+// Start collecting trace events, dropping any earlier ones
+void startProfileTrace(Profiler *profiler);
+
+void stopProfileTrace(Profiler *profiler);
+
+bool profileTracing(const Profiler *profiler);
+
+int profileTraceEvents(const Profiler *profiler);
+
+// Write the events collected so far as Chrome trace JSON. Returns false
+// when the file cannot be written.
+bool writeProfileTrace(const Profiler *profiler, const char *path);
+
+// Times the enclosing block as `phase` on the calling thread
+struct ProfileScope {
+    explicit ProfileScope(ProfilePhase phase);
+    ~ProfileScope();
+
+    Profiler *profiler;
+    ProfilePhase phase;
+    std::chrono::steady_clock::time_point start;
+};
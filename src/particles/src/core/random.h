@@ -0,0 +1,52 @@
+#pragma once
+
+// Counter-based random numbers, Philox4x32-10 (Salmon et al., "Parallel
+// random numbers: as easy as 1, 2, 3", 2011). A block of four 32-bit words
+// is a pure function of a 128-bit counter and a 64-bit key, so every
+// particle can draw its numbers from its own id, on any thread and in any
+// order, without a generator state to copy or share.
+
+#include <cstdint>
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+inline void philoxRound(uint32_t counter[4], const uint32_t key[2])
+{
+    uint64_t product0 = uint64_t(PHILOX_M0) * counter[0];
+    uint64_t product1 = uint64_t(PHILOX_M1) * counter[2];
+
+    uint32_t next[4];
+    next[0] = uint32_t(product1 >> 32) ^ counter[1] ^ key[0];
+    next[1] = uint32_t(product1);
+    next[2] = uint32_t(product0 >> 32) ^ counter[3] ^ key[1];
+    next[3] = uint32_t(product0);
+
+    counter[0] = next[0];
+    counter[1] = next[1];
+    counter[2] = next[2];
+    counter[3] = next[3];
+}
+
+// Replace `counter` with the random block for it
+inline void philox4x32(uint32_t counter[4], const uint32_t seedKey[2])
+{
+    uint32_t key[2] = { seedKey[0], seedKey[1] };
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        if (round > 0) {
+            key[0] += PHILOX_W0;
+            key[1] += PHILOX_W1;
+        }
+        philoxRound(counter, key);
+    }
+}
+
+// Uniform float in [0, 1) from the top 24 bits of `bits`, exactly
+// representable
+inline float uniformFloat(uint32_t bits)
+{
+    return float(bits >> 8) * (1.0f / 16777216.0f);
+}
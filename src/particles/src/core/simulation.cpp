@@ -0,0 +1,420 @@
+#include "core/simulation.h"
+#include "core/arena.h"
+#include "core/cull.h"
+#include "core/integrate.h"
+#include "core/jobs.h"
+#include "core/profiler.h"
+#include "core/spawn.h"
+#include "core/timestep.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+namespace {
+// Point `*array` at the next `count` elements of the arena and advance
+// `offset` past them. With a NULL base only the offset is advanced.
+template <typename T>
+void placeArray(T **array, char *base, size_t *offset, size_t count)
+{
+    if (base != NULL) {
+        *array = reinterpret_cast<T *>(base + *offset);
+    }
+    size_t size = count * sizeof(T);
+    *offset += (size + PARTICLE_ALIGNMENT - 1) / PARTICLE_ALIGNMENT * PARTICLE_ALIGNMENT;
+}
+
+// Lay every per-particle array out after `base` and return the bytes they
+// take, a NULL base only measures. The arena is zeroed, which keeps the
+// slots the vector kernels read past the live particles defined.
+size_t layoutArrays(Particles *particles, char *base, size_t capacity)
+{
+    size_t offset = 0;
+    placeArray(&particles->speedX, base, &offset, capacity);
+    placeArray(&particles->speedY, base, &offset, capacity);
+    placeArray(&particles->speedZ, base, &offset, capacity);
+    placeArray(&particles->cameraDistance, base, &offset, capacity);
+    placeArray(&particles->posX, base, &offset, capacity);
+    placeArray(&particles->posY, base, &offset, capacity);
+    placeArray(&particles->posZ, base, &offset, capacity);
+    placeArray(&particles->sizes, base, &offset, capacity);
+    placeArray(&particles->lives, base, &offset, capacity);
+    placeArray(&particles->initLives, base, &offset, capacity);
+    placeArray(&particles->colours, base, &offset, 4 * capacity);
+    placeArray(&particles->prevPosX, base, &offset, capacity);
+    placeArray(&particles->prevPosY, base, &offset, capacity);
+    placeArray(&particles->prevPosZ, base, &offset, capacity);
+    placeArray(&particles->bounds, base, &offset, numBounds(capacity));
+    placeArray(&particles->sortIndices, base, &offset, capacity);
+    placeArray(&particles->sortPairs, base, &offset, 2 * capacity);
+    placeArray(&particles->sortScratch, base, &offset, capacity);
+    return offset;
+}
+
+void allocateArrays(Particles *particles, int capacity)
+{
+    size_t size = layoutArrays(particles, NULL, capacity);
+    particles->arena = createArena(size, particles->hugePages);
+    particles->capacity = capacity;
+    layoutArrays(particles, particles->arena->data, capacity);
+}
+
+// Reorder `data` so that slot i holds what was in slot indices[i]. Timed
+// as part of sorting.
+template <typename T>
+void permuteArray(JobPool *pool, T *data, const int *indices, int count, T *scratch)
+{
+    parallelFor(pool, 0, count, SIMULATION_CHUNK, [=](int, int begin, int end) {
+        ProfileScope scope(PHASE_SORT);
+        for (int i = begin; i < end; i++) {
+            scratch[i] = data[indices[i]];
+        }
+    });
+    parallelFor(pool, 0, count, SIMULATION_CHUNK, [=](int, int begin, int end) {
+        ProfileScope scope(PHASE_SORT);
+        memcpy(data + begin, scratch + begin, (end - begin) * sizeof(T));
+    });
+}
+
+IntegrateParams integrateParams(const EmitterParams &params, vec3 cameraPos, float delta)
+{
+    IntegrateParams integrate;
+    integrate.delta = delta;
+    integrate.gravity = params.gravity;
+    integrate.wind = params.wind;
+    integrate.initSize = params.initSize;
+    integrate.finalSize = params.finalSize;
+    integrate.cameraX = cameraPos.x;
+    integrate.cameraY = cameraPos.y;
+    integrate.cameraZ = cameraPos.z;
+    return integrate;
+}
+
+// Rendering interpolates from the positions before the last step
+void keepPositions(Particles *particles)
+{
+    int count = particles->numParticles;
+    memcpy(particles->prevPosX, particles->posX, count * sizeof(float));
+    memcpy(particles->prevPosY, particles->posY, count * sizeof(float));
+    memcpy(particles->prevPosZ, particles->posZ, count * sizeof(float));
+}
+} // namespace
+
+Particles *createParticles(unsigned seed, int capacity, bool hugePages)
+{
+    Particles *particles = new Particles();
+
+    particles->hugePages = hugePages;
+    allocateArrays(particles, capacity);
+
+    particles->jobPool = NULL;
+
+    particles->sortMode = SORT_RADIX;
+    particles->sortTime = 0.0;
+
+    particles->seed[0] = seed;
+    particles->seed[1] = 0;
+
+    resetParticles(particles);
+
+    return particles;
+}
+
+void destroyParticles(Particles *particles)
+{
+    destroyArena(particles->arena);
+    delete particles;
+}
+
+void resizeParticles(Particles *particles, int capacity)
+{
+    Particles old = *particles;
+
+    allocateArrays(particles, capacity);
+
+    int count = glm::min(old.numParticles, capacity);
+    memcpy(particles->speedX, old.speedX, count * sizeof(float));
+    memcpy(particles->speedY, old.speedY, count * sizeof(float));
+    memcpy(particles->speedZ, old.speedZ, count * sizeof(float));
+    memcpy(particles->cameraDistance, old.cameraDistance, count * sizeof(float));
+    memcpy(particles->posX, old.posX, count * sizeof(float));
+    memcpy(particles->posY, old.posY, count * sizeof(float));
+    memcpy(particles->posZ, old.posZ, count * sizeof(float));
+    memcpy(particles->sizes, old.sizes, count * sizeof(float));
+    memcpy(particles->lives, old.lives, count * sizeof(float));
+    memcpy(particles->initLives, old.initLives, count * sizeof(float));
+    memcpy(particles->colours, old.colours, count * 4);
+    memcpy(particles->prevPosX, old.prevPosX, count * sizeof(float));
+    memcpy(particles->prevPosY, old.prevPosY, count * sizeof(float));
+    memcpy(particles->prevPosZ, old.prevPosZ, count * sizeof(float));
+    particles->numParticles = count;
+
+    // Either position may be drawn next
+    updateBounds(particles, true);
+
+    destroyArena(old.arena);
+}
+
+size_t particlesMemory(const Particles *particles)
+{
+    return particles->arena->size;
+}
+
+void resetParticles(Particles *particles) {
+    particles->numParticles = 0;
+    particles->spawnRemainder = 0.0f;
+    particles->nextId = 0;
+}
+
+int allocateParticles(Particles *particles, int count)
+{
+    int first = particles->numParticles;
+    particles->numParticles = glm::min(first + count, particles->capacity);
+    return first;
+}
+
+void removeParticle(Particles *particles, int index)
+{
+    int last = --particles->numParticles;
+    if (index == last) {
+        return;
+    }
+
+    particles->speedX[index] = particles->speedX[last];
+    particles->speedY[index] = particles->speedY[last];
+    particles->speedZ[index] = particles->speedZ[last];
+    particles->cameraDistance[index] = particles->cameraDistance[last];
+    particles->posX[index] = particles->posX[last];
+    particles->posY[index] = particles->posY[last];
+    particles->posZ[index] = particles->posZ[last];
+    particles->sizes[index] = particles->sizes[last];
+    particles->lives[index] = particles->lives[last];
+    particles->initLives[index] = particles->initLives[last];
+    memcpy(&particles->colours[4*index], &particles->colours[4*last], 4);
+    particles->prevPosX[index] = particles->prevPosX[last];
+    particles->prevPosY[index] = particles->prevPosY[last];
+    particles->prevPosZ[index] = particles->prevPosZ[last];
+}
+
+void permuteParticles(Particles *particles, const int *indices, int count)
+{
+    JobPool *pool = particles->jobPool;
+    float *scratch = particles->sortScratch;
+    permuteArray(pool, particles->speedX, indices, count, scratch);
+    permuteArray(pool, particles->speedY, indices, count, scratch);
+    permuteArray(pool, particles->speedZ, indices, count, scratch);
+    permuteArray(pool, particles->cameraDistance, indices, count, scratch);
+    permuteArray(pool, particles->posX, indices, count, scratch);
+    permuteArray(pool, particles->posY, indices, count, scratch);
+    permuteArray(pool, particles->posZ, indices, count, scratch);
+    permuteArray(pool, particles->sizes, indices, count, scratch);
+    permuteArray(pool, particles->lives, indices, count, scratch);
+    permuteArray(pool, particles->initLives, indices, count, scratch);
+    permuteArray(pool, reinterpret_cast<uint32_t *>(particles->colours), indices, count,
+                 reinterpret_cast<uint32_t *>(scratch));
+    permuteArray(pool, particles->prevPosX, indices, count, scratch);
+    permuteArray(pool, particles->prevPosY, indices, count, scratch);
+    permuteArray(pool, particles->prevPosZ, indices, count, scratch);
+}
+
+void sortParticles(Particles *particles)
+{
+    auto start = chrono::steady_clock::now();
+
+    // The permutation times its own chunks
+    {
+        ProfileScope scope(PHASE_SORT);
+        switch (particles->sortMode) {
+        case SORT_RADIX:
+            depthOrderRadix(particles);
+            break;
+        case SORT_INCREMENTAL:
+            depthOrderIncremental(particles);
+            break;
+        default:
+            depthOrderComparison(particles);
+            break;
+        }
+    }
+
+    permuteParticles(particles, particles->sortIndices, particles->numParticles);
+
+    auto end = chrono::steady_clock::now();
+    particles->sortTime = chrono::duration<double, milli>(end - start).count();
+}
+
+int spawnCount(const EmitterParams &params, float delta, float *remainder)
+{
+    float spawnRate = 1000.0f * params.spawnRate;
+
+    // Spawn `spawnRate` particles per second. Long steps are bounded by the
+    // fixed timestep, not by dropping particles here.
+    float exact = delta * spawnRate + *remainder;
+    int newparticles = (int)exact;
+    *remainder = exact - newparticles;
+
+    return newparticles;
+}
+
+void spawnParticles(Particles *particles, const EmitterParams &params, float delta)
+{
+    int count = spawnCount(params, delta, &particles->spawnRemainder);
+    int first = allocateParticles(particles, count);
+    int last = particles->numParticles;
+
+    SpawnParams spawn;
+    spawn.key[0] = particles->seed[0];
+    spawn.key[1] = particles->seed[1];
+    spawn.firstId = particles->nextId;
+    spawn.first = first;
+    spawn.spread = params.spread;
+    spawn.minSpeed = glm::min(params.min_speed, params.max_speed);
+    spawn.speedRange = glm::abs(params.max_speed - params.min_speed);
+    spawn.minLife = glm::min(params.min_life, params.max_life) * STRETCH;
+    spawn.lifeRange = glm::abs(params.max_life - params.min_life) * STRETCH;
+    spawn.initSize = params.initSize;
+
+    // Every particle draws from its own id, so the chunks are independent
+    SpawnKernel kernel = spawnKernel(activeSimdLevel());
+    parallelFor(particles->jobPool, first, last, SIMULATION_CHUNK,
+                [&](int, int begin, int end) {
+        ProfileScope scope(PHASE_SPAWN);
+        kernel(particles, begin, end, spawn);
+    });
+
+    particles->nextId += last - first;
+}
+
+void integrateParticles(Particles *particles, const EmitterParams &params,
+                        vec3 cameraPos, float delta)
+{
+    IntegrateParams integrate = integrateParams(params, cameraPos, delta);
+
+    IntegrateKernel kernel = integrateKernel(activeSimdLevel());
+    int numParticles = particles->numParticles;
+
+    std::vector<IntegrateResult> results(numChunks(0, numParticles, SIMULATION_CHUNK));
+    parallelFor(particles->jobPool, 0, numParticles, SIMULATION_CHUNK,
+                [&](int chunk, int begin, int end) {
+        ProfileScope scope(PHASE_INTEGRATE);
+        results[chunk] = kernel(particles, begin, end, integrate);
+    });
+
+    ProfileScope scope(PHASE_INTEGRATE);
+
+    // Remove the particles that died, front to back so the result does not
+    // depend on the number of threads. Chunks where everything survived are
+    // skipped.
+    const float *lives = particles->lives;
+    for (size_t chunk = 0; chunk < results.size(); chunk++) {
+        int begin = chunk * SIMULATION_CHUNK;
+        int end = glm::min(begin + SIMULATION_CHUNK, numParticles);
+        if (results[chunk].numParticles - results[chunk].numExpired == end - begin) {
+            continue;
+        }
+
+        for (int i = begin; i < glm::min(end, particles->numParticles); i++) {
+            if (lives[i] > 0.0f) {
+                continue;
+            }
+            // Drop dead particles off the end first so that a live one
+            // fills the hole
+            while (particles->numParticles - 1 > i && lives[particles->numParticles - 1] <= 0.0f) {
+                particles->numParticles--;
+            }
+            removeParticle(particles, i);
+        }
+    }
+}
+
+void simulateParticles(Particles *particles, const EmitterParams &params,
+                       vec3 cameraPos, float timeDelta)
+{
+    float delta = timeDelta * STRETCH;
+
+    spawnParticles(particles, params, delta);
+
+    integrateParticles(particles, params, cameraPos, delta);
+
+    // Sort particles by camera distance for correct blending
+    if (params.sortParticles) {
+        sortParticles(particles);
+    }
+
+    updateBounds(particles, false);
+}
+
+void simulateParticlesFixed(Particles *particles, const EmitterParams &params,
+                            vec3 cameraPos, Timestep *timestep, float timeDelta)
+{
+    int steps = advanceTimestep(timestep, timeDelta);
+    stepParticlesFixed(particles, params, cameraPos, steps, timestep->step);
+}
+
+void stepParticlesFixed(Particles *particles, const EmitterParams &params,
+                        vec3 cameraPos, int steps, float step)
+{
+    float delta = step * STRETCH;
+
+    for (int step = 0; step < steps; step++) {
+        spawnParticles(particles, params, delta);
+
+        if (step == steps - 1) {
+            keepPositions(particles);
+        }
+
+        integrateParticles(particles, params, cameraPos, delta);
+    }
+
+    if (steps > 0 && params.sortParticles) {
+        sortParticles(particles);
+    }
+
+    // The boxes cover the interpolation between the last two steps
+    if (steps > 0) {
+        updateBounds(particles, true);
+    }
+}
+
+void prewarmParticles(Particles *particles, const EmitterParams &params, vec3 cameraPos,
+                      float seconds, float substep)
+{
+    int steps = int(std::ceil(seconds / substep));
+    float delta = substep * STRETCH;
+    IntegrateKernel kernel = integrateKernel(activeSimdLevel());
+
+    for (int step = 0; step < steps; step++) {
+        integrateParticles(particles, params, cameraPos, delta);
+
+        // The new particles were emitted over the step, not all at its end:
+        // group g has lived (g + 0.5) / PREWARM_SPREAD of it
+        int first = particles->numParticles;
+        spawnParticles(particles, params, delta);
+        int count = particles->numParticles - first;
+        for (int group = 0; group < PREWARM_SPREAD; group++) {
+            int begin = first + count * group / PREWARM_SPREAD;
+            int end = first + count * (group + 1) / PREWARM_SPREAD;
+            float age = delta * (group + 0.5f) / PREWARM_SPREAD;
+            IntegrateParams integrate = integrateParams(params, cameraPos, age);
+            parallelFor(particles->jobPool, begin, end, SIMULATION_CHUNK,
+                        [&](int, int chunkBegin, int chunkEnd) {
+                kernel(particles, chunkBegin, chunkEnd, integrate);
+            });
+        }
+    }
+
+    // Nothing to interpolate from yet
+    keepPositions(particles);
+    if (steps > 0 && params.sortParticles) {
+        sortParticles(particles);
+    }
+    updateBounds(particles, true);
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+// Headless particle simulation. Nothing in here may depend on GLFW, GLEW or
+// ImGui so that the simulation can run on machines without a display.
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+#include "core/sort.h"
+
+// Capacity of a pool when none is given
+#define DEFAULT_CAPACITY 10000
+
+#define STRETCH 0.1f
+
+// Alignment of every per-particle array, one cache line
+#define PARTICLE_ALIGNMENT 64
+
+// Seconds of wall time per substep of prewarmParticles, and the groups the
+// particles of each substep are spread over
+#define PREWARM_SUBSTEP (1.0f / 20.0f)
+#define PREWARM_SPREAD 8
+
+// Particles per job when the simulation is split across threads. A multiple
+// of the widest vector so only the last chunk has a tail.
+#define SIMULATION_CHUNK 16384
+
+struct Arena;
+struct ChunkBounds;
+struct JobPool;
+struct Timestep;
+
+// Parameters describing how an emitter spawns, moves and colours its
+// particles
+struct EmitterParams {
+    float spawnRate;
+    float max_life;
+    float min_life;
+    float spread;
+    float max_speed;
+    float min_speed;
+    float gravity;
+    float wind;
+    float initColour[4];
+    float finalColour[4];
+    float initSize;
+    float finalSize;
+    float initFuzz;
+    float finalFuzz;
+    bool sortParticles;
+    bool add;
+};
+
+// Structure-of-arrays particle storage. Slot i of every array belongs to
+// the same particle.
+//
+// The pool is dense: the live particles always occupy the first
+// `numParticles` slots. New particles are appended at the end and a particle
+// that dies is replaced by the last one, so allocation is O(1) and every
+// pass only touches live particles.
+//
+// The render arrays are what the GPU consumes, the simulation writes them in
+// place and the viewer uploads the first `numParticles` entries of each as
+// is.
+struct Particles {
+    int capacity;
+
+    // Every array below lives in this one allocation
+    Arena *arena;
+    bool hugePages;  // Ask for huge pages when the arena is large
+
+    // Simulation-only state
+    float *speedX;
+    float *speedY;
+    float *speedZ;
+    float *cameraDistance;
+
+    // Render arrays
+    float *posX;
+    float *posY;
+    float *posZ;
+    float *sizes;
+    float *lives;
+    float *initLives;
+    unsigned char *colours;  // RGBA, four bytes per particle
+
+    // Positions before the last step, kept by simulateParticlesFixed for
+    // interpolated rendering
+    float *prevPosX;
+    float *prevPosY;
+    float *prevPosZ;
+
+    // Box around every BOUNDS_CHUNK live particles, see core/cull.h.
+    // Recomputed at the end of every simulation step.
+    ChunkBounds *bounds;
+
+    int numParticles;
+
+    // Fraction of a particle owed to the next spawn, so that emission does
+    // not depend on the step length
+    float spawnRemainder;
+
+    // Key of the counter-based generator, see core/random.h, and the id of
+    // the next particle to spawn, which counts its random numbers
+    uint32_t seed[2];
+    uint64_t nextId;
+
+    // Worker threads for the simulation, NULL runs everything on the
+    // calling thread. Not owned.
+    JobPool *jobPool;
+
+    SortMode sortMode;
+    double sortTime;  // Milliseconds the last sortParticles took
+
+    // Scratch space for sorting
+    int *sortIndices;
+    uint64_t *sortPairs;  // Twice the capacity, key and index pairs
+    float *sortScratch;
+};
+
+// Allocate an empty particle container with room for `capacity` particles.
+// Pools with the same seed emit the same particles.
+Particles *createParticles(unsigned seed, int capacity = DEFAULT_CAPACITY,
+                           bool hugePages = true);
+
+// Move the particles to a pool with room for `capacity` particles. When
+// shrinking below the number of live particles the last ones are dropped.
+void resizeParticles(Particles *particles, int capacity);
+
+// Bytes of memory the pool uses
+size_t particlesMemory(const Particles *particles);
+
+void destroyParticles(Particles *particles);
+
+void resetParticles(Particles *particles);
+
+// Append up to `count` particles, returns the index of the first one. The
+// caller initialises the new slots. Fewer are added when the pool is full,
+// check numParticles for how many.
+int allocateParticles(Particles *particles, int count);
+
+// Swap-remove particle `index`: the last particle takes its slot
+void removeParticle(Particles *particles, int index);
+
+// Number of particles to emit for a step of `delta` simulated seconds.
+// `remainder` carries the fractional particle from step to step.
+int spawnCount(const EmitterParams &params, float delta, float *remainder);
+
+// Emit new particles for a step of `delta` simulated seconds, in parallel
+// with the kernel for activeSimdLevel()
+void spawnParticles(Particles *particles, const EmitterParams &params, float delta);
+
+// Move every live particle `delta` simulated seconds forward and remove the
+// ones whose life runs out
+void integrateParticles(Particles *particles, const EmitterParams &params,
+                        glm::vec3 cameraPos, float delta);
+
+// Reorder the first `count` slots so that slot i holds what was in slot
+// indices[i]
+void permuteParticles(Particles *particles, const int *indices, int count);
+
+// Sort the live particles back to front with `particles->sortMode`
+void sortParticles(Particles *particles);
+
+// Advance the simulation by `timeDelta` seconds of wall time: spawn,
+// integrate and optionally sort
+void simulateParticles(Particles *particles, const EmitterParams &params,
+                       glm::vec3 cameraPos, float timeDelta);
+
+// Advance the simulation by `timeDelta` seconds of wall time in the fixed
+// steps of `timestep`. Sorts once after the last step and keeps the
+// positions from before it for interpolation with timestep->alpha.
+void simulateParticlesFixed(Particles *particles, const EmitterParams &params,
+                            glm::vec3 cameraPos, Timestep *timestep, float timeDelta);
+
+// Take `steps` steps of `step` seconds of wall time the way
+// simulateParticlesFixed does, for callers that advance the timestep
+// themselves
+void stepParticlesFixed(Particles *particles, const EmitterParams &params,
+                        glm::vec3 cameraPos, int steps, float step);
+
+// Fast-forward `seconds` of wall time in substeps of `substep` seconds, so
+// that an effect starts out populated instead of ramping up. The particles
+// of a substep are aged over it in PREWARM_SPREAD groups rather than all
+// emitted at once, which would leave them in shells.
+void prewarmParticles(Particles *particles, const EmitterParams &params,
+                      glm::vec3 cameraPos, float seconds, float substep = PREWARM_SUBSTEP);
@@ -0,0 +1,232 @@
+#include "core/snapshot.h"
+#include "core/cull.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+#define NUM_SNAPSHOT_ARRAYS 11
+
+// The arrays a snapshot stores and the bytes of one element of each. The
+// bounds follow from these. The positions before the last step are left
+// out: only interpolating pools keep them up to date, so they would make
+// snapshots of the same particles differ. Loading rebuilds them.
+void snapshotArrays(const Particles *particles, char **arrays, size_t *sizes)
+{
+    char *pointers[] = {
+        (char *)particles->speedX, (char *)particles->speedY, (char *)particles->speedZ,
+        (char *)particles->posX, (char *)particles->posY, (char *)particles->posZ,
+        (char *)particles->sizes, (char *)particles->lives, (char *)particles->initLives,
+        (char *)particles->colours,
+        (char *)particles->cameraDistance
+    };
+    const size_t elementSizes[] = {
+        sizeof(float), sizeof(float), sizeof(float),
+        sizeof(float), sizeof(float), sizeof(float),
+        sizeof(float), sizeof(float), sizeof(float),
+        4 * sizeof(unsigned char),
+        sizeof(float)
+    };
+    static_assert(sizeof(pointers) / sizeof(pointers[0]) == NUM_SNAPSHOT_ARRAYS &&
+                  sizeof(elementSizes) / sizeof(elementSizes[0]) == NUM_SNAPSHOT_ARRAYS,
+                  "one size per snapshot array");
+    for (int i = 0; i < NUM_SNAPSHOT_ARRAYS; i++) {
+        arrays[i] = pointers[i];
+        sizes[i] = elementSizes[i];
+    }
+}
+
+size_t align(size_t offset)
+{
+    return (offset + PARTICLE_ALIGNMENT - 1) / PARTICLE_ALIGNMENT * PARTICLE_ALIGNMENT;
+}
+
+// Bytes the arrays of `count` particles take, each one aligned
+size_t arraysSize(int count)
+{
+    char *arrays[NUM_SNAPSHOT_ARRAYS];
+    size_t sizes[NUM_SNAPSHOT_ARRAYS];
+    Particles none = Particles();
+    snapshotArrays(&none, arrays, sizes);
+
+    size_t size = 0;
+    for (int i = 0; i < NUM_SNAPSHOT_ARRAYS; i++) {
+        size += align(sizes[i] * count);
+    }
+    return size;
+}
+
+// Where the records end and the first array starts
+size_t headerSize(size_t numEmitters)
+{
+    return align(sizeof(SnapshotHeader) + numEmitters * sizeof(SnapshotEmitter));
+}
+
+// A file mapped for reading, unmapped when it goes out of scope
+struct MappedFile {
+    const char *data;
+    size_t size;
+
+    MappedFile() : data(NULL), size(0) {}
+    ~MappedFile()
+    {
+        if (data != NULL) {
+            munmap((void *)data, size);
+        }
+    }
+};
+
+bool mapFile(const char *path, MappedFile *file)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < off_t(sizeof(SnapshotHeader))) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    file->data = static_cast<const char *>(data);
+    file->size = status.st_size;
+    return true;
+}
+} // namespace
+
+bool saveSnapshot(const EmitterRegistry *registry, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    int count = registry->emitters.size();
+    vector<SnapshotEmitter> records(count);
+    size_t offset = headerSize(count);
+    for (int i = 0; i < count; i++) {
+        const Emitter &emitter = registry->emitters[i];
+        const Particles *particles = emitter.particles;
+        SnapshotEmitter &record = records[i];
+        memset(&record, 0, sizeof(record));
+        record.params = emitter.params;
+        record.origin[0] = emitter.origin.x;
+        record.origin[1] = emitter.origin.y;
+        record.origin[2] = emitter.origin.z;
+        record.capacity = particles->capacity;
+        record.numParticles = particles->numParticles;
+        record.spawnRemainder = particles->spawnRemainder;
+        record.seed[0] = particles->seed[0];
+        record.seed[1] = particles->seed[1];
+        record.nextId = particles->nextId;
+        record.offset = offset;
+        offset += arraysSize(particles->numParticles);
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.paramsSize = sizeof(EmitterParams);
+    header.numEmitters = count;
+    header.fileSize = offset;
+
+    // Zeros to pad every array up to the next boundary with
+    const char padding[PARTICLE_ALIGNMENT] = {};
+    size_t recordsEnd = sizeof(header) + count * sizeof(SnapshotEmitter);
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(records.data(), sizeof(SnapshotEmitter), count, file) == size_t(count) &&
+                   fwrite(padding, 1, headerSize(count) - recordsEnd, file) ==
+                   headerSize(count) - recordsEnd;
+
+    for (int i = 0; i < count && written; i++) {
+        const Particles *particles = registry->emitters[i].particles;
+        char *arrays[NUM_SNAPSHOT_ARRAYS];
+        size_t sizes[NUM_SNAPSHOT_ARRAYS];
+        snapshotArrays(particles, arrays, sizes);
+        for (int j = 0; j < NUM_SNAPSHOT_ARRAYS && written; j++) {
+            size_t size = sizes[j] * particles->numParticles;
+            written = fwrite(arrays[j], 1, size, file) == size &&
+                      fwrite(padding, 1, align(size) - size, file) == align(size) - size;
+        }
+    }
+
+    return fclose(file) == 0 && written;
+}
+
+bool loadSnapshot(EmitterRegistry *registry, const char *path, bool hugePages)
+{
+    MappedFile file;
+    if (!mapFile(path, &file)) {
+        return false;
+    }
+
+    // Check everything before touching the registry
+    SnapshotHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+        header.paramsSize != sizeof(EmitterParams) || header.fileSize != file.size ||
+        header.numEmitters == 0 || headerSize(header.numEmitters) > file.size) {
+        return false;
+    }
+    const SnapshotEmitter *records =
+        reinterpret_cast<const SnapshotEmitter *>(file.data + sizeof(SnapshotHeader));
+    for (uint32_t i = 0; i < header.numEmitters; i++) {
+        const SnapshotEmitter &record = records[i];
+        if (record.capacity <= 0 || record.numParticles < 0 ||
+            record.numParticles > record.capacity || record.offset % PARTICLE_ALIGNMENT != 0 ||
+            record.offset > file.size ||
+            arraysSize(record.numParticles) > file.size - record.offset) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < registry->emitters.size(); i++) {
+        destroyParticles(registry->emitters[i].particles);
+    }
+    registry->emitters.clear();
+
+    for (uint32_t i = 0; i < header.numEmitters; i++) {
+        const SnapshotEmitter &record = records[i];
+        glm::vec3 origin(record.origin[0], record.origin[1], record.origin[2]);
+        int index = addEmitter(registry, record.params, origin, record.capacity, hugePages);
+        Particles *particles = registry->emitters[index].particles;
+
+        char *arrays[NUM_SNAPSHOT_ARRAYS];
+        size_t sizes[NUM_SNAPSHOT_ARRAYS];
+        snapshotArrays(particles, arrays, sizes);
+        const char *data = file.data + record.offset;
+        for (int j = 0; j < NUM_SNAPSHOT_ARRAYS; j++) {
+            size_t size = sizes[j] * record.numParticles;
+            memcpy(arrays[j], data, size);
+            data += align(size);
+        }
+
+        particles->numParticles = record.numParticles;
+        particles->spawnRemainder = record.spawnRemainder;
+        particles->seed[0] = record.seed[0];
+        particles->seed[1] = record.seed[1];
+        particles->nextId = record.nextId;
+
+        // Nothing to interpolate from yet
+        size_t size = record.numParticles * sizeof(float);
+        memcpy(particles->prevPosX, particles->posX, size);
+        memcpy(particles->prevPosY, particles->posY, size);
+        memcpy(particles->prevPosZ, particles->posZ, size);
+        updateBounds(particles, true);
+    }
+
+    return true;
+}
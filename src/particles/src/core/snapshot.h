@@ -0,0 +1,48 @@
+#pragma once
+
+// Particle state snapshots. A snapshot holds every emitter of a registry:
+// its parameters, its origin and the live particles of its pool, with the
+// spawn state so that the simulation carries on exactly where it stopped.
+//
+// The file is a SnapshotHeader, a SnapshotEmitter per emitter and then the
+// particle arrays of every emitter, each starting on a PARTICLE_ALIGNMENT
+// boundary at the offsets the records give. Only the live particles are
+// stored, without their positions before the last step: a loaded pool
+// starts with nothing to interpolate from. Snapshots are read by mapping
+// the file, and are only meant to be read on the machine and build that
+// wrote them.
+
+#include "core/emitters.h"
+
+#include <cstdint>
+
+#define SNAPSHOT_MAGIC 0x50414e53  // "SNAP"
+#define SNAPSHOT_VERSION 2
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t paramsSize;  // sizeof(EmitterParams) of the build that wrote it
+    uint32_t numEmitters;
+    uint64_t fileSize;
+};
+
+struct SnapshotEmitter {
+    EmitterParams params;
+    float origin[3];
+    int32_t capacity;
+    int32_t numParticles;
+    float spawnRemainder;
+    uint32_t seed[2];
+    uint64_t nextId;
+    uint64_t offset;  // Of the first array, from the start of the file
+};
+
+// Write every emitter of `registry` to `path`. Returns false when the file
+// cannot be written.
+bool saveSnapshot(const EmitterRegistry *registry, const char *path);
+
+// Replace the emitters of `registry` with the ones in `path`. Returns false,
+// leaving the registry as it was, when the file cannot be read, holds no
+// emitters or is not a snapshot of this build.
+bool loadSnapshot(EmitterRegistry *registry, const char *path, bool hugePages = true);
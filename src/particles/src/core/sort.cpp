@@ -0,0 +1,178 @@
+#include "core/sort.h"
+#include "core/simulation.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// How far insertion sort may move a particle before it is sorted separately
+#define INCREMENTAL_WINDOW 32
+
+// Fall back to a full sort when more than 1/INCREMENTAL_MAX_REST of the
+// particles have to be sorted separately
+#define INCREMENTAL_MAX_REST 8
+
+namespace {
+// Camera distances are never negative, so the bits of the float order the
+// same way as the values. Inverted so that ascending keys are back to front.
+inline uint32_t depthKey(float distance)
+{
+    uint32_t bits;
+    memcpy(&bits, &distance, sizeof(bits));
+    return ~bits;
+}
+
+// The key in the high half and the slot index in the low half, comparing
+// two pairs compares by depth and then by index
+void makePairs(const Particles *particles, uint64_t *pairs)
+{
+    const float *cameraDistance = particles->cameraDistance;
+    for (int i = 0; i < particles->numParticles; i++) {
+        pairs[i] = (uint64_t(depthKey(cameraDistance[i])) << 32) | uint32_t(i);
+    }
+}
+
+// Sort `count` pairs by their key, `scratch` must hold as many. Returns the
+// buffer that ends up holding the result.
+uint64_t *radixSortPairs(uint64_t *pairs, uint64_t *scratch, int count)
+{
+    int histograms[4][256];
+    memset(histograms, 0, sizeof(histograms));
+
+    for (int i = 0; i < count; i++) {
+        uint32_t key = uint32_t(pairs[i] >> 32);
+        histograms[0][key & 0xff]++;
+        histograms[1][(key >> 8) & 0xff]++;
+        histograms[2][(key >> 16) & 0xff]++;
+        histograms[3][key >> 24]++;
+    }
+
+    for (int pass = 0; pass < 4; pass++) {
+        int shift = 32 + 8 * pass;
+        int *histogram = histograms[pass];
+
+        // Every key has the same digit, nothing to do
+        if (count == 0 || histogram[(pairs[0] >> shift) & 0xff] == count) {
+            continue;
+        }
+
+        int offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            int digitCount = histogram[digit];
+            histogram[digit] = offset;
+            offset += digitCount;
+        }
+
+        // Scattering in input order keeps the sort stable
+        for (int i = 0; i < count; i++) {
+            scratch[histogram[(pairs[i] >> shift) & 0xff]++] = pairs[i];
+        }
+
+        std::swap(pairs, scratch);
+    }
+
+    return pairs;
+}
+
+void writeIndices(const uint64_t *pairs, int count, int *indices)
+{
+    for (int i = 0; i < count; i++) {
+        indices[i] = int(uint32_t(pairs[i]));
+    }
+}
+} // namespace
+
+const char *sortModeName(SortMode mode)
+{
+    switch (mode) {
+    case SORT_COMPARISON: return "std::sort";
+    case SORT_RADIX: return "radix";
+    case SORT_INCREMENTAL: return "incremental";
+    default: return "unknown";
+    }
+}
+
+void depthOrderComparison(Particles *particles)
+{
+    int numParticles = particles->numParticles;
+    int *indices = particles->sortIndices;
+    const float *cameraDistance = particles->cameraDistance;
+
+    for (int i = 0; i < numParticles; i++) {
+        indices[i] = i;
+    }
+
+    // Sort in reverse order : far particles drawn first
+    std::sort(indices, indices + numParticles, [cameraDistance](int a, int b) {
+        if (cameraDistance[a] != cameraDistance[b]) {
+            return cameraDistance[a] > cameraDistance[b];
+        }
+        return a < b;
+    });
+}
+
+void depthOrderRadix(Particles *particles)
+{
+    int numParticles = particles->numParticles;
+    uint64_t *pairs = particles->sortPairs;
+
+    makePairs(particles, pairs);
+    pairs = radixSortPairs(pairs, pairs + particles->capacity, numParticles);
+    writeIndices(pairs, numParticles, particles->sortIndices);
+}
+
+void depthOrderIncremental(Particles *particles)
+{
+    int numParticles = particles->numParticles;
+    uint64_t *kept = particles->sortPairs;
+    uint64_t *rest = particles->sortPairs + particles->capacity;
+
+    makePairs(particles, kept);
+
+    // Insertion sort in place. Slot `numKept` is always at or before `i`, so
+    // the kept prefix never overwrites a pair that has not been read yet.
+    int numKept = 0;
+    int numRest = 0;
+    int maxRest = numParticles / INCREMENTAL_MAX_REST;
+    for (int i = 0; i < numParticles; i++) {
+        uint64_t pair = kept[i];
+
+        // Most particles are still in order
+        if (numKept == 0 || kept[numKept - 1] < pair) {
+            kept[numKept++] = pair;
+            continue;
+        }
+
+        int j = numKept - 1;
+        int window = std::max(0, numKept - INCREMENTAL_WINDOW);
+        while (j > window && kept[j - 1] > pair) {
+            j--;
+        }
+
+        if (j > 0 && kept[j - 1] > pair) {
+            if (numRest == maxRest) {
+                depthOrderRadix(particles);
+                return;
+            }
+            rest[numRest++] = pair;
+            continue;
+        }
+
+        for (int k = numKept; k > j; k--) {
+            kept[k] = kept[k - 1];
+        }
+        kept[j] = pair;
+        numKept++;
+    }
+
+    // The stragglers are few, a comparison sort is cheapest for them
+    std::sort(rest, rest + numRest);
+
+    int *indices = particles->sortIndices;
+    int a = 0;
+    int b = 0;
+    for (int i = 0; i < numParticles; i++) {
+        bool takeKept = b == numRest || (a < numKept && kept[a] < rest[b]);
+        indices[i] = int(uint32_t(takeKept ? kept[a++] : rest[b++]));
+    }
+}
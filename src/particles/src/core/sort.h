@@ -0,0 +1,27 @@
+#pragma once
+
+// Back to front depth ordering of the live particles. Every mode orders by
+// camera distance, far first, and breaks ties by slot index, so all of them
+// produce exactly the same order.
+
+struct Particles;
+
+enum SortMode {
+    SORT_COMPARISON,   // std::sort on the slot indices
+    SORT_RADIX,        // LSD radix sort on a 32-bit depth key
+    SORT_INCREMENTAL,  // Repair of the previous frame's order
+    NUM_SORT_MODES
+};
+
+const char *sortModeName(SortMode mode);
+
+// Write the back to front order of the first `numParticles` slots to
+// `particles->sortIndices`
+void depthOrderComparison(Particles *particles);
+void depthOrderRadix(Particles *particles);
+
+// The particles are still in the order of the last sort apart from the ones
+// spawned or moved by a removal since. Insertion sort repairs the order of
+// the particles that only moved a little, the rest are sorted on their own
+// and merged in. Falls back to the radix sort when too much has changed.
+void depthOrderIncremental(Particles *particles);
@@ -0,0 +1,56 @@
+#include "core/spawn.h"
+#include "core/random.h"
+#include "core/simulation.h"
+
+#include <cstring>
+
+#define PI 3.1415926535897932384626433832795
+
+void spawnScalar(Particles *particles, int begin, int end, const SpawnParams &params)
+{
+    for (int i = begin; i < end; i++) {
+        uint64_t id = params.firstId + (i - params.first);
+        uint32_t block[4] = { uint32_t(id), uint32_t(id >> 32), 0, 0 };
+        philox4x32(block, params.key);
+
+        float life = params.minLife + params.lifeRange * uniformFloat(block[3]);
+        particles->lives[i] = life;
+        particles->initLives[i] = life;
+
+        // Azimuth in [-pi, pi), which spawnSinCos covers directly, and
+        // polar angle in [0, spread]
+        float phi = float(PI) * (2.0f * uniformFloat(block[0]) - 1.0f);
+        float theta = params.spread * uniformFloat(block[1]);
+        float r = params.minSpeed + params.speedRange * uniformFloat(block[2]);
+
+        float sinPhi, cosPhi, sinTheta, cosTheta;
+        spawnSinCos(phi, &sinPhi, &cosPhi);
+        spawnSinCos(theta, &sinTheta, &cosTheta);
+
+        particles->speedX[i] = r * sinTheta * cosPhi;
+        particles->speedY[i] = r * sinTheta * sinPhi;
+        particles->speedZ[i] = r * cosTheta;
+
+        unsigned char *colour = &particles->colours[4*i];
+        colour[0] = block[0] & 0xff;
+        colour[1] = block[1] & 0xff;
+        colour[2] = block[2] & 0xff;
+        colour[3] = (block[3] & 0xff) / 3;
+
+        particles->posX[i] = 0.0f;
+        particles->posY[i] = 0.0f;
+        particles->posZ[i] = 0.0f;
+        particles->prevPosX[i] = 0.0f;
+        particles->prevPosY[i] = 0.0f;
+        particles->prevPosZ[i] = 0.0f;
+        particles->sizes[i] = params.initSize;
+    }
+}
+
+SpawnKernel spawnKernel(SimdLevel level)
+{
+    if (level > detectSimdLevel()) {
+        level = detectSimdLevel();
+    }
+    return level >= SIMD_AVX2 ? spawnAVX2 : spawnScalar;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+// Batched particle emission. Every new particle draws one Philox block
+// keyed by the pool's seed and counted by the particle's id: the top 24
+// bits of the four words give its azimuth, polar angle, speed and life, the
+// low bytes its colour. Sines and cosines come from a polynomial that the
+// vector kernels evaluate in the same order as the scalar one, so all
+// kernels emit bit-identical particles, independent of the thread count.
+
+#include "core/integrate.h"
+
+#include <cstdint>
+
+struct Particles;
+
+struct SpawnParams {
+    uint32_t key[2];
+    uint64_t firstId;  // Id of the particle in slot `first`
+    int first;
+
+    float spread;
+    float minSpeed;
+    float speedRange;
+    float minLife;     // Simulated seconds
+    float lifeRange;
+    float initSize;
+};
+
+// Initialise the new slots [begin, end) of `particles`
+typedef void (*SpawnKernel)(Particles *particles, int begin, int end,
+                            const SpawnParams &params);
+
+void spawnScalar(Particles *particles, int begin, int end, const SpawnParams &params);
+void spawnAVX2(Particles *particles, int begin, int end, const SpawnParams &params);
+
+// Kernel for `level`, which must not exceed detectSimdLevel(). There is no
+// SSE2 or AVX-512 kernel, those levels use the scalar and the AVX2 one.
+SpawnKernel spawnKernel(SimdLevel level);
+
+// sin(x) and cos(x) for x in [-pi, pi], from polynomials for the half
+// angle and the double-angle formulas
+inline void spawnSinCos(float x, float *sine, float *cosine)
+{
+    float h = x * 0.5f;
+    float h2 = h * h;
+
+    float s = -1.0f / 39916800.0f;
+    s = s * h2 + 1.0f / 362880.0f;
+    s = s * h2 - 1.0f / 5040.0f;
+    s = s * h2 + 1.0f / 120.0f;
+    s = s * h2 - 1.0f / 6.0f;
+    s = s * h2 + 1.0f;
+    s = s * h;
+
+    float c = 1.0f / 479001600.0f;
+    c = c * h2 - 1.0f / 3628800.0f;
+    c = c * h2 + 1.0f / 40320.0f;
+    c = c * h2 - 1.0f / 720.0f;
+    c = c * h2 + 1.0f / 24.0f;
+    c = c * h2 - 0.5f;
+    c = c * h2 + 1.0f;
+
+    *sine = 2.0f * s * c;
+    *cosine = 1.0f - 2.0f * s * s;
+}
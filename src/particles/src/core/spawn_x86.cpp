@@ -0,0 +1,170 @@
+// Vectorized version of spawnScalar, compiled for AVX2 with target
+// attributes and only called after detectSimdLevel() has confirmed
+// support. Eight particles at a time, the arithmetic is the scalar kernel's
+// in the same order.
+
+#include "core/spawn.h"
+#include "core/random.h"
+#include "core/simulation.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define PI 3.1415926535897932384626433832795
+
+namespace {
+// The low and high halves of the 32x32-bit products of every lane
+__attribute__((target("avx2")))
+inline void mulHiLo(__m256i a, __m256i b, __m256i *lo, __m256i *hi)
+{
+    __m256i even = _mm256_mul_epu32(a, b);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+    *lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+    *hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xaa);
+}
+
+__attribute__((target("avx2")))
+inline void philox8(__m256i block[4], const uint32_t seedKey[2])
+{
+    const __m256i m0 = _mm256_set1_epi32(PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi32(PHILOX_M1);
+    uint32_t key[2] = { seedKey[0], seedKey[1] };
+
+    for (int round = 0; round < PHILOX_ROUNDS; round++) {
+        if (round > 0) {
+            key[0] += PHILOX_W0;
+            key[1] += PHILOX_W1;
+        }
+        __m256i lo0, hi0, lo1, hi1;
+        mulHiLo(m0, block[0], &lo0, &hi0);
+        mulHiLo(m1, block[2], &lo1, &hi1);
+
+        __m256i next0 = _mm256_xor_si256(_mm256_xor_si256(hi1, block[1]),
+                                         _mm256_set1_epi32(key[0]));
+        __m256i next2 = _mm256_xor_si256(_mm256_xor_si256(hi0, block[3]),
+                                         _mm256_set1_epi32(key[1]));
+        block[0] = next0;
+        block[1] = lo1;
+        block[2] = next2;
+        block[3] = lo0;
+    }
+}
+
+__attribute__((target("avx2")))
+inline __m256 uniform8(__m256i bits)
+{
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(bits, 8)),
+                         _mm256_set1_ps(1.0f / 16777216.0f));
+}
+
+// spawnSinCos on eight lanes
+__attribute__((target("avx2")))
+inline void sinCos8(__m256 x, __m256 *sine, __m256 *cosine)
+{
+    __m256 h = _mm256_mul_ps(x, _mm256_set1_ps(0.5f));
+    __m256 h2 = _mm256_mul_ps(h, h);
+
+    __m256 s = _mm256_set1_ps(-1.0f / 39916800.0f);
+    s = _mm256_add_ps(_mm256_mul_ps(s, h2), _mm256_set1_ps(1.0f / 362880.0f));
+    s = _mm256_sub_ps(_mm256_mul_ps(s, h2), _mm256_set1_ps(1.0f / 5040.0f));
+    s = _mm256_add_ps(_mm256_mul_ps(s, h2), _mm256_set1_ps(1.0f / 120.0f));
+    s = _mm256_sub_ps(_mm256_mul_ps(s, h2), _mm256_set1_ps(1.0f / 6.0f));
+    s = _mm256_add_ps(_mm256_mul_ps(s, h2), _mm256_set1_ps(1.0f));
+    s = _mm256_mul_ps(s, h);
+
+    __m256 c = _mm256_set1_ps(1.0f / 479001600.0f);
+    c = _mm256_sub_ps(_mm256_mul_ps(c, h2), _mm256_set1_ps(1.0f / 3628800.0f));
+    c = _mm256_add_ps(_mm256_mul_ps(c, h2), _mm256_set1_ps(1.0f / 40320.0f));
+    c = _mm256_sub_ps(_mm256_mul_ps(c, h2), _mm256_set1_ps(1.0f / 720.0f));
+    c = _mm256_add_ps(_mm256_mul_ps(c, h2), _mm256_set1_ps(1.0f / 24.0f));
+    c = _mm256_sub_ps(_mm256_mul_ps(c, h2), _mm256_set1_ps(0.5f));
+    c = _mm256_add_ps(_mm256_mul_ps(c, h2), _mm256_set1_ps(1.0f));
+
+    *sine = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), s), c);
+    *cosine = _mm256_sub_ps(_mm256_set1_ps(1.0f),
+                            _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), s), s));
+}
+} // namespace
+
+__attribute__((target("avx2")))
+void spawnAVX2(Particles *particles, int begin, int end, const SpawnParams &params)
+{
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i lowByte = _mm256_set1_epi32(0xff);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 pi = _mm256_set1_ps(float(PI));
+    const __m256 spread = _mm256_set1_ps(params.spread);
+    const __m256 minSpeed = _mm256_set1_ps(params.minSpeed);
+    const __m256 speedRange = _mm256_set1_ps(params.speedRange);
+    const __m256 minLife = _mm256_set1_ps(params.minLife);
+    const __m256 lifeRange = _mm256_set1_ps(params.lifeRange);
+    const __m256 initSize = _mm256_set1_ps(params.initSize);
+
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        // Ids of the eight particles, carrying into the high word where the
+        // low one wraps
+        uint64_t id = params.firstId + (i - params.first);
+        __m256i idLow = _mm256_add_epi32(_mm256_set1_epi32(uint32_t(id)), lanes);
+        __m256i carry = _mm256_cmpgt_epi32(
+            _mm256_xor_si256(_mm256_set1_epi32(uint32_t(id)), _mm256_set1_epi32(0x80000000)),
+            _mm256_xor_si256(idLow, _mm256_set1_epi32(0x80000000)));
+        __m256i idHigh = _mm256_sub_epi32(_mm256_set1_epi32(uint32_t(id >> 32)), carry);
+
+        __m256i block[4] = { idLow, idHigh, _mm256_setzero_si256(), _mm256_setzero_si256() };
+        philox8(block, params.key);
+
+        __m256 life = _mm256_add_ps(minLife, _mm256_mul_ps(lifeRange, uniform8(block[3])));
+        _mm256_storeu_ps(particles->lives + i, life);
+        _mm256_storeu_ps(particles->initLives + i, life);
+
+        __m256 phi = _mm256_mul_ps(pi, _mm256_sub_ps(_mm256_mul_ps(two, uniform8(block[0])), one));
+        __m256 theta = _mm256_mul_ps(spread, uniform8(block[1]));
+        __m256 r = _mm256_add_ps(minSpeed, _mm256_mul_ps(speedRange, uniform8(block[2])));
+
+        __m256 sinPhi, cosPhi, sinTheta, cosTheta;
+        sinCos8(phi, &sinPhi, &cosPhi);
+        sinCos8(theta, &sinTheta, &cosTheta);
+
+        __m256 rSinTheta = _mm256_mul_ps(r, sinTheta);
+        _mm256_storeu_ps(particles->speedX + i, _mm256_mul_ps(rSinTheta, cosPhi));
+        _mm256_storeu_ps(particles->speedY + i, _mm256_mul_ps(rSinTheta, sinPhi));
+        _mm256_storeu_ps(particles->speedZ + i, _mm256_mul_ps(r, cosTheta));
+
+        // RGBA from the low bytes, alpha divided by three as x * 171 >> 9,
+        // which is exact for bytes
+        __m256i red = _mm256_and_si256(block[0], lowByte);
+        __m256i green = _mm256_and_si256(block[1], lowByte);
+        __m256i blue = _mm256_and_si256(block[2], lowByte);
+        __m256i alpha = _mm256_srli_epi32(
+            _mm256_mullo_epi32(_mm256_and_si256(block[3], lowByte), _mm256_set1_epi32(171)), 9);
+        __m256i colour = _mm256_or_si256(
+            _mm256_or_si256(red, _mm256_slli_epi32(green, 8)),
+            _mm256_or_si256(_mm256_slli_epi32(blue, 16), _mm256_slli_epi32(alpha, 24)));
+        _mm256_storeu_si256((__m256i *)(particles->colours + 4 * i), colour);
+
+        _mm256_storeu_ps(particles->posX + i, zero);
+        _mm256_storeu_ps(particles->posY + i, zero);
+        _mm256_storeu_ps(particles->posZ + i, zero);
+        _mm256_storeu_ps(particles->prevPosX + i, zero);
+        _mm256_storeu_ps(particles->prevPosY + i, zero);
+        _mm256_storeu_ps(particles->prevPosZ + i, zero);
+        _mm256_storeu_ps(particles->sizes + i, initSize);
+    }
+
+    spawnScalar(particles, i, end, params);
+}
+
+#else
+
+// No vector kernel on other architectures, detectSimdLevel() never reports
+// it but the symbol still has to exist
+void spawnAVX2(Particles *particles, int begin, int end, const SpawnParams &params)
+{
+    spawnScalar(particles, begin, end, params);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#include "core/timestep.h"
+
+#include <cmath>
+
+void initTimestep(Timestep *timestep, float step, int maxSubsteps)
+{
+    timestep->step = step;
+    timestep->maxSubsteps = maxSubsteps;
+    resetTimestep(timestep);
+}
+
+void resetTimestep(Timestep *timestep)
+{
+    timestep->accumulator = 0.0;
+    timestep->alpha = 0.0f;
+    timestep->steps = 0;
+    timestep->droppedSteps = 0;
+}
+
+int advanceTimestep(Timestep *timestep, float timeDelta)
+{
+    double step = timestep->step;
+    timestep->accumulator += timeDelta;
+
+    long long steps = (long long)(timestep->accumulator / step);
+    if (steps > timestep->maxSubsteps) {
+        timestep->droppedSteps += steps - timestep->maxSubsteps;
+        steps = timestep->maxSubsteps;
+        timestep->accumulator = std::fmod(timestep->accumulator, step);
+    } else {
+        timestep->accumulator -= steps * step;
+    }
+
+    timestep->alpha = float(timestep->accumulator / step);
+    timestep->steps += steps;
+    return int(steps);
+}
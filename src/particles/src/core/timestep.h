@@ -0,0 +1,36 @@
+#pragma once
+
+// Fixed timestep with an accumulator. Frame times are added up and the
+// simulation advances in whole steps of a fixed length, so its results and
+// its cost per simulated second do not depend on the frame rate. What is
+// left over is less than a step and is carried to the next frame; it also
+// tells the renderer how far to interpolate between the last two steps.
+
+// Default step length in seconds of wall time
+#define DEFAULT_STEP (1.0f / 60.0f)
+
+// Default number of steps a single frame may run
+#define DEFAULT_MAX_SUBSTEPS 8
+
+struct Timestep {
+    float step;       // Wall seconds per step
+    int maxSubsteps;  // Steps per frame beyond which the backlog is dropped
+
+    double accumulator;  // Wall time not yet simulated, less than a step
+    float alpha;         // accumulator / step, where rendering interpolates to
+
+    long long steps;         // Steps run since the last reset
+    long long droppedSteps;  // Steps the guard dropped since the last reset
+};
+
+void initTimestep(Timestep *timestep, float step = DEFAULT_STEP,
+                  int maxSubsteps = DEFAULT_MAX_SUBSTEPS);
+
+// Forget the accumulated time and the counters
+void resetTimestep(Timestep *timestep);
+
+// Add `timeDelta` seconds of wall time and return the number of steps to
+// run for it. A hitch that would need more than `maxSubsteps` steps runs
+// that many and drops the rest, so one slow frame cannot make the next
+// ones slower.
+int advanceTimestep(Timestep *timestep, float timeDelta);
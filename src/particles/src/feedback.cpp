@@ -0,0 +1,194 @@
+#include "feedback.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+const char *const FEEDBACK_VARYINGS[NUM_FEEDBACK_VARYINGS] = {
+    "out_position", "out_life", "out_speed", "out_init_life", "out_fraction", "out_colour"
+};
+
+namespace {
+// Attribute locations of particle_update.vert
+enum FeedbackAttribute {
+    STATE_POSITION,
+    STATE_LIFE,
+    STATE_SPEED,
+    STATE_INIT_LIFE,
+    STATE_COLOUR,
+    NUM_STATE_ATTRIBUTES
+};
+
+void allocateBuffers(FeedbackSimulation *sim, int capacity)
+{
+    glGenBuffers(2, sim->buffers);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_ARRAY_BUFFER, sim->buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(FeedbackParticle), NULL, GL_DYNAMIC_COPY);
+    }
+    sim->capacity = capacity;
+}
+
+// Read the particle state from `buffer`
+void bindState(GLuint buffer)
+{
+    GLsizei stride = sizeof(FeedbackParticle);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(STATE_POSITION, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(FeedbackParticle, position));
+    glVertexAttribPointer(STATE_LIFE, 1, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(FeedbackParticle, life));
+    glVertexAttribPointer(STATE_SPEED, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(FeedbackParticle, speed));
+    glVertexAttribPointer(STATE_INIT_LIFE, 1, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(FeedbackParticle, initLife));
+    glVertexAttribIPointer(STATE_COLOUR, 1, GL_UNSIGNED_INT, stride,
+                           (void *)offsetof(FeedbackParticle, colour));
+}
+
+// Copy the particles spawnParticles emitted into the staging records
+void stageSpawned(FeedbackSimulation *sim, int count)
+{
+    const Particles *spawned = sim->spawned;
+    sim->staging.resize(count);
+
+    for (int i = 0; i < count; i++) {
+        FeedbackParticle *particle = &sim->staging[i];
+        particle->position[0] = spawned->posX[i];
+        particle->position[1] = spawned->posY[i];
+        particle->position[2] = spawned->posZ[i];
+        particle->life = spawned->lives[i];
+        particle->speed[0] = spawned->speedX[i];
+        particle->speed[1] = spawned->speedY[i];
+        particle->speed[2] = spawned->speedZ[i];
+        particle->initLife = spawned->initLives[i];
+        particle->fraction = 1.0f;
+        memcpy(&particle->colour, &spawned->colours[4*i], 4);
+    }
+}
+} // namespace
+
+const char *backendName(SimulationBackend backend)
+{
+    switch (backend) {
+    case BACKEND_CPU: return "cpu";
+    case BACKEND_FEEDBACK: return "feedback";
+    default: return "unknown";
+    }
+}
+
+void createFeedbackSimulation(FeedbackSimulation *sim, GLuint program, unsigned seed,
+                              int capacity)
+{
+    sim->program = program;
+
+    // Keep the state attributes out of the viewer's vertex array
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glGenVertexArrays(1, &sim->vao);
+    glBindVertexArray(sim->vao);
+    for (int i = 0; i < NUM_STATE_ATTRIBUTES; i++) {
+        glEnableVertexAttribArray(i);
+    }
+    glBindVertexArray(previous);
+
+    allocateBuffers(sim, capacity);
+    glGenBuffers(1, &sim->spawnBuffer);
+    glGenQueries(1, &sim->query);
+
+    sim->spawned = createParticles(seed, capacity);
+
+    resetFeedbackSimulation(sim);
+}
+
+void destroyFeedbackSimulation(FeedbackSimulation *sim)
+{
+    destroyParticles(sim->spawned);
+    glDeleteQueries(1, &sim->query);
+    glDeleteBuffers(1, &sim->spawnBuffer);
+    glDeleteBuffers(2, sim->buffers);
+    glDeleteVertexArrays(1, &sim->vao);
+}
+
+void resetFeedbackSimulation(FeedbackSimulation *sim)
+{
+    sim->current = 0;
+    sim->numParticles = 0;
+    resetParticles(sim->spawned);
+}
+
+void resizeFeedbackSimulation(FeedbackSimulation *sim, int capacity)
+{
+    GLuint old = sim->buffers[sim->current];
+    GLuint other = sim->buffers[1 - sim->current];
+
+    allocateBuffers(sim, capacity);
+
+    int count = std::min(sim->numParticles, capacity);
+    glBindBuffer(GL_COPY_READ_BUFFER, old);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, sim->buffers[0]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        count * sizeof(FeedbackParticle));
+    sim->current = 0;
+    sim->numParticles = count;
+
+    glDeleteBuffers(1, &old);
+    glDeleteBuffers(1, &other);
+
+    resizeParticles(sim->spawned, capacity);
+}
+
+void simulateFeedback(FeedbackSimulation *sim, const EmitterParams &params, float timeDelta)
+{
+    float delta = timeDelta * STRETCH;
+
+    // Emit on the CPU, the pass below integrates the newborn particles
+    // along with the old ones. Only the pool is emptied, the fraction of a
+    // particle owed to the next step is kept.
+    sim->spawned->numParticles = 0;
+    spawnParticles(sim->spawned, params, delta);
+    int numSpawned = std::min(sim->spawned->numParticles, sim->capacity - sim->numParticles);
+
+    stageSpawned(sim, numSpawned);
+    glBindBuffer(GL_ARRAY_BUFFER, sim->spawnBuffer);
+    glBufferData(GL_ARRAY_BUFFER, numSpawned * sizeof(FeedbackParticle),
+                 numSpawned > 0 ? &sim->staging[0] : NULL, GL_STREAM_DRAW);
+
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glBindVertexArray(sim->vao);
+
+    glUseProgram(sim->program);
+    glUniform1f(glGetUniformLocation(sim->program, "delta"), delta);
+    glUniform1f(glGetUniformLocation(sim->program, "gravity_step"),
+                params.gravity * delta * 0.5f);
+    glUniform1f(glGetUniformLocation(sim->program, "wind"), params.wind);
+
+    // Nothing is drawn, the pass only writes the feedback buffer
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    int next = 1 - sim->current;
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, sim->buffers[next]);
+    glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, sim->query);
+    glBeginTransformFeedback(GL_POINTS);
+
+    bindState(sim->buffers[sim->current]);
+    glDrawArrays(GL_POINTS, 0, sim->numParticles);
+
+    bindState(sim->spawnBuffer);
+    glDrawArrays(GL_POINTS, 0, numSpawned);
+
+    glEndTransformFeedback();
+    glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+    glDisable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(previous);
+
+    // The next step and the draw need the count. GL 3.2 has no
+    // glDrawTransformFeedback, so read it back.
+    GLuint written = 0;
+    glGetQueryObjectuiv(sim->query, GL_QUERY_RESULT, &written);
+    sim->numParticles = written;
+    sim->current = next;
+}
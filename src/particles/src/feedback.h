@@ -0,0 +1,75 @@
+#pragma once
+
+// GPU simulation backend. The particle state lives in two buffers that are
+// ping-ponged every step: particle_update.vert integrates the particles of
+// one with transform feedback capturing into the other, and
+// particle_update.geom drops the ones whose life ran out. The particles born
+// in the step are drawn through the same pass after the old ones, which
+// appends them to the feedback stream. Only the newborn particles are ever
+// uploaded, the state itself never leaves GPU memory.
+//
+// Spawning reuses spawnParticles on a CPU pool so that both backends emit
+// the same particles. The particles stay in birth order, they are not
+// sorted.
+
+#include "core/simulation.h"
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <vector>
+
+// Where the particles are simulated
+enum SimulationBackend {
+    BACKEND_CPU,
+    BACKEND_FEEDBACK,
+    NUM_BACKENDS
+};
+
+const char *backendName(SimulationBackend backend);
+
+// One particle in the state buffers, laid out in the order the update
+// program captures its outputs
+struct FeedbackParticle {
+    float position[3];
+    float life;
+    float speed[3];
+    float initLife;
+    float fraction;   // life over initLife, for the render pass
+    uint32_t colour;  // RGBA, one byte each
+};
+
+#define NUM_FEEDBACK_VARYINGS 6
+
+// The captured outputs of particle_update.geom, to link the program with
+extern const char *const FEEDBACK_VARYINGS[NUM_FEEDBACK_VARYINGS];
+
+struct FeedbackSimulation {
+    GLuint program;  // The update program, not owned
+    GLuint vao;
+    GLuint buffers[2];
+    GLuint spawnBuffer;
+    GLuint query;
+    int current;  // The buffer holding the live particles
+    int capacity;
+    int numParticles;
+
+    // The particles born in the current step
+    Particles *spawned;
+    std::vector<FeedbackParticle> staging;
+};
+
+void createFeedbackSimulation(FeedbackSimulation *sim, GLuint program, unsigned seed,
+                              int capacity = DEFAULT_CAPACITY);
+
+void destroyFeedbackSimulation(FeedbackSimulation *sim);
+
+void resetFeedbackSimulation(FeedbackSimulation *sim);
+
+// Move the particles to buffers with room for `capacity` particles. When
+// shrinking below the number of live particles the youngest are dropped.
+void resizeFeedbackSimulation(FeedbackSimulation *sim, int capacity);
+
+// Spawn and integrate like simulateParticles, without sorting. Reads back
+// the number of live particles, which waits for the step to finish.
+void simulateFeedback(FeedbackSimulation *sim, const EmitterParams &params, float timeDelta);
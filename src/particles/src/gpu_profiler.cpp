@@ -0,0 +1,125 @@
+#include "gpu_profiler.h"
+
+namespace {
+// Add the scopes of `frame` to the profiler, one time per phase. Returns
+// false, leaving the frame pending, when its queries are not done and
+// `wait` is not set.
+bool readFrame(GpuProfiler *gpu, GpuFrame *frame, bool wait)
+{
+    if (!frame->pending) {
+        return true;
+    }
+    if (frame->numScopes > 0 && !wait) {
+        GLint available = 0;
+        const GpuScope &last = frame->scopes[frame->numScopes - 1];
+        glGetQueryObjectiv(last.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return false;
+        }
+    }
+
+    double times[NUM_PROFILE_PHASES] = {};
+    double starts[NUM_PROFILE_PHASES];
+    bool timed[NUM_PROFILE_PHASES] = {};
+    for (int i = 0; i < frame->numScopes; i++) {
+        const GpuScope &scope = frame->scopes[i];
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(scope.queries[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(scope.queries[1], GL_QUERY_RESULT, &end);
+
+        // Nanoseconds on the GPU clock to microseconds on the profiler's
+        if (!timed[scope.phase]) {
+            starts[scope.phase] = frame->cpuTime + (GLint64(begin) - frame->gpuTime) * 1e-3;
+            timed[scope.phase] = true;
+        }
+        times[scope.phase] += (end - begin) * 1e-6;
+    }
+    for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+        if (timed[phase]) {
+            addProfileTime(gpu->profiler, ProfilePhase(phase), PROFILE_GPU, starts[phase],
+                           times[phase]);
+        }
+    }
+
+    frame->pending = false;
+    return true;
+}
+} // namespace
+
+bool createGpuProfiler(GpuProfiler *gpu, Profiler *profiler)
+{
+    gpu->profiler = profiler;
+    gpu->supported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    gpu->frame = 0;
+    gpu->open = false;
+    for (int i = 0; i < GPU_PROFILER_FRAMES; i++) {
+        GpuFrame *frame = &gpu->frames[i];
+        frame->numScopes = 0;
+        frame->pending = false;
+        for (int j = 0; j < GPU_PROFILER_SCOPES && gpu->supported; j++) {
+            glGenQueries(2, frame->scopes[j].queries);
+        }
+    }
+    return gpu->supported;
+}
+
+void destroyGpuProfiler(GpuProfiler *gpu)
+{
+    for (int i = 0; i < GPU_PROFILER_FRAMES && gpu->supported; i++) {
+        for (int j = 0; j < GPU_PROFILER_SCOPES; j++) {
+            glDeleteQueries(2, gpu->frames[i].scopes[j].queries);
+        }
+    }
+    gpu->supported = false;
+}
+
+void beginGpuScope(GpuProfiler *gpu, ProfilePhase phase)
+{
+    GpuFrame *frame = &gpu->frames[gpu->frame];
+    if (!gpu->supported || gpu->open || frame->numScopes == GPU_PROFILER_SCOPES) {
+        return;
+    }
+    if (frame->numScopes == 0) {
+        frame->cpuTime = profileClock(gpu->profiler);
+        glGetInteger64v(GL_TIMESTAMP, &frame->gpuTime);
+    }
+
+    GpuScope *scope = &frame->scopes[frame->numScopes];
+    scope->phase = phase;
+    glQueryCounter(scope->queries[0], GL_TIMESTAMP);
+    gpu->open = true;
+}
+
+void endGpuScope(GpuProfiler *gpu)
+{
+    if (!gpu->open) {
+        return;
+    }
+    GpuFrame *frame = &gpu->frames[gpu->frame];
+    glQueryCounter(frame->scopes[frame->numScopes].queries[1], GL_TIMESTAMP);
+    frame->numScopes++;
+    gpu->open = false;
+}
+
+void endGpuFrame(GpuProfiler *gpu)
+{
+    if (!gpu->supported) {
+        return;
+    }
+    endGpuScope(gpu);
+    gpu->frames[gpu->frame].pending = gpu->frames[gpu->frame].numScopes > 0;
+
+    // Oldest first, so that the times go in in order
+    for (int i = 1; i <= GPU_PROFILER_FRAMES; i++) {
+        GpuFrame *frame = &gpu->frames[(gpu->frame + i) % GPU_PROFILER_FRAMES];
+        if (!readFrame(gpu, frame, false)) {
+            break;
+        }
+    }
+
+    gpu->frame = (gpu->frame + 1) % GPU_PROFILER_FRAMES;
+    GpuFrame *next = &gpu->frames[gpu->frame];
+    readFrame(gpu, next, true);
+    next->numScopes = 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// GPU times of the frame phases for the profiler, see core/profiler.h.
+// Each scope is a pair of GL_TIMESTAMP queries; the particle pass already
+// runs a GL_TIME_ELAPSED query of its own, and those cannot nest. The
+// results are read GPU_PROFILER_FRAMES frames later instead of waiting for
+// them, and placed on the profiler's clock through a GPU and CPU time pair
+// taken when the frame's first scope began.
+
+#include "core/profiler.h"
+
+#include <GL/glew.h>
+
+// Frames in flight before their queries are read
+#define GPU_PROFILER_FRAMES 4
+
+// Scopes per frame, later ones are not timed
+#define GPU_PROFILER_SCOPES 16
+
+struct GpuScope {
+    ProfilePhase phase;
+    GLuint queries[2];  // Timestamps of the beginning and the end
+};
+
+struct GpuFrame {
+    GpuScope scopes[GPU_PROFILER_SCOPES];
+    int numScopes;
+    bool pending;  // Issued and not read yet
+    double cpuTime;  // profileClock and GPU time at the first scope
+    GLint64 gpuTime;
+};
+
+struct GpuProfiler {
+    Profiler *profiler;  // Not owned
+    bool supported;  // False without timer queries, the scopes do nothing
+    GpuFrame frames[GPU_PROFILER_FRAMES];
+    int frame;  // The one being recorded
+    bool open;  // Its last scope has begun and not ended
+};
+
+// Returns false without timer queries
+bool createGpuProfiler(GpuProfiler *gpu, Profiler *profiler);
+
+void destroyGpuProfiler(GpuProfiler *gpu);
+
+void beginGpuScope(GpuProfiler *gpu, ProfilePhase phase);
+
+void endGpuScope(GpuProfiler *gpu);
+
+// Add the times of every finished frame to the profiler and start the next
+// frame, waiting for the oldest one if it is still in flight
+void endGpuFrame(GpuProfiler *gpu);
@@ -0,0 +1,111 @@
+#include "offscreen.h"
+
+namespace {
+// Texture unit of the target in the upsample pass, clear of the viewer's
+// buffer textures and the OIT targets
+const int OFFSCREEN_UNIT = 4;
+
+// Create the texture and attach it to the framebuffer
+bool attachTarget(OffscreenTarget *target, int width, int height)
+{
+    target->width = width;
+    target->height = height;
+
+    glGenTextures(1, &target->colourTexture);
+    glBindTexture(GL_TEXTURE_2D, target->colourTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint previous = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           target->colourTexture, 0);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+    return complete;
+}
+} // namespace
+
+bool createOffscreenTarget(OffscreenTarget *target, GLuint program, int width, int height)
+{
+    setOffscreenProgram(target, program);
+    glGenVertexArrays(1, &target->vao);
+    glGenFramebuffers(1, &target->framebuffer);
+
+    if (!attachTarget(target, width, height)) {
+        destroyOffscreenTarget(target);
+        return false;
+    }
+    return true;
+}
+
+void destroyOffscreenTarget(OffscreenTarget *target)
+{
+    glDeleteTextures(1, &target->colourTexture);
+    glDeleteFramebuffers(1, &target->framebuffer);
+    glDeleteVertexArrays(1, &target->vao);
+    target->framebuffer = 0;
+    target->colourTexture = 0;
+    target->vao = 0;
+}
+
+void setOffscreenProgram(OffscreenTarget *target, GLuint program)
+{
+    target->program = program;
+    target->screenSizeId = glGetUniformLocation(program, "screen_size");
+
+    GLint previous = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "particle_texture"), OFFSCREEN_UNIT);
+    glUseProgram(previous);
+}
+
+void resizeOffscreenTarget(OffscreenTarget *target, int width, int height)
+{
+    if (target->framebuffer == 0 || (target->width == width && target->height == height)) {
+        return;
+    }
+    glDeleteTextures(1, &target->colourTexture);
+    attachTarget(target, width, height);
+}
+
+void beginOffscreen(OffscreenTarget *target)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+    glViewport(0, 0, target->width, target->height);
+
+    const GLfloat clear[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    glClearBufferfv(GL_COLOR, 0, clear);
+}
+
+void upsampleOffscreen(OffscreenTarget *target, GLuint framebuffer, int width, int height)
+{
+    GLint program = 0;
+    GLint vao = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+    glUseProgram(target->program);
+    glUniform2f(target->screenSizeId, float(width), float(height));
+
+    glActiveTexture(GL_TEXTURE0 + OFFSCREEN_UNIT);
+    glBindTexture(GL_TEXTURE_2D, target->colourTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Premultiplied colour over what the background lets through
+    glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+    glBindVertexArray(target->vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindVertexArray(vao);
+    glUseProgram(program);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// A reduced resolution target for the particle pass. Large soft particles
+// are fill rate bound, so drawing them at a half or a quarter of the window
+// size and scaling the result up trades sharpness for fragment work.
+//
+// The target holds the particles' premultiplied colour over a black
+// background, with the transmittance of the background in alpha: the
+// particle blend functions carry the product of (1 - alpha) along in the
+// alpha channel. The upsample pass filters the target bilinearly and
+// blends it over the frame as colour + background * transmittance.
+
+#include <GL/glew.h>
+
+struct OffscreenTarget {
+    GLuint framebuffer;
+    GLuint colourTexture;  // RGBA16F
+    GLuint program;        // The upsample program, not owned
+    GLint screenSizeId;
+    GLuint vao;            // Empty, the upsample pass has no attributes
+    int width;
+    int height;
+};
+
+// Create a target of `width` by `height` pixels. Returns false, leaving the
+// target empty, when the framebuffer is incomplete.
+bool createOffscreenTarget(OffscreenTarget *target, GLuint program, int width, int height);
+
+void destroyOffscreenTarget(OffscreenTarget *target);
+
+// Use a newly linked upsample program
+void setOffscreenProgram(OffscreenTarget *target, GLuint program);
+
+// Recreate the texture when the size changed
+void resizeOffscreenTarget(OffscreenTarget *target, int width, int height);
+
+// Clear the target, nothing drawn and all of the background showing, and
+// draw the following calls into it at its size
+void beginOffscreen(OffscreenTarget *target);
+
+// Scale the target up over `framebuffer`, which is `width` by `height`
+// pixels, and leave the viewport at that size. Leaves the bound program and
+// vertex array as they were.
+void upsampleOffscreen(OffscreenTarget *target, GLuint framebuffer, int width, int height);
@@ -0,0 +1,138 @@
+#include "oit.h"
+
+namespace {
+// Texture units of the targets in the composite pass, clear of the
+// viewer's buffer textures
+enum OitUnit {
+    ACCUM_UNIT = 2,
+    WEIGHT_UNIT = 3
+};
+
+GLuint createTarget(GLint format, GLenum layout, int width, int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, layout, GL_HALF_FLOAT, NULL);
+    return texture;
+}
+
+// Create the textures and attach them to the framebuffer
+bool attachTargets(OitTargets *targets, int width, int height)
+{
+    targets->width = width;
+    targets->height = height;
+    targets->accumTexture = createTarget(GL_RGBA16F, GL_RGBA, width, height);
+    targets->weightTexture = createTarget(GL_R16F, GL_RED, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint previous = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+    glBindFramebuffer(GL_FRAMEBUFFER, targets->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           targets->accumTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                           targets->weightTexture, 0);
+    const GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, buffers);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+    return complete;
+}
+
+void deleteTargets(OitTargets *targets)
+{
+    glDeleteTextures(1, &targets->accumTexture);
+    glDeleteTextures(1, &targets->weightTexture);
+}
+} // namespace
+
+bool createOitTargets(OitTargets *targets, GLuint program, int width, int height)
+{
+    setOitProgram(targets, program);
+    glGenVertexArrays(1, &targets->vao);
+    glGenFramebuffers(1, &targets->framebuffer);
+
+    if (!attachTargets(targets, width, height)) {
+        destroyOitTargets(targets);
+        return false;
+    }
+    return true;
+}
+
+void setOitProgram(OitTargets *targets, GLuint program)
+{
+    targets->program = program;
+
+    GLint previous = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "accum_texture"), ACCUM_UNIT);
+    glUniform1i(glGetUniformLocation(program, "weight_texture"), WEIGHT_UNIT);
+    glUseProgram(previous);
+}
+
+void destroyOitTargets(OitTargets *targets)
+{
+    deleteTargets(targets);
+    glDeleteFramebuffers(1, &targets->framebuffer);
+    glDeleteVertexArrays(1, &targets->vao);
+    targets->framebuffer = 0;
+    targets->accumTexture = 0;
+    targets->weightTexture = 0;
+    targets->vao = 0;
+}
+
+void resizeOitTargets(OitTargets *targets, int width, int height)
+{
+    if (targets->framebuffer == 0 ||
+        (targets->width == width && targets->height == height)) {
+        return;
+    }
+    deleteTargets(targets);
+    attachTargets(targets, width, height);
+}
+
+void beginOit(OitTargets *targets)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, targets->framebuffer);
+
+    // Nothing accumulated and all of the background revealed
+    const GLfloat accum[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    const GLfloat weight[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, accum);
+    glClearBufferfv(GL_COLOR, 1, weight);
+
+    // Colours and weights add up, the alpha of the accumulation target
+    // multiplies into the revealage
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void compositeOit(OitTargets *targets, GLuint framebuffer)
+{
+    GLint program = 0;
+    GLint vao = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glUseProgram(targets->program);
+
+    glActiveTexture(GL_TEXTURE0 + ACCUM_UNIT);
+    glBindTexture(GL_TEXTURE_2D, targets->accumTexture);
+    glActiveTexture(GL_TEXTURE0 + WEIGHT_UNIT);
+    glBindTexture(GL_TEXTURE_2D, targets->weightTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    // The average covers all of the background but its revealage, which
+    // also multiplies into the transmittance of an offscreen target
+    glBlendFuncSeparate(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA, GL_ZERO, GL_SRC_ALPHA);
+    glBindVertexArray(targets->vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindVertexArray(vao);
+    glUseProgram(program);
+}
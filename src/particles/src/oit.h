@@ -0,0 +1,46 @@
+#pragma once
+
+// Weighted blended order-independent transparency (McGuire and Bavoil,
+// 2013). The alpha blended particles are drawn in any order into two
+// offscreen targets: one accumulates the premultiplied colours scaled by a
+// depth weight, the other the sum of the weights, and the product of
+// (1 - alpha) is kept as the revealage of the background. A full screen
+// pass then divides the two and blends the result over the frame. The
+// result approximates back to front blending without sorting anything.
+//
+// GL 3.2 has no blend state per draw buffer, so the revealage rides in the
+// alpha channel of the accumulation target and one separate blend function
+// serves both targets, see beginOit.
+
+#include <GL/glew.h>
+
+struct OitTargets {
+    GLuint framebuffer;
+    GLuint accumTexture;   // RGBA16F: sum of weighted colour, revealage in alpha
+    GLuint weightTexture;  // R16F: sum of the weights
+    GLuint program;        // The composite program, not owned
+    GLuint vao;            // Empty, the composite pass has no attributes
+    int width;
+    int height;
+};
+
+// Create targets of `width` by `height` pixels. Returns false, leaving the
+// targets empty, when the framebuffer is incomplete.
+bool createOitTargets(OitTargets *targets, GLuint program, int width, int height);
+
+void destroyOitTargets(OitTargets *targets);
+
+// Use a newly linked composite program
+void setOitProgram(OitTargets *targets, GLuint program);
+
+// Recreate the textures when the size changed
+void resizeOitTargets(OitTargets *targets, int width, int height);
+
+// Clear the targets and draw the following calls into them. The fragment
+// shader must write the weighted colour and alpha to location 0 and the
+// weight to location 1.
+void beginOit(OitTargets *targets);
+
+// Blend the accumulated particles over `framebuffer`. Leaves the bound
+// program and vertex array as they were.
+void compositeOit(OitTargets *targets, GLuint framebuffer);
@@ -1,6 +1,24 @@
+#include "feedback.h"
+#include "gpu_profiler.h"
+#include "offscreen.h"
+#include "oit.h"
+#include "program_cache.h"
+#include "stream.h"
 #include "utils.h"
 #include "utils2.h"
 
+#include "core/analytic.h"
+#include "core/bake.h"
+#include "core/emitters.h"
+#include "core/integrate.h"
+#include "core/jobs.h"
+#include "core/pack.h"
+#include "core/presets.h"
+#include "core/profiler.h"
+#include "core/simulation.h"
+#include "core/snapshot.h"
+#include "core/timestep.h"
+
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
@@ -15,13 +33,13 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
 
 #include <random>
+#include <thread>
 
 #define PI 3.1415926535897932384626433832795
-#define MAX_PARTICLES 10000
-#define STRETCH 0.1f
 
 using namespace std;
 using namespace glm;
@@ -30,86 +48,272 @@ using namespace glm;
 enum AttributeLocation {
     INSTANCE,
     POSITION,
-    SIZE,
     LIFE,
     COLOUR,
-    INIT_LIFE,
     NUM_ATTRIBUTES
 };
 
-struct Particle {
-    vec3 pos;
-    vec3 speed;
-    uvec4 color;
-    float size;
-    float angle;
-    float weight;
-    float life;
-    float initLife;
-    float cameraDistance;
-    bool operator<(const Particle& that) const {
-        // Sort in reverse order : far particles drawn first.
-        return this->cameraDistance > that.cameraDistance;
+// GL buffers backing the particle data
+struct ParticleBuffers {
+    GLuint billboardBuffer;
+    GLuint instanceBuffer;  // Interleaved, see core/pack.h
+    GLuint spawnBuffer;     // Spawn records of the analytic particles
+
+    // Per-emitter data of the batch being drawn, read as buffer textures
+    GLuint emitterBuffer;   // Origin, colours, size and fuzziness
+    GLuint emitterTexture;
+    GLuint segmentBuffer;   // First instance of each emitter
+    GLuint segmentTexture;
+
+    GLuint constantsBuffer;  // FrameConstants
+
+    // The pulled draw paths read the instance buffer through these
+    GLuint positionTexture;
+    GLuint lifeTexture;
+    GLuint colourTexture;
+    GLuint quadIndices;  // Two triangles over four vertices per particle
+    int numIndexedQuads;
+};
+
+// Texture units of the buffer textures, the instance views clear of the
+// OIT and upsample units
+enum TableUnit {
+    EMITTER_TABLE_UNIT,
+    SEGMENT_TABLE_UNIT,
+    POSITION_VIEW_UNIT = 5,
+    LIFE_VIEW_UNIT,
+    COLOUR_VIEW_UNIT
+};
+
+// Binding point of the FrameConstants uniform block
+#define FRAME_BLOCK_BINDING 0
+
+// The FrameConstants block of the shaders in the std140 layout, written
+// once per frame
+struct FrameConstants {
+    float vp[16];
+    float cameraUp[4];
+    float cameraRight[4];
+    float alpha;
+    float time;
+    float gravity;
+    float wind;
+    float pixelScale;  // Pixels per world unit at unit view depth
+    float fittedMinPixels;  // Fitted billboards smaller than this draw quads
+    float padding[2];
+};
+
+// Vertex arrays, one per source of particle data. The billboard and the
+// divisors are set up once; only the packed instances move around.
+struct ParticleArrays {
+    GLuint instances;    // Packed instances of the CPU simulation
+    GLuint analytic;     // Spawn records
+    GLuint feedback[2];  // State buffers of the feedback simulation
+    GLuint pulled;       // No attributes, the quad indices
+
+    // What the attributes of `instances` point at, so that they are only
+    // re-pointed when that changes
+    GLuint instanceBuffer;
+    InstanceFormat instanceFormat;
+    size_t instanceOffset;
+
+    // What the instance views are over
+    GLuint viewBuffer;
+    InstanceFormat viewFormat;
+};
+
+// Locations of the uniforms of the particle programs that change per draw
+struct DrawUniforms {
+    GLint segmentBegin;
+    GLint segmentEnd;
+    GLint instanceBase;
+
+    // Of the pulled program only
+    GLint instanceWord;
+    GLint halfPositions;
+    GLint pointSprites;
+};
+
+// The vertex shaders of the particle programs, all drawn with particle.frag
+enum ParticleShader {
+    SHADER_INSTANCED,  // particle.vert
+    SHADER_PULLED,     // particle_pulled.vert
+    SHADER_ANALYTIC,   // particle_analytic.vert
+    NUM_PARTICLE_SHADERS
+};
+
+const char *PARTICLE_VERTEX_SHADERS[NUM_PARTICLE_SHADERS] = {
+    "particle.vert", "particle_pulled.vert", "particle_analytic.vert"
+};
+
+// Permutations of particle.frag, each one a combination of these bits and
+// compiled with the matching #defines
+#define VARIANT_QUADS 1  // SHOW_QUADS
+#define VARIANT_FUZZ 2   // FUZZ
+#define VARIANT_OIT 4    // OIT
+#define NUM_VARIANTS 8
+
+// How the packed particles are drawn
+enum DrawPath {
+    DRAW_INSTANCED,  // The billboard instanced per particle
+    DRAW_PULLED,     // Quads of four vertices each, reading the instances
+    DRAW_POINTS,     // Point sprites, reading the instances
+    NUM_DRAW_PATHS
+};
+
+const char *drawPathName(DrawPath path)
+{
+    switch (path) {
+    case DRAW_INSTANCED: return "instanced";
+    case DRAW_PULLED: return "pulled";
+    case DRAW_POINTS: return "points";
+    default: return "unknown";
     }
+}
+
+// The size the particles are drawn at
+enum Resolution {
+    RESOLUTION_FULL,
+    RESOLUTION_HALF,
+    RESOLUTION_QUARTER,
+    NUM_RESOLUTIONS
 };
 
-struct Particles {
-    Particle container[MAX_PARTICLES];
+const char *resolutionName(Resolution resolution)
+{
+    switch (resolution) {
+    case RESOLUTION_FULL: return "full";
+    case RESOLUTION_HALF: return "half";
+    case RESOLUTION_QUARTER: return "quarter";
+    default: return "unknown";
+    }
+}
 
-    // Buffer identifiers
-    GLuint billboardBuffer;
-    GLuint positionsBuffer;
-    GLuint sizesBuffer;
-    GLuint livesBuffer;
-    GLuint initLivesBuffer;
-    GLuint coloursBuffer;
-
-    // Data for buffers
-    GLfloat positionsData[3*MAX_PARTICLES];
-    GLfloat sizesData[MAX_PARTICLES];
-    GLfloat livesData[MAX_PARTICLES];
-    GLfloat initLivesData[MAX_PARTICLES];
-    GLubyte coloursData[4*MAX_PARTICLES];
-
-    int lastUsedParticle;
-    int numParticles;
-    float spawnRate;
-    float initColour[4];
-    float finalColour[4];
-    float initSize;
-    float finalSize;
-    float initFuzz;
-    float finalFuzz;
+// The geometry each particle is drawn with. The polygons are fitted around
+// the fuzz circle; the quad covers its corners as well, which shade to zero
+// alpha.
+enum BillboardShape {
+    BILLBOARD_QUAD,
+    BILLBOARD_HEXAGON,
+    BILLBOARD_OCTAGON,
+    BILLBOARD_FITTED,  // The octagon, the quad for particles of few pixels
+    NUM_BILLBOARD_SHAPES
+};
+
+const char *billboardShapeName(BillboardShape shape)
+{
+    switch (shape) {
+    case BILLBOARD_QUAD: return "quad";
+    case BILLBOARD_HEXAGON: return "hexagon";
+    case BILLBOARD_OCTAGON: return "octagon";
+    case BILLBOARD_FITTED: return "fitted";
+    default: return "unknown";
+    }
+}
+
+// Particle pass draws, one per blend group
+#define MAX_PASS_DRAWS NUM_BLEND_GROUPS
+
+// GPU time and shaded fragments of the particle pass, from queries that are
+// read back a few frames later instead of waiting for them. The fragments
+// are counted per draw, leaving out the composite passes between them.
+struct PassStats {
+    GLuint timeQuery;  // 0 without timer queries
+    GLuint samplesQueries[MAX_PASS_DRAWS];
+    bool pending;
+    int numDraws;  // Of the pending pass
+    int instances;
+    Resolution resolution;
+    BillboardShape shape;
+    DrawPath path;
+
+    // Smoothed, 0 until measured
+    double time[NUM_RESOLUTIONS];  // Milliseconds
+    double fragments[NUM_BILLBOARD_SHAPES];  // Per drawn instance, instanced only
+    double pathFragments[NUM_DRAW_PATHS];
+};
+
+// The last frame drawn both sorted and through the OIT targets
+struct OitComparison {
+    double sortedTime;  // Milliseconds the sorted draw took, without the sort
+    double oitTime;
+    double meanDifference;  // Per colour channel, out of 255
+    int maxDifference;
+    double differing;  // Fraction of the pixels off by more than 2 in a channel
+    std::vector<unsigned char> pixels[2];
 };
 
 // Struct for resources and state
 struct Context {
     mt19937 eng;
-    uniform_int_distribution<> rand255;
     int width;
     int height;
     float aspect;
     vec3 cameraPos;
     GLFWwindow *window;
-    GLuint program;
+    ProgramCache programCache;
+    // Every permutation of each particle program, linked up front so that
+    // switching never compiles
+    GLuint particlePrograms[NUM_PARTICLE_SHADERS][NUM_VARIANTS];
+    DrawUniforms particleUniforms[NUM_PARTICLE_SHADERS][NUM_VARIANTS];
+    const DrawUniforms *passUniforms;  // Of the program the current group draws with
+    GLuint feedbackProgram;
+    GLuint compositeProgram;
+    GLuint upsampleProgram;
     Trackball trackball;
-    GLuint vao;
-    Particles *particles;
+    ParticleArrays arrays;
+    EmitterRegistry *emitters;
+    int selected;  // The emitter the GUI edits
+    int initialEmitters;
+    EmitterBatches batches;  // Draw order of the last frame
+    bool culling;  // Only pack and draw the chunks in the view frustum
+    mat4 viewProjection;  // Of the last sceneSetup
+    bool oit;  // Blend the alpha blended particles unsorted, see oit.h
+    OitTargets oitTargets;  // No framebuffer when unsupported
+    bool compareOit;  // Draw every frame sorted as well and compare
+    OitComparison comparison;
+    Resolution resolution;
+    OffscreenTarget offscreen;  // No framebuffer when unsupported
+    PassStats passStats;
+    bool measurePass;  // The current particle pass runs the stats queries
+    BillboardShape billboardShape;
+    float fittedMinPixels;  // Below this size BILLBOARD_FITTED draws quads
+    DrawPath drawPath;  // Of the CPU backend
+    DrawPath passPath;  // The current particle pass draws with
+    GLint maxTextureBufferSize;  // Texels
+    AnalyticEmitter *analyticEmitter;
+    bool analytic;  // Draw additive presets from spawn records
+    SimulationBackend backend;
+    FeedbackSimulation feedback;
+    int capacity;
+    JobPool *jobPool;
+    int numThreads;
+    ParticleBuffers buffers;
+    InstanceFormat instanceFormat;
+    std::vector<unsigned char> staging;  // Packed instances for glBufferSubData
+    UploadPath uploadPath;
+    bool persistentSupported;
+    StreamRing ring;
+    double uploadTime;  // Milliseconds the last upload took
+    Profiler *profiler;
+    GpuProfiler gpuProfiler;
+    bool showProfiler;
+    const char *tracePath;  // Where a recorded trace is saved
+    bool fixedTimestep;  // Step the simulation in fixed steps of timestep.step
+    Timestep timestep;
+    float prewarmSeconds;  // Fast-forwarded on startup and preset switches
+    const char *snapshotPath;
+    BakeWriter *bakeWriter;  // Records every frame drawn, NULL when not recording
+    bool bakePending;  // The frame being drawn is not recorded yet
+    BakeReader *bakeReader;  // Played back instead of simulating, NULL for none
+    int bakeFrame;  // The frame played back next
+    bool bakePaused;
     float elapsed_time;
     float timeDelta;
     float zoom;
-    float max_life;
-    float min_life;
-    float spread;
-    float max_speed;
-    float min_speed;
     bool showQuads;
-    bool sortParticles;
     float clearColor[3];
     float alpha;
-    float gravity;
-    float wind;
-    bool add;
     bool shake;
 };
 
@@ -125,6 +329,12 @@ std::string getEnvVar(const std::string &name)
     }
 }
 
+// The outputs the update program captures, in the layout of FeedbackParticle
+std::vector<const char *> feedbackVaryings()
+{
+    return std::vector<const char *>(FEEDBACK_VARYINGS, FEEDBACK_VARYINGS + NUM_FEEDBACK_VARYINGS);
+}
+
 // Returns the absolute path to the shader directory
 std::string shaderDir(void)
 {
@@ -144,103 +354,306 @@ void initializeTrackball(Context &ctx)
     ctx.trackball.center = center;
 }
 
-void resetParticles(Particles *particles) {
-    for(int i=0; i<MAX_PARTICLES; i++){
-        particles->container[i].life = -1.0f;
-        particles->container[i].cameraDistance = -1.0f;
+Emitter *selectedEmitter(const Context *ctx)
+{
+    return &ctx->emitters->emitters[ctx->selected];
+}
+
+// A buffer texture of `format` texels over a new buffer
+void createTable(GLuint *buffer, GLuint *texture, GLenum format)
+{
+    glGenBuffers(1, buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, *buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 0, NULL, GL_STREAM_DRAW);
+    glGenTextures(1, texture);
+    glBindTexture(GL_TEXTURE_BUFFER, *texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, *buffer);
+}
+
+// Bind the frame block and the buffer textures of a newly linked particle
+// program, and look up the locations of its per-draw uniforms
+void setupProgram(GLuint program, DrawUniforms *uniforms)
+{
+    GLuint block = glGetUniformBlockIndex(program, "FrameConstants");
+    if (block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, block, FRAME_BLOCK_BINDING);
+    }
+
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "emitter_table"), EMITTER_TABLE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "segment_first"), SEGMENT_TABLE_UNIT);
+    glUniform1i(glGetUniformLocation(program, "instance_positions"), POSITION_VIEW_UNIT);
+    glUniform1i(glGetUniformLocation(program, "instance_lives"), LIFE_VIEW_UNIT);
+    glUniform1i(glGetUniformLocation(program, "instance_colours"), COLOUR_VIEW_UNIT);
+
+    uniforms->segmentBegin = glGetUniformLocation(program, "segment_begin");
+    uniforms->segmentEnd = glGetUniformLocation(program, "segment_end");
+    uniforms->instanceBase = glGetUniformLocation(program, "instance_base");
+    uniforms->instanceWord = glGetUniformLocation(program, "instance_word");
+    uniforms->halfPositions = glGetUniformLocation(program, "half_positions");
+    uniforms->pointSprites = glGetUniformLocation(program, "point_sprites");
+}
+
+// The #defines of `variant` for particle.frag
+std::string variantDefines(int variant)
+{
+    std::string defines;
+    if (variant & VARIANT_QUADS) {
+        defines += "#define SHOW_QUADS\n";
+    }
+    if (variant & VARIANT_FUZZ) {
+        defines += "#define FUZZ\n";
+    }
+    if (variant & VARIANT_OIT) {
+        defines += "#define OIT\n";
+    }
+    return defines;
+}
+
+// (Re)link every particle program, from the program cache where it can
+void loadParticlePrograms(Context *ctx)
+{
+    for (int shader = 0; shader < NUM_PARTICLE_SHADERS; shader++) {
+        for (int variant = 0; variant < NUM_VARIANTS; variant++) {
+            GLuint *program = &ctx->particlePrograms[shader][variant];
+            glDeleteProgram(*program);
+            *program = loadCachedProgram(&ctx->programCache,
+                                         shaderDir() + PARTICLE_VERTEX_SHADERS[shader],
+                                         shaderDir() + "particle.frag", variantDefines(variant));
+            setupProgram(*program, &ctx->particleUniforms[shader][variant]);
+        }
+    }
+}
+
+// A vertex array with the billboard corners on INSTANCE and the particle
+// attributes enabled, advancing once per instance
+GLuint createParticleArray(GLuint billboard)
+{
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, billboard);
+    glEnableVertexAttribArray(INSTANCE);
+    glVertexAttribPointer(INSTANCE, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glVertexAttribDivisor(INSTANCE, 0);
+
+    for (int attribute = POSITION; attribute < NUM_ATTRIBUTES; attribute++) {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+
+    return vao;
+}
+
+// Point the feedback arrays at the state buffers, again whenever the
+// simulation recreates them
+void pointFeedbackArrays(Context *ctx)
+{
+    size_t stride = sizeof(FeedbackParticle);
+    for (int i = 0; i < 2; i++) {
+        glBindVertexArray(ctx->arrays.feedback[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, ctx->feedback.buffers[i]);
+        glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, stride,
+                              (void *)offsetof(FeedbackParticle, position));
+        glVertexAttribPointer(LIFE, 1, GL_FLOAT, GL_FALSE, stride,
+                              (void *)offsetof(FeedbackParticle, fraction));
+        glVertexAttribPointer(COLOUR, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                              (void *)offsetof(FeedbackParticle, colour));
+    }
+}
+
+// Append a regular polygon with `sides` sides whose sides touch the fuzz
+// circle, 0.45 from the centre of the unit billboard, as a triangle strip
+// that zigzags between its two halves. z = 1 marks the vertices the vertex
+// shader grows by the circle's antialiasing margin.
+void addBillboardPolygon(std::vector<GLfloat> *vertices, int sides)
+{
+    float radius = 0.45f / std::cos(glm::pi<float>() / sides);
+    for (int i = 0; i < sides; i++) {
+        // 0, 1, sides - 1, 2, sides - 2, ...
+        int corner = i % 2 == 1 ? (i + 1) / 2 : (sides - i / 2) % sides;
+        float angle = (corner + 0.5f) * 2.0f * glm::pi<float>() / sides;
+        vertices->push_back(radius * std::cos(angle));
+        vertices->push_back(radius * std::sin(angle));
+        vertices->push_back(1.0f);
     }
 }
 
 void initParticles(Context *ctx)
 {
-    Particles *particles = new Particles();
-    if (particles == NULL) {
-        fprintf(stderr, "Failed to allocate %x bytes of memory. Exiting.", sizeof(struct Particles));
-        exit(-1);
+    ctx->numThreads = std::max(1u, std::thread::hardware_concurrency());
+    ctx->jobPool = createJobPool(ctx->numThreads);
+    ParticleBuffers *buffers = &ctx->buffers;
+
+    // The emitters start out as fires on a grid
+    EmitterParams params;
+    findPreset("fire")->apply(&params);
+    ctx->emitters = createEmitterRegistry(ctx->eng(), ctx->jobPool);
+    for (int i = 0; i < ctx->initialEmitters; i++) {
+        addEmitter(ctx->emitters, params, emitterGridPosition(i, ctx->initialEmitters, 0.5f),
+                   ctx->capacity);
     }
+    ctx->selected = 0;
+    batchEmitters(ctx->emitters, ctx->cameraPos, &ctx->batches);
 
-    // A quad
-    static const GLfloat vertices[] = {
+    // A quad, then the hexagon and the octagon around the fuzz circle, as
+    // triangle strips. See billboardVertices.
+    std::vector<GLfloat> vertices = {
         -0.5f, -0.5f, 0.0f,
         0.5f, -0.5f, 0.0f,
         -0.5f, 0.5f, 0.0f,
         0.5f, 0.5f, 0.0f
     };
+    addBillboardPolygon(&vertices, 6);
+    addBillboardPolygon(&vertices, 8);
 
     GLuint billboard;
-    GLuint positions;
-    GLuint sizes;
-    GLuint lives;
-    GLuint colours;
-    GLuint initLives;
+    GLuint instances;
 
     // The billboard quad. This is done only once
     glGenBuffers(1, &billboard);
-    particles->billboardBuffer = billboard;
+    buffers->billboardBuffer = billboard;
 
     glBindBuffer(GL_ARRAY_BUFFER, billboard);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0],
+                 GL_STATIC_DRAW);
 
-    // The positions of the particles
-    glGenBuffers(1, &positions);
-    particles->positionsBuffer = positions;
 
-    glBindBuffer(GL_ARRAY_BUFFER, positions);
-    glBufferData(GL_ARRAY_BUFFER, 3 * MAX_PARTICLES * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+    // The packed particles, filled every frame
+    glGenBuffers(1, &instances);
+    buffers->instanceBuffer = instances;
 
+    ctx->instanceFormat = INSTANCE_HALF;
 
-    // The sizes of the particles
-    glGenBuffers(1, &sizes);
-    particles->sizesBuffer = sizes;
+    createTable(&buffers->emitterBuffer, &buffers->emitterTexture, GL_RGBA32F);
+    createTable(&buffers->segmentBuffer, &buffers->segmentTexture, GL_R32I);
+    glActiveTexture(GL_TEXTURE0 + EMITTER_TABLE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, buffers->emitterTexture);
+    glActiveTexture(GL_TEXTURE0 + SEGMENT_TABLE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, buffers->segmentTexture);
 
-    glBindBuffer(GL_ARRAY_BUFFER, sizes);
-    glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-
-
-    // The lives of the particles
-    glGenBuffers(1, &lives);
-    particles->livesBuffer = lives;
-
-    glBindBuffer(GL_ARRAY_BUFFER, lives);
-    glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-
-
-    // The init life of the particles
-    glGenBuffers(1, &initLives);
-    particles->initLivesBuffer = initLives;
-
-    glBindBuffer(GL_ARRAY_BUFFER, initLives);
-    glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-
-
-    // The colours of the particles
-    glGenBuffers(1, &colours);
-    particles->coloursBuffer = colours;
-
-    glBindBuffer(GL_ARRAY_BUFFER, colours);
-    glBufferData(GL_ARRAY_BUFFER, 4 * MAX_PARTICLES * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-
-    particles->numParticles = 0;
-    particles->lastUsedParticle = 0;
-
-    resetParticles(particles);
-
-    ctx->particles = particles;
+    // Pointed at the instance buffer by viewInstances
+    GLuint *views[] = {
+        &buffers->positionTexture, &buffers->lifeTexture, &buffers->colourTexture
+    };
+    for (int i = 0; i < 3; i++) {
+        glGenTextures(1, views[i]);
+        glActiveTexture(GL_TEXTURE0 + POSITION_VIEW_UNIT + i);
+        glBindTexture(GL_TEXTURE_BUFFER, *views[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &ctx->maxTextureBufferSize);
+
+    glGenBuffers(1, &buffers->constantsBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffers->constantsBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants), NULL, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, buffers->constantsBuffer);
+
+    // Spawn records, written as particles are born
+    ctx->analyticEmitter = createAnalyticEmitter(ctx->eng(), ctx->capacity);
+    glGenBuffers(1, &buffers->spawnBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers->spawnBuffer);
+    glBufferData(GL_ARRAY_BUFFER, ctx->capacity * sizeof(SpawnRecord), NULL, GL_DYNAMIC_DRAW);
+
+    // Particle state on the GPU
+    createFeedbackSimulation(&ctx->feedback, ctx->feedbackProgram, ctx->eng(), ctx->capacity);
+
+    // The attributes of the spawn records and of the feedback state never
+    // move, the packed instances are pointed at when drawn
+    ParticleArrays *arrays = &ctx->arrays;
+    arrays->instances = createParticleArray(billboard);
+    arrays->instanceBuffer = 0;
+
+    arrays->analytic = createParticleArray(billboard);
+    size_t stride = sizeof(SpawnRecord);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers->spawnBuffer);
+    glVertexAttribPointer(POSITION, 4, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(SpawnRecord, origin));
+    glVertexAttribPointer(LIFE, 4, GL_FLOAT, GL_FALSE, stride,
+                          (void *)offsetof(SpawnRecord, velocity));
+    glVertexAttribPointer(COLOUR, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                          (void *)offsetof(SpawnRecord, colour));
+
+    for (int i = 0; i < 2; i++) {
+        arrays->feedback[i] = createParticleArray(billboard);
+    }
+    pointFeedbackArrays(ctx);
+
+    glGenVertexArrays(1, &arrays->pulled);
+    glGenBuffers(1, &buffers->quadIndices);
+    buffers->numIndexedQuads = 0;
+    arrays->viewBuffer = 0;
+    glBindVertexArray(0);
+
+    // Fall back to glBufferSubData when persistent mapping is missing
+    memset(&ctx->ring, 0, sizeof(ctx->ring));
+    ctx->persistentSupported = loadBufferStorage();
+    if (ctx->uploadPath == UPLOAD_PERSISTENT && !ctx->persistentSupported) {
+        std::cerr << "GL_ARB_buffer_storage is not supported, using "
+                  << uploadPathName(UPLOAD_SUBDATA) << std::endl;
+        ctx->uploadPath = UPLOAD_SUBDATA;
+    }
+    ctx->uploadTime = 0.0;
 }
 
 void init(Context &ctx)
 {
-    ctx.program = loadShaderProgram(shaderDir() + "particle.vert",
-                                    shaderDir() + "particle.frag");
+    memset(ctx.particlePrograms, 0, sizeof(ctx.particlePrograms));
+    loadParticlePrograms(&ctx);
+    ctx.passUniforms = &ctx.particleUniforms[SHADER_INSTANCED][0];
+    ctx.feedbackProgram = loadFeedbackProgram(shaderDir() + "particle_update.vert",
+                                              shaderDir() + "particle_update.geom",
+                                              feedbackVaryings());
+
+    ctx.compositeProgram = loadCachedProgram(&ctx.programCache,
+                                             shaderDir() + "fullscreen.vert",
+                                             shaderDir() + "oit_composite.frag");
+    ctx.upsampleProgram = loadCachedProgram(&ctx.programCache,
+                                            shaderDir() + "fullscreen.vert",
+                                            shaderDir() + "upsample.frag");
+
+    if (!createOitTargets(&ctx.oitTargets, ctx.compositeProgram, ctx.width, ctx.height)) {
+        std::cerr << "Float render targets unsupported, no OIT" << std::endl;
+        ctx.oit = false;
+    }
+    if (!createOffscreenTarget(&ctx.offscreen, ctx.upsampleProgram, ctx.width, ctx.height)) {
+        std::cerr << "Float render targets unsupported, particles at full resolution"
+                  << std::endl;
+        ctx.resolution = RESOLUTION_FULL;
+    }
+
+    PassStats *stats = &ctx.passStats;
+    stats->timeQuery = 0;
+    if (GLEW_VERSION_3_3 || GLEW_ARB_timer_query) {
+        glGenQueries(1, &stats->timeQuery);
+    }
+    glGenQueries(MAX_PASS_DRAWS, stats->samplesQueries);
+    stats->pending = false;
+    stats->numDraws = 0;
+    stats->instances = 0;
+    for (int i = 0; i < NUM_RESOLUTIONS; i++) {
+        stats->time[i] = 0.0;
+    }
+    for (int i = 0; i < NUM_BILLBOARD_SHAPES; i++) {
+        stats->fragments[i] = 0.0;
+    }
+    for (int i = 0; i < NUM_DRAW_PATHS; i++) {
+        stats->pathFragments[i] = 0.0;
+    }
+
+    ctx.profiler = createProfiler();
+    setActiveProfiler(ctx.profiler);
+    if (!createGpuProfiler(&ctx.gpuProfiler, ctx.profiler)) {
+        std::cerr << "Timer queries unsupported, no GPU times" << std::endl;
+    }
 
     glEnable(GL_BLEND);
+    // Point sprites take their size from the vertex shader
+    glEnable(GL_PROGRAM_POINT_SIZE);
     // glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 
-    glGenVertexArrays(1, &(ctx.vao));
-    glBindVertexArray(ctx.vao);
-
     initParticles(&ctx);
 
     initializeTrackball(ctx);
@@ -263,28 +676,22 @@ void trackCamera(Context *ctx, vec3 centre) {
 }
 
 
-void sceneSetup(Context *ctx)
+// Whether the particles are drawn from spawn records. Additive blending
+// does not depend on the draw order, so those presets need no sorting and
+// therefore no per-frame CPU work at all.
+bool analyticActive(const Context *ctx)
 {
-    // Identifiers for the uniform variables
-    GLuint camera_up_id = glGetUniformLocation(ctx->program, "camera_up");
-    GLuint camera_right_id = glGetUniformLocation(ctx->program, "camera_right");
-    GLuint vp_id = glGetUniformLocation(ctx->program, "vp");
-
-    GLuint show_quads_id = glGetUniformLocation(ctx->program, "show_quads");
-    GLuint alpha_id = glGetUniformLocation(ctx->program, "alpha");
-
-    GLuint init_col_id = glGetUniformLocation(ctx->program, "init_col");
-    GLuint final_col_id = glGetUniformLocation(ctx->program, "final_col");
-
-    GLuint init_size_id = glGetUniformLocation(ctx->program, "init_size");
-    GLuint final_size_id = glGetUniformLocation(ctx->program, "final_size");
-
-    GLuint init_fuzz_id = glGetUniformLocation(ctx->program, "init_fuzz");
-    GLuint final_fuzz_id = glGetUniformLocation(ctx->program, "final_fuzz");
+    return ctx->analytic && ctx->bakeReader == NULL && selectedEmitter(ctx)->params.add;
+}
 
+// Write the frame constants every program reads
+void sceneSetup(Context *ctx)
+{
     vec3 centre = vec3(0.0f, 0.0f, 0.2f);
 
-    mt19937 eng = ctx->eng;
+    // Draw from the context's generator itself, a copy would shake the
+    // same way every frame
+    mt19937 &eng = ctx->eng;
     uniform_real_distribution<> noise(-1, 1);
 
     //trackCamera(ctx, centre);
@@ -300,329 +707,777 @@ void sceneSetup(Context *ctx)
     mat4 view = lookAt(cameraPos, centre, vec3(0.0f,0.0f,1.0f));
     mat4 projection = perspective(fov * ctx->zoom, ctx->aspect, 0.1f, 100.0f);
     mat4 vp = projection * view;
+    ctx->viewProjection = vp;
 
     // Camera-local directions for billboarding
     vec3 camera_up = vec3(view[0][1], view[1][1], view[2][1]);
     vec3 camera_right = vec3(view[0][0], view[1][0], view[2][0]);
 
-    // Set uniforms
-    glUniform3fv(camera_up_id, 1, &camera_up[0]);
-    glUniform3fv(camera_right_id, 1, &camera_right[0]);
-    glUniformMatrix4fv(vp_id, 1, GL_FALSE, &vp[0][0]);
-    glUniform1i(show_quads_id, ctx->showQuads);
-    glUniform1f(alpha_id, ctx->alpha);
-
-    glUniform1f(init_size_id, ctx->particles->initSize);
-    glUniform1f(final_size_id, ctx->particles->finalSize);
-
-    glUniform1f(init_fuzz_id, ctx->particles->initFuzz);
-    glUniform1f(final_fuzz_id, ctx->particles->finalFuzz);
-
-    glUniform4fv(init_col_id, 1, ctx->particles->initColour);
-    glUniform4fv(final_col_id, 1, ctx->particles->finalColour);
+    const EmitterParams &params = selectedEmitter(ctx)->params;
+
+    FrameConstants constants;
+    memcpy(constants.vp, &vp[0][0], sizeof(constants.vp));
+    vec4 up = vec4(camera_up, 0.0f);
+    vec4 right = vec4(camera_right, 0.0f);
+    memcpy(constants.cameraUp, &up[0], sizeof(constants.cameraUp));
+    memcpy(constants.cameraRight, &right[0], sizeof(constants.cameraRight));
+    constants.alpha = ctx->alpha;
+    constants.time = ctx->analyticEmitter->time;
+    constants.gravity = params.gravity;
+    constants.wind = params.wind;
+
+    // Polygon billboards snap to quads below the size, 0 keeps them
+    int passHeight = std::max(ctx->height >> ctx->resolution, 1);
+    constants.pixelScale = projection[1][1] * 0.5f * passHeight;
+    bool fitted = ctx->billboardShape == BILLBOARD_FITTED;
+    constants.fittedMinPixels = fitted ? ctx->fittedMinPixels : 0.0f;
+
+    // One upload a frame, orphaning the previous frame's block
+    glBindBuffer(GL_UNIFORM_BUFFER, ctx->buffers.constantsBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants), &constants, GL_STREAM_DRAW);
 }
 
-void drawParticles(Context *ctx)
+// Fill the buffer textures with the emitters of `batches`, in draw order
+void uploadEmitterTable(Context *ctx, const EmitterBatches &batches)
 {
-    // Particle data
-    Particles *particles = ctx->particles;
-    GLuint billboard = particles->billboardBuffer;
-    GLuint positions = particles->positionsBuffer;
-    GLuint sizes = particles->sizesBuffer;
-    GLuint lives = particles->livesBuffer;
-    GLuint colours = particles->coloursBuffer;
-    GLuint initLives = particles->initLivesBuffer;
-    int numParticles = particles->numParticles;
-
-    // Update particle positions
-    glBindBuffer(GL_ARRAY_BUFFER, positions);
-    glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * 3 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, numParticles * sizeof(GLfloat) * 3, particles->positionsData);
-
-    // Update particle sizes
-    glBindBuffer(GL_ARRAY_BUFFER, sizes);
-    glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, numParticles * sizeof(GLfloat), particles->sizesData);
-
-    // Update particle lives
-    glBindBuffer(GL_ARRAY_BUFFER, lives);
-    glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, numParticles * sizeof(GLfloat), particles->livesData);
-
-    // Update particle init lives
-    glBindBuffer(GL_ARRAY_BUFFER, initLives);
-    glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, numParticles * sizeof(GLfloat), particles->initLivesData);
-
-    // Update particle colours
-    glBindBuffer(GL_ARRAY_BUFFER, colours);
-    glBufferData(GL_ARRAY_BUFFER, MAX_PARTICLES * 3 * sizeof(GLubyte), NULL, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, numParticles * sizeof(GLubyte) * 4, particles->coloursData);
-
-
-    // Attach billboard corners to the vertices
-    glEnableVertexAttribArray(INSTANCE);
-    glBindBuffer(GL_ARRAY_BUFFER, billboard);
-    glVertexAttribPointer(INSTANCE, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+    ProfileScope scope(PHASE_UPLOAD);
+    size_t count = batches.segments.size();
+    std::vector<float> emitters(16 * std::max<size_t>(count, 1));
+    std::vector<GLint> firsts(std::max<size_t>(count, 1));
+
+    for (size_t i = 0; i < count; i++) {
+        const Emitter &emitter = ctx->emitters->emitters[batches.segments[i].emitter];
+        const EmitterParams &params = emitter.params;
+        float *texels = &emitters[16 * i];
+
+        texels[0] = emitter.origin.x;
+        texels[1] = emitter.origin.y;
+        texels[2] = emitter.origin.z;
+        texels[3] = 0.0f;
+        memcpy(texels + 4, params.initColour, 4 * sizeof(float));
+        memcpy(texels + 8, params.finalColour, 4 * sizeof(float));
+        texels[12] = params.initSize;
+        texels[13] = params.finalSize;
+        texels[14] = params.initFuzz;
+        texels[15] = params.finalFuzz;
+
+        firsts[i] = batches.segments[i].first;
+    }
 
-    // Attach particle positions to the vertices
-    glEnableVertexAttribArray(POSITION);
-    glBindBuffer(GL_ARRAY_BUFFER, positions);
-    glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-
-    // Attach particle sizes to the vertices
-    glEnableVertexAttribArray(SIZE);
-    glBindBuffer(GL_ARRAY_BUFFER, sizes);
-    glVertexAttribPointer(SIZE, 1, GL_FLOAT, GL_FALSE, 0, nullptr);
-
-    // Attach particle lives to the vertices
-    glEnableVertexAttribArray(LIFE);
-    glBindBuffer(GL_ARRAY_BUFFER, lives);
-    glVertexAttribPointer(LIFE, 1, GL_FLOAT, GL_FALSE, 0, nullptr);
-
-    // Attach particle initial lives to the vertices
-    glEnableVertexAttribArray(INIT_LIFE);
-    glBindBuffer(GL_ARRAY_BUFFER, initLives);
-    glVertexAttribPointer(INIT_LIFE, 1, GL_FLOAT, GL_FALSE, 0, nullptr);
-
-    // Attach colours to the vertices
-    glEnableVertexAttribArray(COLOUR);
-    glBindBuffer(GL_ARRAY_BUFFER, colours);
-    glVertexAttribPointer(COLOUR, 4, GL_UNSIGNED_SHORT, GL_TRUE, 0, nullptr);
-
-    // The billboard is the same for each particle
-    glVertexAttribDivisor(INSTANCE,0);
-    // The particle position advance for each particle
-    glVertexAttribDivisor(POSITION,1);
-    // The particle sized advance for each particle
-    glVertexAttribDivisor(SIZE,1);
-    // The particle life advance for each particle
-    glVertexAttribDivisor(LIFE,1);
-    // The particle initial life advance for each particle
-    glVertexAttribDivisor(INIT_LIFE,1);
-    // The particle colours advance for each particle
-    glVertexAttribDivisor(COLOUR,1);
-
-    // Draw all particle instances
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, numParticles);
-
-    glDisableVertexAttribArray(POSITION);
-    glDisableVertexAttribArray(INSTANCE);
-    glDisableVertexAttribArray(COLOUR);
-    glDisableVertexAttribArray(SIZE);
-    glDisableVertexAttribArray(LIFE);
-    glDisableVertexAttribArray(INIT_LIFE);
+    glBindBuffer(GL_TEXTURE_BUFFER, ctx->buffers.emitterBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, emitters.size() * sizeof(float), &emitters[0],
+                 GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, ctx->buffers.segmentBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, firsts.size() * sizeof(GLint), &firsts[0], GL_STREAM_DRAW);
 }
 
-void display(Context *ctx)
+// A batch of just the selected emitter, for the paths that only simulate
+// that one. Returns the emitter's blend group.
+BlendGroup selectedBatch(Context *ctx, int count, EmitterBatches *batches)
 {
-    glClearColor(ctx->clearColor[0], ctx->clearColor[1], ctx->clearColor[2], 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    EmitterSegment segment;
+    segment.emitter = ctx->selected;
+    segment.first = 0;
+    segment.count = count;
+    segment.firstRange = 0;
+    segment.numRanges = 0;
+    batches->segments.assign(1, segment);
+    batches->ranges.clear();
+    batches->numInstances = count;
+    batches->numCulled = 0;
+    batches->numChunks = 0;
+    batches->numCulledChunks = 0;
+
+    BlendGroup group = selectedEmitter(ctx)->params.add ? BLEND_ADD : BLEND_ALPHA;
+    for (int i = 0; i <= NUM_BLEND_GROUPS; i++) {
+        batches->groupBegin[i] = i <= group ? 0 : 1;
+    }
+    return group;
+}
 
-    if (ctx->add && !ctx->showQuads) {
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+// The alpha channel keeps the transmittance of the background for the
+// reduced resolution pass, see offscreen.h
+void setBlending(Context *ctx, BlendGroup group)
+{
+    if (group == BLEND_ADD && !ctx->showQuads) {
+        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE);
     } else {
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
     }
+}
 
-    glUseProgram(ctx->program);
-
-    sceneSetup(ctx);
-
-    drawParticles(ctx);
+// The permutation of particle.frag that `group` of `batches` draws with.
+// Fuzz is left out when none of its emitters have any.
+int groupVariant(const Context *ctx, const EmitterBatches &batches, BlendGroup group)
+{
+    int variant = 0;
+    if (ctx->showQuads) {
+        variant |= VARIANT_QUADS;
+    }
+    if (ctx->oit && group == BLEND_ALPHA) {
+        variant |= VARIANT_OIT;
+    }
+    for (int i = batches.groupBegin[group]; i < batches.groupBegin[group + 1]; i++) {
+        const EmitterParams &params = ctx->emitters->emitters[batches.segments[i].emitter].params;
+        if (params.initFuzz > 0.0f || params.finalFuzz > 0.0f) {
+            variant |= VARIANT_FUZZ;
+        }
+    }
+    return variant;
 }
 
-void presetFountain(Context *ctx)
+// Draw `group` with its permutation of `shader`, point it at the segments of
+// the group and set its blending. Returns the instance the group starts at.
+int beginGroup(Context *ctx, const EmitterBatches &batches, BlendGroup group,
+               ParticleShader shader)
 {
-    ctx->max_life = 4.0f;
-    ctx->min_life = 3.0f;
+    int begin = batches.groupBegin[group];
+    int end = batches.groupBegin[group + 1];
+    int base = batches.segments[begin].first;
 
-    ctx->spread = 0.2f;
+    int variant = groupVariant(ctx, batches, group);
+    glUseProgram(ctx->particlePrograms[shader][variant]);
+    ctx->passUniforms = &ctx->particleUniforms[shader][variant];
 
-    ctx->min_speed = 1.0f;
-    ctx->max_speed = 2.0f;
+    const DrawUniforms &uniforms = *ctx->passUniforms;
+    glUniform1i(uniforms.segmentBegin, begin);
+    glUniform1i(uniforms.segmentEnd, end);
+    glUniform1i(uniforms.instanceBase, base);
+    setBlending(ctx, group);
 
-    ctx->showQuads = false;
-    ctx->sortParticles = true;
+    return base;
+}
 
-    ctx->clearColor[0] = 0.2;
-    ctx->clearColor[1] = 0.2;
-    ctx->clearColor[2] = 0.2;
+// Number of instances in `group`
+int groupInstances(const EmitterBatches &batches, int group)
+{
+    int count = 0;
+    for (int i = batches.groupBegin[group]; i < batches.groupBegin[group + 1]; i++) {
+        count += batches.segments[i].count;
+    }
+    return count;
+}
 
-    ctx->alpha = 1.0f;
+// Where the particle pass draws to
+GLuint particleFramebuffer(const Context *ctx)
+{
+    return ctx->resolution == RESOLUTION_FULL ? 0 : ctx->offscreen.framebuffer;
+}
 
-    ctx->particles->spawnRate = 10.0f;
+// Fold `value` into a smoothed statistic
+void smooth(double *smoothed, double value)
+{
+    *smoothed = *smoothed == 0.0 ? value : 0.9 * *smoothed + 0.1 * value;
+}
 
-    ctx->gravity = -9.82f;
-    ctx->wind = 0.2f;
+// Fold in the statistics of the last finished particle pass
+void readPassStats(PassStats *stats)
+{
+    if (!stats->pending) {
+        return;
+    }
+    GLint available = 0;
+    GLuint last = stats->numDraws > 0 ? stats->samplesQueries[stats->numDraws - 1]
+                                      : stats->timeQuery;
+    if (last != 0) {
+        glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+    if (stats->timeQuery != 0) {
+        GLint timeAvailable = 0;
+        glGetQueryObjectiv(stats->timeQuery, GL_QUERY_RESULT_AVAILABLE, &timeAvailable);
+        available = available && timeAvailable;
+    }
+    if (!available) {
+        return;
+    }
 
-    ctx->particles->initColour[0] = 102.0f/255.0f;
-    ctx->particles->initColour[1] = 141.0f/255.0f;
-    ctx->particles->initColour[2] = 181.0f/255.0f;
-    ctx->particles->initColour[3] = 25.0f/255.0f;
+    if (stats->timeQuery != 0) {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(stats->timeQuery, GL_QUERY_RESULT, &elapsed);
+        smooth(&stats->time[stats->resolution], elapsed * 1e-6);
+    }
 
-    ctx->particles->finalColour[0] = 197.0f/255.0f;
-    ctx->particles->finalColour[1] = 231.0f/255.0f;
-    ctx->particles->finalColour[2] = 1.0f;
-    ctx->particles->finalColour[3] = 0.0f;
+    GLuint samples = 0;
+    for (int i = 0; i < stats->numDraws; i++) {
+        GLuint drawn = 0;
+        glGetQueryObjectuiv(stats->samplesQueries[i], GL_QUERY_RESULT, &drawn);
+        samples += drawn;
+    }
+    if (stats->instances > 0) {
+        double fragments = double(samples) / stats->instances;
+        if (stats->path == DRAW_INSTANCED) {
+            smooth(&stats->fragments[stats->shape], fragments);
+        }
+        smooth(&stats->pathFragments[stats->path], fragments);
+    }
+    stats->pending = false;
+}
 
-    ctx->particles->initSize = 0.01f;
-    ctx->particles->finalSize = 0.1f;
+// Start drawing the particles, after their data is uploaded, at the
+// selected resolution
+void beginParticlePass(Context *ctx)
+{
+    PassStats *stats = &ctx->passStats;
+    readPassStats(stats);
+    ctx->measurePass = !stats->pending;
+    if (ctx->measurePass) {
+        stats->numDraws = 0;
+        stats->instances = 0;
+        stats->resolution = ctx->resolution;
+        stats->shape = ctx->billboardShape;
+        stats->path = ctx->passPath;
+        if (stats->timeQuery != 0) {
+            glBeginQuery(GL_TIME_ELAPSED, stats->timeQuery);
+        }
+    }
+    beginGpuScope(&ctx->gpuProfiler, PHASE_DRAW);
+
+    int scale = 1 << ctx->resolution;
+    int width = std::max((ctx->width + scale - 1) / scale, 1);
+    int height = std::max((ctx->height + scale - 1) / scale, 1);
+    resizeOitTargets(&ctx->oitTargets, width, height);
+    if (ctx->resolution != RESOLUTION_FULL) {
+        resizeOffscreenTarget(&ctx->offscreen, width, height);
+        beginOffscreen(&ctx->offscreen);
+    }
+}
 
-    ctx->particles->initFuzz = 0.0f;
-    ctx->particles->finalFuzz = 0.0f;
+void endParticlePass(Context *ctx)
+{
+    if (ctx->resolution != RESOLUTION_FULL) {
+        upsampleOffscreen(&ctx->offscreen, 0, ctx->width, ctx->height);
+    }
+    endGpuScope(&ctx->gpuProfiler);
 
-    ctx->add = false;
+    if (ctx->measurePass) {
+        if (ctx->passStats.timeQuery != 0) {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+        ctx->passStats.pending = true;
+    }
+}
 
-    ctx->shake = false;
+// First vertex and number of vertices of each shape in the billboard buffer
+void billboardVertices(BillboardShape shape, int *first, int *count)
+{
+    switch (shape) {
+    case BILLBOARD_QUAD: *first = 0; *count = 4; break;
+    case BILLBOARD_HEXAGON: *first = 4; *count = 6; break;
+    default: *first = 10; *count = 8; break;
+    }
 }
 
-void presetSmoke(Context *ctx)
+// Draw `count` particles from the bound vertex array with the pass's draw
+// path, instanced as billboards of the selected shape, counting their
+// fragments
+void drawBillboards(Context *ctx, int count)
 {
-    ctx->max_life = 7.0f;
-    ctx->min_life = 4.0f;
+    PassStats *stats = &ctx->passStats;
+    bool measure = ctx->measurePass && stats->numDraws < MAX_PASS_DRAWS;
+    if (measure) {
+        glBeginQuery(GL_SAMPLES_PASSED, stats->samplesQueries[stats->numDraws]);
+    }
+    if (ctx->passPath == DRAW_PULLED) {
+        glDrawElements(GL_TRIANGLES, 6 * count, GL_UNSIGNED_INT, nullptr);
+    } else if (ctx->passPath == DRAW_POINTS) {
+        glDrawArrays(GL_POINTS, 0, count);
+    } else {
+        int first;
+        int vertices;
+        billboardVertices(ctx->billboardShape, &first, &vertices);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, first, vertices, count);
+    }
+    if (measure) {
+        glEndQuery(GL_SAMPLES_PASSED);
+        stats->numDraws++;
+        stats->instances += count;
+    }
+}
 
-    ctx->spread = PI;
+// Draw `count` instances of `group` from the bound vertex array. With OIT
+// the alpha blended group goes through the OIT targets and is composited
+// over the frame right away, before the additive group is drawn over it.
+void drawGroup(Context *ctx, BlendGroup group, int count)
+{
+    bool oit = ctx->oit && group == BLEND_ALPHA;
+    if (!oit) {
+        drawBillboards(ctx, count);
+        return;
+    }
 
-    ctx->min_speed = 0.0f;
-    ctx->max_speed = 0.3f;
+    beginOit(&ctx->oitTargets);
+    drawBillboards(ctx, count);
+    compositeOit(&ctx->oitTargets, particleFramebuffer(ctx));
+}
 
-    ctx->showQuads = false;
-    ctx->sortParticles = true;
+// Spawn this frame's analytic particles and upload their records, the only
+// data that goes to the GPU in this mode
+void stepAnalytic(Context *ctx, float timeDelta)
+{
+    AnalyticEmitter *emitter = ctx->analyticEmitter;
 
-    ctx->clearColor[0] = 0.2;
-    ctx->clearColor[1] = 0.2;
-    ctx->clearColor[2] = 0.2;
+    auto uploadStart = std::chrono::steady_clock::now();
 
-    ctx->alpha = 1.0f;
+    int first = emitter->head;
+    int count = spawnAnalytic(emitter, selectedEmitter(ctx)->params, timeDelta);
 
-    ctx->particles->spawnRate = 10.0f;
+    ProfileScope scope(PHASE_UPLOAD);
+    beginGpuScope(&ctx->gpuProfiler, PHASE_UPLOAD);
 
-    ctx->gravity = 3.5f;
-    ctx->wind = -0.2f;
+    // The new records may wrap around the end of the ring
+    glBindBuffer(GL_ARRAY_BUFFER, ctx->buffers.spawnBuffer);
+    int tail = std::min(count, emitter->capacity - first);
+    glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(SpawnRecord), tail * sizeof(SpawnRecord),
+                    &emitter->records[first]);
+    if (count > tail) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, (count - tail) * sizeof(SpawnRecord),
+                        &emitter->records[0]);
+    }
+    endGpuScope(&ctx->gpuProfiler);
 
-    ctx->particles->initColour[0] = 145.0f/255.0f;
-    ctx->particles->initColour[1] = 145.0f/255.0f;
-    ctx->particles->initColour[2] = 145.0f/255.0f;
-    ctx->particles->initColour[3] = 70.0f/255.0f;
+    auto uploadEnd = std::chrono::steady_clock::now();
+    ctx->uploadTime = std::chrono::duration<double, std::milli>(uploadEnd - uploadStart).count();
+}
 
-    ctx->particles->finalColour[0] = 51.0f/255.0f;
-    ctx->particles->finalColour[1] = 51.0f/255.0f;
-    ctx->particles->finalColour[2] = 51.0f/255.0f;
-    ctx->particles->finalColour[3] = 10.0f/255.0f;
+// Draw the particle state of the GPU backend straight from its buffer
+void drawFeedbackParticles(Context *ctx)
+{
+    FeedbackSimulation *sim = &ctx->feedback;
+    ctx->passPath = DRAW_INSTANCED;
 
-    ctx->particles->initSize = 0.0f;
-    ctx->particles->finalSize = 0.2f;
+    BlendGroup group = selectedBatch(ctx, sim->numParticles, &ctx->batches);
+    uploadEmitterTable(ctx, ctx->batches);
 
-    ctx->particles->initFuzz = 0.5f;
-    ctx->particles->finalFuzz = 0.9f;
+    ProfileScope scope(PHASE_DRAW);
+    beginGroup(ctx, ctx->batches, group, SHADER_INSTANCED);
 
-    ctx->add = false;
-    ctx->shake = false;
+    glBindVertexArray(ctx->arrays.feedback[sim->current]);
+    beginParticlePass(ctx);
+    drawGroup(ctx, group, sim->numParticles);
+    endParticlePass(ctx);
 }
 
-void presetToonTorch(Context *ctx)
+void drawAnalyticParticles(Context *ctx)
 {
-    ctx->max_life = 5.0f;
-    ctx->min_life = 3.0f;
+    AnalyticEmitter *emitter = ctx->analyticEmitter;
+    ctx->passPath = DRAW_INSTANCED;
+
+    // The analytic particles only ever draw the selected emitter, the first
+    // texels of the table
+    BlendGroup group = selectedBatch(ctx, emitter->written, &ctx->batches);
+    uploadEmitterTable(ctx, ctx->batches);
+
+    ProfileScope scope(PHASE_DRAW);
+    beginGroup(ctx, ctx->batches, group, SHADER_ANALYTIC);
+
+    // Every slot that ever held a particle, the dead ones are culled in the
+    // vertex shader
+    glBindVertexArray(ctx->arrays.analytic);
+    beginParticlePass(ctx);
+    drawBillboards(ctx, emitter->written);
+    endParticlePass(ctx);
+}
 
-    ctx->spread = 0.2f;
+// Attach the packed particles that start `offset` bytes into `buffer` to
+// the instance array, unless it already points there
+void bindInstances(Context *ctx, GLuint buffer, InstanceFormat format, size_t offset)
+{
+    ParticleArrays *arrays = &ctx->arrays;
+    if (arrays->instanceBuffer == buffer && arrays->instanceFormat == format &&
+        arrays->instanceOffset == offset) {
+        return;
+    }
+    arrays->instanceBuffer = buffer;
+    arrays->instanceFormat = format;
+    arrays->instanceOffset = offset;
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    size_t stride = instanceStride(format);
+    if (format == INSTANCE_HALF) {
+        glVertexAttribPointer(POSITION, 3, GL_HALF_FLOAT, GL_FALSE, stride,
+                              (void *)(offset + offsetof(InstanceHalf, position)));
+        glVertexAttribPointer(LIFE, 1, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                              (void *)(offset + offsetof(InstanceHalf, life)));
+        glVertexAttribPointer(COLOUR, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                              (void *)(offset + offsetof(InstanceHalf, colour)));
+    } else {
+        glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, stride,
+                              (void *)(offset + offsetof(InstanceFloat, position)));
+        glVertexAttribPointer(LIFE, 1, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                              (void *)(offset + offsetof(InstanceFloat, life)));
+        glVertexAttribPointer(COLOUR, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                              (void *)(offset + offsetof(InstanceFloat, colour)));
+    }
+}
 
-    ctx->min_speed = 0.611f;
-    ctx->max_speed = 1.137f;
+// Point the instance views at `buffer`, unless they already are
+void viewInstances(Context *ctx, GLuint buffer, InstanceFormat format)
+{
+    ParticleArrays *arrays = &ctx->arrays;
+    if (arrays->viewBuffer == buffer && arrays->viewFormat == format) {
+        return;
+    }
+    arrays->viewBuffer = buffer;
+    arrays->viewFormat = format;
+
+    // Texels of the components each view reads, see core/pack.h
+    const ParticleBuffers &buffers = ctx->buffers;
+    glActiveTexture(GL_TEXTURE0 + POSITION_VIEW_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, buffers.positionTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format == INSTANCE_HALF ? GL_R16F : GL_R32F, buffer);
+    glActiveTexture(GL_TEXTURE0 + LIFE_VIEW_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, buffers.lifeTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R16, buffer);
+    glActiveTexture(GL_TEXTURE0 + COLOUR_VIEW_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, buffers.colourTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA8, buffer);
+    glActiveTexture(GL_TEXTURE0);
+}
 
-    ctx->showQuads = false;
-    ctx->sortParticles = true;
+// Grow the quad indices of the pulled array to `count` particles. Vertex
+// 4 i + c is corner c of particle i.
+void reserveQuadIndices(Context *ctx, int count)
+{
+    ParticleBuffers *buffers = &ctx->buffers;
+    if (buffers->numIndexedQuads >= count) {
+        return;
+    }
+    std::vector<GLuint> indices(6 * size_t(count));
+    const GLuint corners[] = { 0, 1, 2, 2, 1, 3 };
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < 6; j++) {
+            indices[6 * size_t(i) + j] = 4 * GLuint(i) + corners[j];
+        }
+    }
+    glBindVertexArray(ctx->arrays.pulled);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers->quadIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0],
+                 GL_STATIC_DRAW);
+    buffers->numIndexedQuads = count;
+}
 
-    ctx->clearColor[0] = 0.2;
-    ctx->clearColor[1] = 0.2;
-    ctx->clearColor[2] = 0.2;
+// Draw the `batches.numInstances` instances packed at `offset` in
+// `instances`, a buffer of `bufferSize` bytes. The pulled quads are indexed
+// for up to `capacity` of them.
+void drawPackedParticles(Context *ctx, const EmitterBatches &batches, GLuint instances,
+                         InstanceFormat format, size_t offset, size_t bufferSize, int capacity)
+{
+    ProfileScope scope(PHASE_DRAW);
+    size_t stride = instanceStride(format);
 
-    ctx->alpha = 1.0f;
+    // The pulled paths view the whole buffer through 16-bit texels, which
+    // may be more than the implementation allows
+    bool viewable = bufferSize / 2 <= size_t(ctx->maxTextureBufferSize);
+    ctx->passPath = viewable ? ctx->drawPath : DRAW_INSTANCED;
 
-    ctx->particles->spawnRate = 2.0f;
+    ParticleShader shader = SHADER_INSTANCED;
+    if (ctx->passPath == DRAW_INSTANCED) {
+        glBindVertexArray(ctx->arrays.instances);
+    } else {
+        shader = SHADER_PULLED;
+        viewInstances(ctx, instances, format);
+        if (ctx->passPath == DRAW_PULLED) {
+            reserveQuadIndices(ctx, capacity);
+        }
+        glBindVertexArray(ctx->arrays.pulled);
+    }
+    beginParticlePass(ctx);
+
+    // One draw per blend group for all of its emitters. There is no base
+    // instance in GL 3.2, so each draw starts the attributes at the group's
+    // first instance instead, or the pulled ones read from there.
+    for (int group = 0; group < NUM_BLEND_GROUPS; group++) {
+        int count = groupInstances(batches, group);
+        if (count == 0) {
+            continue;
+        }
+        int base = beginGroup(ctx, batches, BlendGroup(group), shader);
+        if (ctx->passPath == DRAW_INSTANCED) {
+            bindInstances(ctx, instances, format, offset + base * stride);
+        } else {
+            const DrawUniforms &uniforms = *ctx->passUniforms;
+            glUniform1i(uniforms.halfPositions, format == INSTANCE_HALF);
+            glUniform1i(uniforms.pointSprites, ctx->passPath == DRAW_POINTS);
+            glUniform1i(uniforms.instanceWord, (offset + base * stride) / 4);
+        }
+        drawGroup(ctx, BlendGroup(group), count);
+    }
+    endParticlePass(ctx);
+}
 
-    ctx->gravity = -1.0f;
-    ctx->wind = 0.0f;
+void drawParticles(Context *ctx)
+{
+    // Particle data
+    EmitterRegistry *emitters = ctx->emitters;
+    EmitterBatches *batches = &ctx->batches;
+    GLuint instances = ctx->buffers.instanceBuffer;
+    InstanceFormat format = ctx->instanceFormat;
+    size_t stride = instanceStride(format);
+    int capacity = emitterCapacity(emitters);
+
+    // Where the packed particles start in `instances`
+    size_t offset = 0;
+
+    // Between the last two fixed steps
+    float alpha = ctx->fixedTimestep ? ctx->timestep.alpha : 1.0f;
+
+    // The emitters are packed in the order they are drawn, without the
+    // chunks outside the view. A bake keeps all of them, the camera may
+    // move on playback.
+    Frustum frustum;
+    extractFrustum(ctx->viewProjection, &frustum);
+    bool culling = ctx->culling && ctx->bakeWriter == NULL;
+    batchEmitters(emitters, ctx->cameraPos, batches, culling ? &frustum : NULL);
+    int numParticles = batches->numInstances;
+
+    auto uploadStart = std::chrono::steady_clock::now();
+    beginGpuScope(&ctx->gpuProfiler, PHASE_UPLOAD);
+
+    // The bake copies the packed instances, which is slow from the
+    // write-combined memory of the ring
+    StreamRing *ring = &ctx->ring;
+    bool persistent = ctx->uploadPath == UPLOAD_PERSISTENT && ctx->persistentSupported &&
+                      ctx->bakeWriter == NULL;
+    size_t sectionSize = capacity * sizeof(InstanceFloat);
+    if (persistent && ring->sectionSize < sectionSize) {
+        // A new ring may reuse the old name, so the instance array and the
+        // views have to be pointed again
+        ctx->arrays.instanceBuffer = 0;
+        ctx->arrays.viewBuffer = 0;
+        destroyStreamRing(ring);
+        persistent = createStreamRing(ring, sectionSize);
+        ctx->persistentSupported = persistent;
+    }
 
-    ctx->particles->initColour[0] = 200.0f/255.0f;
-    ctx->particles->initColour[1] = 0.0f;
-    ctx->particles->initColour[2] = 0.0f;
-    ctx->particles->initColour[3] = 1.0f;
+    if (persistent) {
+        // The simulation threads pack straight into mapped memory, once
+        // the GPU is done with the section
+        {
+            ProfileScope scope(PHASE_UPLOAD);
+            offset = beginStreamFrame(ring);
+        }
+        packEmitters(emitters, *batches, format, ring->mapped + offset, alpha);
+        instances = ring->buffer;
+    } else {
+        // Pack, then a single upload. The buffer is sized from the capacity
+        // so it follows the pools when they are resized.
+        ctx->staging.resize(capacity * stride);
+        packEmitters(emitters, *batches, format, &ctx->staging[0], alpha);
+        // Once per frame, the OIT comparison draws it twice
+        if (ctx->bakeWriter != NULL && ctx->bakePending) {
+            ctx->bakePending = false;
+            if (!writeBakeFrame(ctx->bakeWriter, *batches, &ctx->staging[0])) {
+                std::cerr << "Error: cannot write the bake, recording stopped" << std::endl;
+                closeBakeWriter(ctx->bakeWriter);
+                ctx->bakeWriter = NULL;
+            }
+        }
 
-    ctx->particles->finalColour[0] = 0.0f;
-    ctx->particles->finalColour[1] = 0.0f;
-    ctx->particles->finalColour[2] = 0.0f;
-    ctx->particles->finalColour[3] = 1.0f;
+        ProfileScope scope(PHASE_UPLOAD);
+        glBindBuffer(GL_ARRAY_BUFFER, instances);
+        glBufferData(GL_ARRAY_BUFFER, ctx->staging.size(), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, numParticles * stride, &ctx->staging[0]);
+    }
 
-    ctx->particles->initSize = 0.2f;
-    ctx->particles->finalSize = 0.0f;
+    uploadEmitterTable(ctx, *batches);
+    endGpuScope(&ctx->gpuProfiler);
 
-    ctx->particles->initFuzz = 0.0f;
-    ctx->particles->finalFuzz = 0.0f;
+    auto uploadEnd = std::chrono::steady_clock::now();
+    ctx->uploadTime = std::chrono::duration<double, std::milli>(uploadEnd - uploadStart).count();
 
-    ctx->add = false;
+    size_t bufferSize = persistent ? STREAM_RING_FRAMES * ring->sectionSize : ctx->staging.size();
+    drawPackedParticles(ctx, *batches, instances, format, offset, bufferSize, capacity);
 
-    ctx->shake = false;
+    if (persistent) {
+        endStreamFrame(ring);
+    }
 }
 
-void presetComet(Context *ctx)
+// Draw frame bakeFrame of the bake being played back
+void drawBakedParticles(Context *ctx)
 {
-    ctx->max_life = 0.873f;
-    ctx->min_life = 4.128f;
-
-    ctx->spread = 1.269f;
-
-    ctx->min_speed = 0.0f;
-    ctx->max_speed = 0.718f;
+    EmitterBatches *batches = &ctx->batches;
+    GLuint instances = ctx->buffers.instanceBuffer;
+    InstanceFormat format = bakeFormat(ctx->bakeReader);
+
+    auto uploadStart = std::chrono::steady_clock::now();
+    beginGpuScope(&ctx->gpuProfiler, PHASE_UPLOAD);
+
+    // Raw frames go from the mapped file to the buffer in one copy
+    const void *frame = readBakeFrame(ctx->bakeReader, ctx->bakeFrame, batches);
+    size_t size = std::max(batches->numInstances, 1) * size_t(instanceStride(format));
+    {
+        ProfileScope scope(PHASE_UPLOAD);
+        glBindBuffer(GL_ARRAY_BUFFER, instances);
+        glBufferData(GL_ARRAY_BUFFER, size, batches->numInstances > 0 ? frame : NULL,
+                     GL_STREAM_DRAW);
+    }
 
-    ctx->showQuads = false;
-    ctx->sortParticles = true;
+    uploadEmitterTable(ctx, *batches);
+    endGpuScope(&ctx->gpuProfiler);
 
-    ctx->clearColor[0] = 0.2;
-    ctx->clearColor[1] = 0.2;
-    ctx->clearColor[2] = 0.2;
+    auto uploadEnd = std::chrono::steady_clock::now();
+    ctx->uploadTime = std::chrono::duration<double, std::milli>(uploadEnd - uploadStart).count();
 
-    ctx->alpha = 1.0f;
+    drawPackedParticles(ctx, *batches, instances, format, 0, size, batches->numInstances);
+}
 
-    ctx->particles->spawnRate = 20.0f;
+// Move the playback on by a frame, back to the start after the last one
+void advanceBake(Context *ctx)
+{
+    if (!ctx->bakePaused) {
+        ctx->bakeFrame = (ctx->bakeFrame + 1) % bakeFrames(ctx->bakeReader);
+    }
+}
 
-    ctx->gravity = 20.0f;
-    ctx->wind = 0.0f;
+void clearFrame(Context *ctx)
+{
+    glClearColor(ctx->clearColor[0], ctx->clearColor[1], ctx->clearColor[2], 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
 
-    ctx->particles->initColour[0] = 134.0f/255.0f;
-    ctx->particles->initColour[1] = 1.0f;
-    ctx->particles->initColour[2] = 0.5f;
-    ctx->particles->initColour[3] = 28.0f/255.0f;
+// Draw the particles of the CPU or the feedback backend, or the bake
+void drawScene(Context *ctx)
+{
+    if (ctx->bakeReader != NULL) {
+        drawBakedParticles(ctx);
+    } else if (ctx->backend == BACKEND_FEEDBACK) {
+        drawFeedbackParticles(ctx);
+    } else {
+        drawParticles(ctx);
+    }
+}
 
-    ctx->particles->finalColour[0] = 0.0f;
-    ctx->particles->finalColour[1] = 91.0f/255.0f;
-    ctx->particles->finalColour[2] = 9.0f/255.0f;
-    ctx->particles->finalColour[3] = 99.0f/255.0f;
+// Draw the frame sorted, then through the OIT targets, which stays on
+// screen, and compare the two. Waits for the GPU after each.
+void compareOitFrame(Context *ctx)
+{
+    OitComparison *comparison = &ctx->comparison;
+    size_t size = size_t(ctx->width) * ctx->height * 4;
+    double times[2];
+
+    for (int pass = 0; pass < 2; pass++) {
+        ctx->oit = pass == 1;
+        clearFrame(ctx);
+
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        drawScene(ctx);
+        glFinish();
+        auto end = std::chrono::steady_clock::now();
+        times[pass] = std::chrono::duration<double, std::milli>(end - start).count();
+
+        comparison->pixels[pass].resize(size);
+        glReadPixels(0, 0, ctx->width, ctx->height, GL_RGBA, GL_UNSIGNED_BYTE,
+                     &comparison->pixels[pass][0]);
+    }
+    comparison->sortedTime = times[0];
+    comparison->oitTime = times[1];
+
+    const unsigned char *sorted = &comparison->pixels[0][0];
+    const unsigned char *blended = &comparison->pixels[1][0];
+    long total = 0;
+    int maxDifference = 0;
+    int differing = 0;
+    for (size_t i = 0; i < size; i += 4) {
+        int pixelMax = 0;
+        for (int c = 0; c < 3; c++) {
+            int difference = std::abs(int(sorted[i + c]) - int(blended[i + c]));
+            total += difference;
+            pixelMax = std::max(pixelMax, difference);
+        }
+        maxDifference = std::max(maxDifference, pixelMax);
+        differing += pixelMax > 2;
+    }
+    size_t pixels = std::max<size_t>(size / 4, 1);
+    comparison->meanDifference = double(total) / (3 * pixels);
+    comparison->maxDifference = maxDifference;
+    comparison->differing = double(differing) / pixels;
+}
 
-    ctx->particles->initSize = 0.047f;
-    ctx->particles->finalSize = 0.0f;
+void display(Context *ctx)
+{
+    // Each draw sets the blending of its emitters
+    sceneSetup(ctx);
+    ctx->bakePending = true;
 
-    ctx->particles->initFuzz = 0.5f;
-    ctx->particles->finalFuzz = 0.0f;
+    if (analyticActive(ctx)) {
+        clearFrame(ctx);
+        drawAnalyticParticles(ctx);
+    } else if (ctx->oit && ctx->compareOit) {
+        compareOitFrame(ctx);
+    } else {
+        clearFrame(ctx);
+        drawScene(ctx);
+    }
+}
 
-    ctx->add = true;
+// Advance whichever representation of the particles is in use. The
+// analytic and the feedback paths only run the selected emitter.
+void stepSimulation(Context *ctx, float timeDelta)
+{
+    // The comparison needs the sorted particles as well
+    ctx->emitters->skipSort = ctx->oit && !ctx->compareOit;
+
+    if (analyticActive(ctx)) {
+        stepAnalytic(ctx, timeDelta);
+    } else if (ctx->backend == BACKEND_FEEDBACK) {
+        // The GPU state is drawn as of the last step, without interpolation.
+        // Spawning and integrating are one pass there.
+        const EmitterParams &params = selectedEmitter(ctx)->params;
+        ProfileScope scope(PHASE_INTEGRATE);
+        beginGpuScope(&ctx->gpuProfiler, PHASE_INTEGRATE);
+        if (ctx->fixedTimestep) {
+            int steps = advanceTimestep(&ctx->timestep, timeDelta);
+            for (int step = 0; step < steps; step++) {
+                simulateFeedback(&ctx->feedback, params, ctx->timestep.step);
+            }
+        } else {
+            simulateFeedback(&ctx->feedback, params, timeDelta);
+        }
+        endGpuScope(&ctx->gpuProfiler);
+    } else if (ctx->fixedTimestep) {
+        simulateEmittersFixed(ctx->emitters, ctx->cameraPos, &ctx->timestep, timeDelta);
+    } else {
+        simulateEmitters(ctx->emitters, ctx->cameraPos, timeDelta);
+    }
+}
 
-    ctx->shake = true;
+// Fast-forward the CPU emitters so that the effect starts out populated
+void prewarmSimulation(Context *ctx)
+{
+    if (ctx->prewarmSeconds > 0.0f && ctx->backend == BACKEND_CPU && !analyticActive(ctx)) {
+        prewarmEmitters(ctx->emitters, ctx->cameraPos, ctx->prewarmSeconds);
+    }
 }
 
-void presetFire(Context *ctx)
+// Start both particle representations over
+void resetSimulation(Context *ctx)
 {
-    ctx->max_life = 5.0f;
-    ctx->min_life = 3.0f;
+    resetEmitters(ctx->emitters);
+    resetAnalyticEmitter(ctx->analyticEmitter);
+    resetFeedbackSimulation(&ctx->feedback);
+    resetTimestep(&ctx->timestep);
+}
 
-    ctx->spread = 0.2f;
+void resizeSimulation(Context *ctx, int capacity)
+{
+    resizeEmitters(ctx->emitters, capacity);
+    resizeFeedbackSimulation(&ctx->feedback, capacity);
+    pointFeedbackArrays(ctx);
+
+    destroyAnalyticEmitter(ctx->analyticEmitter);
+    ctx->analyticEmitter = createAnalyticEmitter(ctx->eng(), capacity);
+    glBindBuffer(GL_ARRAY_BUFFER, ctx->buffers.spawnBuffer);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(SpawnRecord), NULL, GL_DYNAMIC_DRAW);
+}
 
-    ctx->min_speed = 0.611f;
-    ctx->max_speed = 1.137f;
+// Apply `preset` to the selected emitter
+void applyPreset(Context *ctx, const Preset *preset)
+{
+    preset->apply(&selectedEmitter(ctx)->params);
 
     ctx->showQuads = false;
-    ctx->sortParticles = true;
 
     ctx->clearColor[0] = 0.2;
     ctx->clearColor[1] = 0.2;
@@ -630,74 +1485,180 @@ void presetFire(Context *ctx)
 
     ctx->alpha = 1.0f;
 
-    ctx->particles->spawnRate = 10.0f;
+    ctx->shake = preset->shake;
+}
+
+bool drawPathItem(void *, int index, const char **text)
+{
+    *text = drawPathName(DrawPath(index));
+    return true;
+}
+
+bool billboardShapeItem(void *, int index, const char **text)
+{
+    *text = billboardShapeName(BillboardShape(index));
+    return true;
+}
+
+bool resolutionItem(void *, int index, const char **text)
+{
+    *text = resolutionName(Resolution(index));
+    return true;
+}
 
-    ctx->gravity = -2.388;
-    ctx->wind = 0.1f;
+bool instanceFormatItem(void *, int index, const char **text)
+{
+    *text = instanceFormatName(InstanceFormat(index));
+    return true;
+}
 
-    ctx->particles->initColour[0] = 1.0f;
-    ctx->particles->initColour[1] = 131.0f/255.0f;
-    ctx->particles->initColour[2] = 64.0f/255.0f;
-    ctx->particles->initColour[3] = 47.0f/255.0f;
+bool uploadPathItem(void *, int index, const char **text)
+{
+    *text = uploadPathName(UploadPath(index));
+    return true;
+}
+
+bool backendItem(void *, int index, const char **text)
+{
+    *text = backendName(SimulationBackend(index));
+    return true;
+}
 
-    ctx->particles->finalColour[0] = 0.0f;
-    ctx->particles->finalColour[1] = 0.0f;
-    ctx->particles->finalColour[2] = 0.0f;
-    ctx->particles->finalColour[3] = 7.0f/255.0f;
+bool sortModeItem(void *, int index, const char **text)
+{
+    *text = sortModeName(SortMode(index));
+    return true;
+}
 
-    ctx->particles->initSize = 0.01f;
-    ctx->particles->finalSize = 0.1f;
+// Percentiles of every phase over the last PROFILE_HISTORY frames
+void profilerWindow(Context *ctx)
+{
+    Profiler *profiler = ctx->profiler;
+    ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiSetCond_FirstUseEver);
+    ImGui::Begin("Profiler", &ctx->showProfiler, ImGuiWindowFlags_AlwaysAutoResize);
+
+    ProfilePercentiles frame = frameTimePercentiles(profiler);
+    ImGui::Text("Frame: p50 %.2f ms, p95 %.2f ms, p99 %.2f ms", frame.p50, frame.p95,
+                frame.p99);
+
+    // A row per phase. The CPU phases on the job pool are timed in every
+    // chunk, see core/profiler.h.
+    ImGui::Text("CPU times are summed over the threads");
+    ImGui::Columns(4, "phases");
+    ImGui::Text("ms"); ImGui::NextColumn();
+    ImGui::Text("p50"); ImGui::NextColumn();
+    ImGui::Text("p95"); ImGui::NextColumn();
+    ImGui::Text("p99"); ImGui::NextColumn();
+    ImGui::Separator();
+    for (int source = 0; source < NUM_PROFILE_SOURCES; source++) {
+        for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+            ProfilePercentiles times = profilePercentiles(profiler, ProfilePhase(phase),
+                                                          ProfileSource(source));
+            if (times.samples == 0) {
+                continue;
+            }
+            ImGui::Text("%s %s", source == PROFILE_GPU ? "GPU" : "CPU",
+                        profilePhaseName(ProfilePhase(phase)));
+            ImGui::NextColumn();
+            ImGui::Text("%.3f", times.p50); ImGui::NextColumn();
+            ImGui::Text("%.3f", times.p95); ImGui::NextColumn();
+            ImGui::Text("%.3f", times.p99); ImGui::NextColumn();
+        }
+    }
+    ImGui::Columns(1);
+    if (!ctx->gpuProfiler.supported) {
+        ImGui::Text("Timer queries unsupported, no GPU times");
+    }
 
-    ctx->particles->initFuzz = 0.05f;
-    ctx->particles->finalFuzz = 0.4f;
+    ImGui::Spacing();
 
-    ctx->add = true;
+    if (profileTracing(profiler)) {
+        if (ImGui::Button("Stop trace")) {
+            stopProfileTrace(profiler);
+        }
+    } else if (ImGui::Button("Record trace")) {
+        startProfileTrace(profiler);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Save trace") && !writeProfileTrace(profiler, ctx->tracePath)) {
+        std::cerr << "Error: cannot write " << ctx->tracePath << std::endl;
+    }
+    ImGui::Text("%d events, saved to %s", profileTraceEvents(profiler), ctx->tracePath);
 
-    ctx->shake = false;
+    ImGui::End();
 }
 
 void gui(Context *ctx)
 {
     ImGui::Begin("Rendering options");
 
+    ImGui::Text("Emitters");
+
+    EmitterRegistry *emitters = ctx->emitters;
+    ImGui::SliderInt("Emitter", &ctx->selected, 0, numEmitters(emitters) - 1);
+    ctx->selected = glm::clamp(ctx->selected, 0, numEmitters(emitters) - 1);
+    ImGui::SliderFloat3("Position", &selectedEmitter(ctx)->origin[0], -2.0f, 2.0f);
+
+    // A bake holds the emitters it started with
+    bool fixedEmitters = ctx->bakeWriter != NULL || ctx->bakeReader != NULL;
+
+    // A copy of the selected emitter next to it
+    if (!fixedEmitters && ImGui::Button("Add emitter")) {
+        Emitter *emitter = selectedEmitter(ctx);
+        ctx->selected = addEmitter(emitters, emitter->params,
+                                   emitter->origin + vec3(0.0f, 0.5f, 0.0f), ctx->capacity);
+    }
+    if (!fixedEmitters && numEmitters(emitters) > 1) {
+        ImGui::SameLine();
+        if (ImGui::Button("Remove emitter")) {
+            removeEmitter(emitters, ctx->selected);
+            ctx->selected = std::min(ctx->selected, numEmitters(emitters) - 1);
+        }
+    }
+
+    ImGui::Spacing();
+
+    // Everything below edits the selected emitter
+    EmitterParams &params = selectedEmitter(ctx)->params;
+
     ImGui::Text("Spawn");
 
-    ImGui::SliderFloat("Particles per ms", &ctx->particles->spawnRate, 0.0f, 20.0f);
+    ImGui::SliderFloat("Particles per ms", &params.spawnRate, 0.0f, 20.0f);
 
-    ImGui::SliderFloat("Min life", &ctx->min_life, 0.0f, ctx->max_life);
-    ImGui::SliderFloat("Max life", &ctx->max_life, ctx->min_life, 7.0f);
+    ImGui::SliderFloat("Min life", &params.min_life, 0.0f, params.max_life);
+    ImGui::SliderFloat("Max life", &params.max_life, params.min_life, 7.0f);
 
-    ImGui::SliderFloat("Spread", &ctx->spread, 0.0f, PI);
+    ImGui::SliderFloat("Spread", &params.spread, 0.0f, PI);
 
-    ImGui::SliderFloat("Min speed", &ctx->min_speed, 0.0f, ctx->max_speed);
-    ImGui::SliderFloat("Max speed", &ctx->max_speed, ctx->min_speed, 7.0f);
+    ImGui::SliderFloat("Min speed", &params.min_speed, 0.0f, params.max_speed);
+    ImGui::SliderFloat("Max speed", &params.max_speed, params.min_speed, 7.0f);
 
     ImGui::Spacing();
 
     ImGui::Text("Colour");
 
-    ImGui::ColorEdit4("Initial colour", ctx->particles->initColour);
-    ImGui::ColorEdit4("Final colour", ctx->particles->finalColour);
+    ImGui::ColorEdit4("Initial colour", params.initColour);
+    ImGui::ColorEdit4("Final colour", params.finalColour);
 
-    ImGui::SliderFloat("Initial fuzziness", &ctx->particles->initFuzz, 0.0f, 1.0f);
-    ImGui::SliderFloat("Final fuzziness", &ctx->particles->finalFuzz, 0.0f, 1.0f);
+    ImGui::SliderFloat("Initial fuzziness", &params.initFuzz, 0.0f, 1.0f);
+    ImGui::SliderFloat("Final fuzziness", &params.finalFuzz, 0.0f, 1.0f);
 
-    ImGui::Checkbox("Additive blend", &ctx->add);
+    ImGui::Checkbox("Additive blend", &params.add);
 
     ImGui::Spacing();
 
     ImGui::Text("Size");
 
-    ImGui::SliderFloat("Initial size", &ctx->particles->initSize, 0.0f, 0.2f);
-    ImGui::SliderFloat("Final size", &ctx->particles->finalSize, 0.0f, 0.2f);
+    ImGui::SliderFloat("Initial size", &params.initSize, 0.0f, 0.2f);
+    ImGui::SliderFloat("Final size", &params.finalSize, 0.0f, 0.2f);
 
     ImGui::Spacing();
 
     ImGui::Text("Physics");
 
-    ImGui::SliderFloat("Gravity", &ctx->gravity, -20.0f, 20.0f);
+    ImGui::SliderFloat("Gravity", &params.gravity, -20.0f, 20.0f);
 
-    ImGui::SliderFloat("Wind", &ctx->wind, -0.5f, 0.5f);
+    ImGui::SliderFloat("Wind", &params.wind, -0.5f, 0.5f);
 
     ImGui::Spacing();
 
@@ -705,61 +1666,262 @@ void gui(Context *ctx)
 
     ImGui::Checkbox("Camera shake", &ctx->shake);
 
-    ImGui::Spacing();
-
-    ImGui::Text("Presets");
+    ImGui::Checkbox("Fixed timestep", &ctx->fixedTimestep);
+    if (ctx->fixedTimestep) {
+        float rate = 1.0f / ctx->timestep.step;
+        ImGui::SliderFloat("Steps per second", &rate, 10.0f, 240.0f, "%.0f");
+        ctx->timestep.step = 1.0f / rate;
+        ImGui::SliderInt("Max substeps", &ctx->timestep.maxSubsteps, 1, 32);
+        ImGui::Text("Steps: %lld, dropped %lld", ctx->timestep.steps,
+                    ctx->timestep.droppedSteps);
+    }
 
-    if (ImGui::Button("Realistic fire")) {
-        resetParticles(ctx->particles);
-        presetFire(ctx);
+    // A bake records what the CPU simulation packs
+    if (ctx->bakeWriter == NULL && ImGui::Checkbox("Analytic particles", &ctx->analytic)) {
+        resetAnalyticEmitter(ctx->analyticEmitter);
+    }
+    if (ctx->analytic && !params.add) {
+        ImGui::SameLine();
+        ImGui::Text("(additive blend only)");
     }
 
-    if (ImGui::Button("Toon torch")) {
-        resetParticles(ctx->particles);
-        presetToonTorch(ctx);
+    ImGui::Checkbox("Sort particles", &params.sortParticles);
+    if (params.sortParticles && emitters->skipSort) {
+        ImGui::SameLine();
+        ImGui::Text("(skipped with OIT)");
+    } else if (params.sortParticles) {
+        int sortMode = emitters->sortMode;
+        ImGui::Combo("Sort method", &sortMode, sortModeItem, NULL, NUM_SORT_MODES);
+        emitters->sortMode = SortMode(sortMode);
+        ImGui::Text("Sort time: %.3f ms, all emitters", emitters->sortTime);
     }
 
-    if (ImGui::Button("Fountain")) {
-        resetParticles(ctx->particles);
-        presetFountain(ctx);
+    ImGui::Spacing();
+
+    ImGui::Text("Presets");
+
+    for (int i = 0; i < NUM_PRESETS; i++) {
+        if (ImGui::Button(PRESETS[i].label)) {
+            resetSimulation(ctx);
+            applyPreset(ctx, &PRESETS[i]);
+            prewarmSimulation(ctx);
+        }
     }
+    ImGui::SliderFloat("Pre-warm (s)", &ctx->prewarmSeconds, 0.0f, 10.0f);
 
-    if (ImGui::Button("Green comet")) {
-        resetParticles(ctx->particles);
-        presetComet(ctx);
+    // The CPU emitters and their particles
+    if (ImGui::Button("Save snapshot") && !saveSnapshot(emitters, ctx->snapshotPath)) {
+        std::cerr << "Error: cannot write " << ctx->snapshotPath << std::endl;
+    }
+    if (!fixedEmitters) {
+        ImGui::SameLine();
+        if (ImGui::Button("Load snapshot")) {
+            if (loadSnapshot(emitters, ctx->snapshotPath)) {
+                ctx->selected = 0;
+            } else {
+                std::cerr << "Error: cannot load " << ctx->snapshotPath << std::endl;
+            }
+        }
     }
 
-    if (ImGui::Button("Smoke")) {
-        resetParticles(ctx->particles);
-        presetSmoke(ctx);
+    if (ctx->bakeReader != NULL) {
+        ImGui::Spacing();
+
+        ImGui::Text("Playback");
+
+        BakeReader *bake = ctx->bakeReader;
+        ImGui::SliderInt("Frame", &ctx->bakeFrame, 0, bakeFrames(bake) - 1);
+        ctx->bakeFrame = glm::clamp(ctx->bakeFrame, 0, bakeFrames(bake) - 1);
+        ImGui::Checkbox("Pause", &ctx->bakePaused);
+        ImGui::Text("%d frames, %s, %s", bakeFrames(bake), instanceFormatName(bakeFormat(bake)),
+                    bakeEncodingName(bakeEncoding(bake)));
+    } else if (ctx->bakeWriter != NULL) {
+        ImGui::Spacing();
+
+        uint64_t written;
+        uint64_t raw;
+        bakeWriterSizes(ctx->bakeWriter, &written, &raw);
+        ImGui::Text("Recording: %d frames, %.1f MB", bakeWriterFrames(ctx->bakeWriter),
+                    written / (1024.0 * 1024.0));
+        ImGui::SameLine();
+        if (ImGui::Button("Stop recording")) {
+            if (!closeBakeWriter(ctx->bakeWriter)) {
+                std::cerr << "Error: cannot write the bake" << std::endl;
+            }
+            ctx->bakeWriter = NULL;
+        }
     }
 
     if (ImGui::CollapsingHeader("Debug")) {
+        ImGui::Checkbox("Profiler overlay", &ctx->showProfiler);
+
         ImGui::SliderFloat("Alpha", &ctx->alpha, 0.0f, 1.0f);
 
         ImGui::ColorEdit3("Background", ctx->clearColor);
 
         ImGui::Checkbox("Show quads", &ctx->showQuads);
 
+        const ProgramCache &programCache = ctx->programCache;
+        ImGui::Text("Programs: %d from the cache, %d compiled, %.1f ms", programCache.hits,
+                    programCache.misses, programCache.loadTime);
+
+        ImGui::Checkbox("Frustum culling", &ctx->culling);
+        ImGui::Text("Culled: %d particles, %d of %d chunks", ctx->batches.numCulled,
+                    ctx->batches.numCulledChunks, ctx->batches.numChunks);
+
+        if (ctx->oitTargets.framebuffer != 0) {
+            ImGui::Checkbox("Order-independent transparency", &ctx->oit);
+        } else {
+            ImGui::Text("Order-independent transparency unsupported");
+        }
+        if (ctx->oit) {
+            ImGui::Checkbox("Compare with sorted", &ctx->compareOit);
+        }
+        if (ctx->oit && ctx->compareOit) {
+            const OitComparison &comparison = ctx->comparison;
+            ImGui::Text("Sorted: %.3f ms + sort %.3f ms, OIT: %.3f ms",
+                        comparison.sortedTime, emitters->sortTime, comparison.oitTime);
+            ImGui::Text("Difference: mean %.2f, max %d, %.1f%% of pixels",
+                        comparison.meanDifference, comparison.maxDifference,
+                        100.0 * comparison.differing);
+        }
+
+        if (ctx->offscreen.framebuffer != 0) {
+            int resolution = ctx->resolution;
+            ImGui::Combo("Particle resolution", &resolution, resolutionItem, NULL,
+                         NUM_RESOLUTIONS);
+            ctx->resolution = Resolution(resolution);
+        }
+        const PassStats &stats = ctx->passStats;
+        if (stats.timeQuery != 0) {
+            double time = stats.time[ctx->resolution];
+            double full = stats.time[RESOLUTION_FULL];
+            if (ctx->resolution != RESOLUTION_FULL && full > 0.0) {
+                ImGui::Text("Particle pass: %.3f ms, %.3f ms less than at full", time,
+                            full - time);
+            } else {
+                ImGui::Text("Particle pass: %.3f ms", time);
+            }
+        }
+
+        int path = ctx->drawPath;
+        ImGui::Combo("Draw path", &path, drawPathItem, NULL, NUM_DRAW_PATHS);
+        ctx->drawPath = DrawPath(path);
+        if (ctx->passPath != ctx->drawPath) {
+            ImGui::SameLine();
+            ImGui::Text("(drawn %s)", drawPathName(ctx->passPath));
+        }
+
+        if (ctx->passPath == DRAW_INSTANCED) {
+            int shape = ctx->billboardShape;
+            ImGui::Combo("Billboard", &shape, billboardShapeItem, NULL, NUM_BILLBOARD_SHAPES);
+            ctx->billboardShape = BillboardShape(shape);
+            if (ctx->billboardShape == BILLBOARD_FITTED) {
+                ImGui::SliderFloat("Quads below (pixels)", &ctx->fittedMinPixels, 0.0f, 64.0f);
+            }
+            ImGui::Text("Fragments per particle: %.1f, %.1f as quads",
+                        stats.fragments[ctx->billboardShape], stats.fragments[BILLBOARD_QUAD]);
+        } else {
+            ImGui::Text("Fragments per particle: %.1f", stats.pathFragments[ctx->passPath]);
+        }
+
+        int backend = ctx->backend;
+        if (ctx->bakeWriter == NULL) {
+            ImGui::Combo("Simulation", &backend, backendItem, NULL, NUM_BACKENDS);
+        }
+        if (backend != ctx->backend) {
+            ctx->backend = SimulationBackend(backend);
+            resetSimulation(ctx);
+        }
+
+        int simd = activeSimdLevel();
+        ImGui::SliderInt("Integration kernel", &simd, SIMD_SCALAR, detectSimdLevel(),
+                         simdLevelName(SimdLevel(simd)));
+        setActiveSimdLevel(SimdLevel(simd));
+
+        int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+        if (ImGui::SliderInt("Worker threads", &ctx->numThreads, 1, maxThreads)) {
+            destroyJobPool(ctx->jobPool);
+            ctx->jobPool = createJobPool(ctx->numThreads);
+            setEmitterJobPool(emitters, ctx->jobPool);
+        }
+
+        if (ctx->persistentSupported) {
+            int uploadPath = ctx->uploadPath;
+            ImGui::Combo("Upload path", &uploadPath, uploadPathItem, NULL, NUM_UPLOAD_PATHS);
+            ctx->uploadPath = UploadPath(uploadPath);
+        } else {
+            ImGui::Text("Upload path: %s", uploadPathName(ctx->uploadPath));
+        }
+        // The bake's frames are all in one format
+        if (fixedEmitters) {
+            ImGui::Text("Instance format: %s", instanceFormatName(ctx->instanceFormat));
+        } else {
+            int instanceFormat = ctx->instanceFormat;
+            ImGui::Combo("Instance format", &instanceFormat, instanceFormatItem, NULL,
+                         NUM_INSTANCE_FORMATS);
+            ctx->instanceFormat = InstanceFormat(instanceFormat);
+        }
+        ImGui::Text("Upload time: %.3f ms, %d bytes per particle", ctx->uploadTime,
+                    instanceStride(ctx->instanceFormat));
+
+        ImGui::InputInt("Capacity per emitter", &ctx->capacity, 10000, 1000000);
+        ctx->capacity = std::max(ctx->capacity, 1);
+        if (ctx->capacity != selectedEmitter(ctx)->particles->capacity) {
+            ImGui::SameLine();
+            if (ImGui::Button("Resize")) {
+                resizeSimulation(ctx, ctx->capacity);
+            }
+        }
+
         if (ImGui::Button("Reset simulation")) {
-            resetParticles(ctx->particles);
+            resetSimulation(ctx);
         }
 
     }
 
     ImGui::Spacing();
 
-    ImGui::Text("Live particles: %6d of %d", ctx->particles->numParticles, MAX_PARTICLES);
+    if (ctx->bakeReader != NULL) {
+        ImGui::Text("Live particles: %6d (baked)", ctx->batches.numInstances);
+    } else if (analyticActive(ctx)) {
+        ImGui::Text("Live particles: %6d of %d (analytic)",
+                    countAnalyticLive(ctx->analyticEmitter), ctx->analyticEmitter->capacity);
+    } else if (ctx->backend == BACKEND_FEEDBACK) {
+        ImGui::Text("Live particles: %6d of %d (feedback)", ctx->feedback.numParticles,
+                    ctx->feedback.capacity);
+    } else {
+        ImGui::Text("Live particles: %6d of %d, %d emitters", countEmitterParticles(emitters),
+                    emitterCapacity(emitters), numEmitters(emitters));
+    }
     ImGui::Text("Frame rate: %.0f fps", std::trunc(1.0f/ctx->timeDelta));
 
     ImGui::End();
+
+    if (ctx->showProfiler) {
+        profilerWindow(ctx);
+    }
 }
 
 void reloadShaders(Context *ctx)
 {
-    glDeleteProgram(ctx->program);
-    ctx->program = loadShaderProgram(shaderDir() + "particle.vert",
-                                     shaderDir() + "particle.frag");
+    // Only the edited shaders miss the cache and are compiled again
+    loadParticlePrograms(ctx);
+    glDeleteProgram(ctx->feedbackProgram);
+    ctx->feedbackProgram = loadFeedbackProgram(shaderDir() + "particle_update.vert",
+                                               shaderDir() + "particle_update.geom",
+                                               feedbackVaryings());
+    ctx->feedback.program = ctx->feedbackProgram;
+    glDeleteProgram(ctx->compositeProgram);
+    ctx->compositeProgram = loadCachedProgram(&ctx->programCache,
+                                              shaderDir() + "fullscreen.vert",
+                                              shaderDir() + "oit_composite.frag");
+    setOitProgram(&ctx->oitTargets, ctx->compositeProgram);
+    glDeleteProgram(ctx->upsampleProgram);
+    ctx->upsampleProgram = loadCachedProgram(&ctx->programCache,
+                                             shaderDir() + "fullscreen.vert",
+                                             shaderDir() + "upsample.frag");
+    setOffscreenProgram(&ctx->offscreen, ctx->upsampleProgram);
 }
 
 void mouseButtonPressed(Context *ctx, int button, int x, int y)
@@ -854,180 +2016,357 @@ void resizeCallback(GLFWwindow* window, int width, int height)
     glViewport(0, 0, width, height);
 }
 
-int findUnusedParticle(Particles *particles)
+// Run `frames` frames with a full pool on each upload path and instance
+// format and print the mean frame and upload times
+void compareUploadPaths(Context *ctx, int frames)
 {
-    int lastUsedParticle = particles->lastUsedParticle;
-    Particle *container = particles->container;
+    glfwSwapInterval(0);
 
-    for(int i=lastUsedParticle; i<MAX_PARTICLES; i++){
-        if (container[i].life < 0){
-            particles->lastUsedParticle = i;
-            return i;
-        }
+    // Step exactly once per frame, without interpolation
+    ctx->fixedTimestep = false;
+
+    // Enough spawning to refill every pool every frame
+    EmitterRegistry *emitters = ctx->emitters;
+    for (int i = 0; i < numEmitters(emitters); i++) {
+        Emitter *emitter = &emitters->emitters[i];
+        emitter->params.spawnRate = emitter->particles->capacity / (1000.0f * 0.016f * STRETCH);
     }
 
-    for(int i=0; i<lastUsedParticle; i++){
-        if (container[i].life < 0){
-            particles->lastUsedParticle = i;
-            return i;
+    printf("%d particles in %d emitters, %d frames per run\n", emitterCapacity(emitters),
+           numEmitters(emitters), frames);
+    for (int path = 0; path < NUM_UPLOAD_PATHS; path++) {
+        if (path == UPLOAD_PERSISTENT && !ctx->persistentSupported) {
+            printf("%-16s not supported\n", uploadPathName(UploadPath(path)));
+            continue;
+        }
+        for (int format = 0; format < NUM_INSTANCE_FORMATS; format++) {
+            ctx->uploadPath = UploadPath(path);
+            ctx->instanceFormat = InstanceFormat(format);
+            resetEmitters(emitters);
+
+            double uploadTime = 0.0;
+            glFinish();
+            double start = glfwGetTime();
+            for (int frame = 0; frame < frames; frame++) {
+                glfwPollEvents();
+                simulateEmitters(emitters, ctx->cameraPos, 0.016f);
+                display(ctx);
+                glfwSwapBuffers(ctx->window);
+                uploadTime += ctx->uploadTime;
+            }
+            glFinish();
+            double elapsed = glfwGetTime() - start;
+
+            printf("%-16s %-15s %2d B/particle: frame %.3f ms, upload %.3f ms\n",
+                   uploadPathName(UploadPath(path)), instanceFormatName(InstanceFormat(format)),
+                   instanceStride(InstanceFormat(format)), 1000.0 * elapsed / frames,
+                   uploadTime / frames);
         }
     }
-
-    return -1;
 }
 
-void sortParticles(Particles *particles)
+// Draw `frames` frames both sorted and with OIT, printing the average
+// times and image difference
+void compareOitPaths(Context *ctx, int frames)
 {
-    std::sort(particles->container, &(particles->container[MAX_PARTICLES]));
-}
-
-void updateParticleData(Particles *particles, float delta)
-{
-    GLfloat *positionsData = particles->positionsData;
-    GLfloat *sizesData = particles->sizesData;
-    GLfloat *livesData = particles->livesData;
-    GLfloat *initLivesData = particles->initLivesData;
-    GLubyte *coloursData = particles->coloursData;
-
-    Particle *container = particles->container;
-
-    int numParticles = particles->numParticles;
-
-    // Update buffers
-    int processed = 0;
-    for (int i = 0; processed < numParticles; i++){
-
-        Particle& p = container[i];
-
-        if (p.life > 0.0f - delta) {
-
-            positionsData[3*processed+0] = p.pos.x;
-            positionsData[3*processed+1] = p.pos.y;
-            positionsData[3*processed+2] = p.pos.z;
+    if (ctx->oitTargets.framebuffer == 0) {
+        printf("OIT not supported\n");
+        return;
+    }
 
-            sizesData[processed] = p.size;
+    glfwSwapInterval(0);
+    ctx->fixedTimestep = false;
+    ctx->oit = true;
+    ctx->compareOit = true;
+
+    double sortedTime = 0.0;
+    double sortTime = 0.0;
+    double oitTime = 0.0;
+    double meanDifference = 0.0;
+    double differing = 0.0;
+    int maxDifference = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        glfwPollEvents();
+        stepSimulation(ctx, 0.016f);
+        display(ctx);
+        glfwSwapBuffers(ctx->window);
+
+        const OitComparison &comparison = ctx->comparison;
+        sortedTime += comparison.sortedTime;
+        sortTime += ctx->emitters->sortTime;
+        oitTime += comparison.oitTime;
+        meanDifference += comparison.meanDifference;
+        differing += comparison.differing;
+        maxDifference = std::max(maxDifference, comparison.maxDifference);
+    }
 
-            livesData[processed] = p.life;
+    printf("%d particles in %d emitters, %d frames\n", countEmitterParticles(ctx->emitters),
+           numEmitters(ctx->emitters), frames);
+    printf("sorted  draw %.3f ms + sort %.3f ms\n", sortedTime / frames, sortTime / frames);
+    printf("oit     draw %.3f ms\n", oitTime / frames);
+    printf("difference: mean %.3f, max %d, %.2f%% of pixels\n", meanDifference / frames,
+           maxDifference, 100.0 * differing / frames);
+}
 
-            initLivesData[processed] = p.initLife;
+// Draw `frames` frames at every particle resolution, printing the average
+// frame and particle pass times
+void compareResolutions(Context *ctx, int frames)
+{
+    glfwSwapInterval(0);
+    ctx->fixedTimestep = false;
+
+    printf("%dx%d window, %d frames per run\n", ctx->width, ctx->height, frames);
+    for (int resolution = 0; resolution < NUM_RESOLUTIONS; resolution++) {
+        if (resolution != RESOLUTION_FULL && ctx->offscreen.framebuffer == 0) {
+            printf("%-8s not supported\n", resolutionName(Resolution(resolution)));
+            continue;
+        }
+        ctx->resolution = Resolution(resolution);
+        resetSimulation(ctx);
 
-            coloursData[4*processed+0] = p.color.r;
-            coloursData[4*processed+1] = p.color.g;
-            coloursData[4*processed+2] = p.color.b;
-            coloursData[4*processed+3] = p.color.a;
+        // Fill the pools before timing
+        for (int frame = 0; frame < frames; frame++) {
+            stepSimulation(ctx, 0.016f);
+        }
 
-            processed++;
+        glFinish();
+        double start = glfwGetTime();
+        for (int frame = 0; frame < frames; frame++) {
+            glfwPollEvents();
+            stepSimulation(ctx, 0.016f);
+            display(ctx);
+            glfwSwapBuffers(ctx->window);
         }
+        glFinish();
+        double elapsed = glfwGetTime() - start;
+        readPassStats(&ctx->passStats);
+
+        printf("%-8s frame %.3f ms, particle pass %.3f ms\n",
+               resolutionName(Resolution(resolution)), 1000.0 * elapsed / frames,
+               ctx->passStats.time[resolution]);
     }
 }
 
-void simulateParticles(Context *ctx)
+// Draw `frames` frames with every billboard shape, printing the shaded
+// fragments per particle and the particle pass time
+void compareBillboards(Context *ctx, int frames)
 {
-    Particles *particles = ctx->particles;
-    Particle *container = particles->container;
-    float delta = ctx->timeDelta * STRETCH;
-
-    vec3 cameraPos = ctx->cameraPos;
-
-    // Uniform distributions for random properties
-    mt19937 eng = ctx->eng;
-    uniform_real_distribution<> azimuth(0, 2*PI);
-    uniform_real_distribution<> polar(0, ctx->spread);
-    uniform_real_distribution<> speed(glm::min(ctx->min_speed, ctx->max_speed),
-                                      glm::max(ctx->min_speed, ctx->max_speed));
-    uniform_real_distribution<> rlife(glm::min(ctx->min_life, ctx->max_life),
-                                      glm::max(ctx->min_life, ctx->max_life));
-
-    float spawnRate = 1000.0f * ctx->particles->spawnRate;
-
-    // Spawn `spawnRate` particles per second
-    int newparticles = (int)(delta * spawnRate);
-    if (newparticles > (int)(0.016f * spawnRate))
-        newparticles = (int)(0.016f * spawnRate);
-
-    for(int i = 0; i < newparticles; i++){
-        int particleIndex = findUnusedParticle(particles);
-        if (particleIndex == -1)
-          break;
-
-        Particle &p = container[particleIndex];
-
-        p.life = rlife(eng) * STRETCH;
-        p.initLife = p.life;
+    glfwSwapInterval(0);
+    ctx->fixedTimestep = false;
 
-        p.pos = glm::vec3(0, 0.0f, 0.0f);
+    printf("%dx%d window, %d frames per run\n", ctx->width, ctx->height, frames);
+    for (int shape = 0; shape < NUM_BILLBOARD_SHAPES; shape++) {
+        ctx->billboardShape = BillboardShape(shape);
+        resetSimulation(ctx);
 
-        float phi = azimuth(eng);
-        float theta = polar(eng);
-        float r = speed(eng);
-
-        float vx = r * sin(theta) * cos(phi);
-        float vy = r * sin(theta) * sin(phi);
-        float vz = r * cos(theta);
-
-        vec4 speed = vec4(vx, vy, vz, 1);
-
-        p.speed[0] = speed[0];
-        p.speed[1] = speed[1];
-        p.speed[2] = speed[2];
-        p.speed /= speed[3];
+        // Fill the pools before measuring
+        for (int frame = 0; frame < frames; frame++) {
+            stepSimulation(ctx, 0.016f);
+        }
 
-        // Very bad way to generate a random color
-        p.color.r = ctx->rand255(ctx->eng);
-        p.color.g = ctx->rand255(ctx->eng);
-        p.color.b = ctx->rand255(ctx->eng);
-        p.color.a = (ctx->rand255(ctx->eng) % 256) / 3;
+        // Time this shape on its own
+        ctx->passStats.time[ctx->resolution] = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            glfwPollEvents();
+            stepSimulation(ctx, 0.016f);
+            display(ctx);
+            glfwSwapBuffers(ctx->window);
+        }
+        glFinish();
+        readPassStats(&ctx->passStats);
 
-        p.size = ctx->particles->initSize;
+        printf("%-8s %.1f fragments per particle, particle pass %.3f ms\n",
+               billboardShapeName(BillboardShape(shape)), ctx->passStats.fragments[shape],
+               ctx->passStats.time[ctx->resolution]);
     }
+}
 
-    int numParticles = 0;
-
-    // Simulate
-    for (int i = 0; i < MAX_PARTICLES; i++) {
-
-        Particle& p = container[i];
-
-        if (p.life > 0.0f) {
-
-            p.life -= delta;
-
-            // Normalized age
-            float age = (p.initLife - p.life) / p.initLife;
-
-            vec3 wind = vec3(0.0f, ctx->wind, 0.0f) * age;
-
-            p.speed += glm::vec3(0.0f, 0.0f, ctx->gravity) * (float)delta * 0.5f;
-            p.pos += (p.speed + wind) * (float)delta;
-            p.cameraDistance = glm::length2(p.pos - cameraPos);
-
-            p.size = (1-age) * ctx->particles->initSize + age * ctx->particles->finalSize;
+// Draw `frames` frames with every draw path, printing the average frame
+// time, the particle pass time and the fragments per particle
+void compareDrawPaths(Context *ctx, int frames)
+{
+    glfwSwapInterval(0);
+    ctx->fixedTimestep = false;
 
-            numParticles++;
+    printf("%dx%d window, %d frames per run\n", ctx->width, ctx->height, frames);
+    for (int path = 0; path < NUM_DRAW_PATHS; path++) {
+        ctx->drawPath = DrawPath(path);
+        resetSimulation(ctx);
 
-        } else {
-            p.cameraDistance = -1.0f;
+        // Fill the pools before timing
+        for (int frame = 0; frame < frames; frame++) {
+            stepSimulation(ctx, 0.016f);
         }
-    }
-
-    particles->numParticles = numParticles;
 
-    // Sort particles by camera distance for correct blending
-    if (ctx->sortParticles) {
-        sortParticles(particles);
+        // Time this path on its own
+        ctx->passStats.time[ctx->resolution] = 0.0;
+        glFinish();
+        double start = glfwGetTime();
+        for (int frame = 0; frame < frames; frame++) {
+            glfwPollEvents();
+            stepSimulation(ctx, 0.016f);
+            display(ctx);
+            glfwSwapBuffers(ctx->window);
+        }
+        glFinish();
+        double elapsed = glfwGetTime() - start;
+        readPassStats(&ctx->passStats);
+
+        if (ctx->passPath != ctx->drawPath) {
+            printf("%-9s not supported, drawn %s\n", drawPathName(DrawPath(path)),
+                   drawPathName(ctx->passPath));
+            continue;
+        }
+        printf("%-9s frame %.3f ms, particle pass %.3f ms, %.1f fragments per particle\n",
+               drawPathName(DrawPath(path)), 1000.0 * elapsed / frames,
+               ctx->passStats.time[ctx->resolution], ctx->passStats.pathFragments[path]);
     }
-
-    updateParticleData(particles, delta);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
     random_device rd;
     mt19937 eng(rd());
-    std::uniform_int_distribution<> rand255(0, 255); // define the range
 
     Context ctx;
 
+    ctx.capacity = DEFAULT_CAPACITY;
+    ctx.initialEmitters = 1;
+    ctx.culling = true;
+    ctx.oit = false;
+    ctx.compareOit = false;
+    ctx.resolution = RESOLUTION_FULL;
+    ctx.billboardShape = BILLBOARD_FITTED;
+    ctx.fittedMinPixels = 16.0f;
+    ctx.drawPath = DRAW_INSTANCED;
+    ctx.passPath = DRAW_INSTANCED;
+    ctx.uploadPath = UPLOAD_PERSISTENT;
+    ctx.analytic = false;
+    ctx.backend = BACKEND_CPU;
+    ctx.fixedTimestep = true;
+    initTimestep(&ctx.timestep);
+    ctx.showProfiler = false;
+    ctx.prewarmSeconds = 0.0f;
+    ctx.snapshotPath = "particles.snap";
+    bool snapshot = false;
+    ctx.bakeWriter = NULL;
+    ctx.bakePending = false;
+    ctx.bakeReader = NULL;
+    ctx.bakeFrame = 0;
+    ctx.bakePaused = false;
+    const char *bakePath = NULL;
+    const char *playPath = NULL;
+    const char *shaderCacheDir = "shader_cache";
+    InstanceFormat recordFormat = INSTANCE_HALF;
+    BakeEncoding bakeEncoding = BAKE_RAW;
+    ctx.tracePath = "particles_trace.json";
+    bool trace = false;
+    int compareFrames = 0;
+    int compareOitFrames = 0;
+    int compareResolutionFrames = 0;
+    int compareBillboardFrames = 0;
+    int compareDrawFrames = 0;
+    const char *preset = "fire";
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--capacity") == 0 && hasValue) {
+            ctx.capacity = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--upload") == 0 && hasValue &&
+                   (strcmp(argv[i + 1], "subdata") == 0 || strcmp(argv[i + 1], "persistent") == 0)) {
+            ctx.uploadPath = strcmp(argv[++i], "subdata") == 0 ? UPLOAD_SUBDATA : UPLOAD_PERSISTENT;
+        } else if (strcmp(argv[i], "--backend") == 0 && hasValue &&
+                   (strcmp(argv[i + 1], "cpu") == 0 || strcmp(argv[i + 1], "feedback") == 0)) {
+            ctx.backend = strcmp(argv[++i], "cpu") == 0 ? BACKEND_CPU : BACKEND_FEEDBACK;
+        } else if (strcmp(argv[i], "--step") == 0 && hasValue) {
+            float step = atof(argv[++i]);
+            ctx.fixedTimestep = step > 0.0f;
+            if (ctx.fixedTimestep) {
+                ctx.timestep.step = step;
+            }
+        } else if (strcmp(argv[i], "--emitters") == 0 && hasValue) {
+            ctx.initialEmitters = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--analytic") == 0) {
+            ctx.analytic = true;
+        } else if (strcmp(argv[i], "--compare-upload") == 0 && hasValue) {
+            compareFrames = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--preset") == 0 && hasValue && findPreset(argv[i + 1])) {
+            preset = argv[++i];
+        } else if (strcmp(argv[i], "--oit") == 0) {
+            ctx.oit = true;
+        } else if (strcmp(argv[i], "--compare-oit") == 0 && hasValue) {
+            compareOitFrames = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--resolution") == 0 && hasValue) {
+            i++;
+            for (int resolution = 0; resolution < NUM_RESOLUTIONS; resolution++) {
+                if (strcmp(argv[i], resolutionName(Resolution(resolution))) == 0) {
+                    ctx.resolution = Resolution(resolution);
+                }
+            }
+        } else if (strcmp(argv[i], "--compare-resolution") == 0 && hasValue) {
+            compareResolutionFrames = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--billboard") == 0 && hasValue) {
+            i++;
+            for (int shape = 0; shape < NUM_BILLBOARD_SHAPES; shape++) {
+                if (strcmp(argv[i], billboardShapeName(BillboardShape(shape))) == 0) {
+                    ctx.billboardShape = BillboardShape(shape);
+                }
+            }
+        } else if (strcmp(argv[i], "--compare-billboards") == 0 && hasValue) {
+            compareBillboardFrames = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--draw") == 0 && hasValue) {
+            i++;
+            for (int path = 0; path < NUM_DRAW_PATHS; path++) {
+                if (strcmp(argv[i], drawPathName(DrawPath(path))) == 0) {
+                    ctx.drawPath = DrawPath(path);
+                }
+            }
+        } else if (strcmp(argv[i], "--compare-draw") == 0 && hasValue) {
+            compareDrawFrames = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--prewarm") == 0 && hasValue) {
+            ctx.prewarmSeconds = std::max(float(atof(argv[++i])), 0.0f);
+        } else if (strcmp(argv[i], "--snapshot") == 0 && hasValue) {
+            ctx.snapshotPath = argv[++i];
+            snapshot = true;
+        } else if (strcmp(argv[i], "--bake") == 0 && hasValue) {
+            bakePath = argv[++i];
+        } else if (strcmp(argv[i], "--bake-format") == 0 && hasValue &&
+                   (strcmp(argv[i + 1], "half") == 0 || strcmp(argv[i + 1], "float") == 0)) {
+            recordFormat = strcmp(argv[++i], "half") == 0 ? INSTANCE_HALF : INSTANCE_FLOAT;
+        } else if (strcmp(argv[i], "--bake-encoding") == 0 && hasValue &&
+                   (strcmp(argv[i + 1], "raw") == 0 || strcmp(argv[i + 1], "delta") == 0)) {
+            bakeEncoding = strcmp(argv[++i], "raw") == 0 ? BAKE_RAW : BAKE_DELTA;
+        } else if (strcmp(argv[i], "--play") == 0 && hasValue) {
+            playPath = argv[++i];
+        } else if (strcmp(argv[i], "--shader-cache") == 0 && hasValue) {
+            shaderCacheDir = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && hasValue) {
+            ctx.tracePath = argv[++i];
+            trace = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--capacity N] [--emitters N]"
+                      << " [--upload subdata|persistent]"
+                      << " [--step SECONDS] [--backend cpu|feedback] [--analytic]"
+                      << " [--preset NAME] [--oit] [--resolution full|half|quarter]"
+                      << " [--compare-upload FRAMES] [--compare-oit FRAMES]"
+                      << " [--billboard quad|hexagon|octagon|fitted]"
+                      << " [--draw instanced|pulled|points]"
+                      << " [--compare-resolution FRAMES] [--compare-billboards FRAMES]"
+                      << " [--compare-draw FRAMES] [--trace FILE]"
+                      << " [--prewarm SECONDS] [--snapshot FILE]"
+                      << " [--bake FILE] [--bake-format half|float]"
+                      << " [--bake-encoding raw|delta] [--play FILE]"
+                      << " [--shader-cache DIR]"
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    // A bake records what the CPU simulation packs
+    if (bakePath != NULL && playPath == NULL) {
+        ctx.backend = BACKEND_CPU;
+        ctx.analytic = false;
+    }
+
     // Create a GLFW window
     glfwSetErrorCallback(errorCallback);
 
@@ -1047,7 +2386,6 @@ int main(void)
     ctx.timeDelta = 0.016f;
     ctx.cameraPos = glm::vec3(4.0f, 0.0f, 0.0f);
     ctx.eng = eng;
-    ctx.rand255 = rand255;
 
     glfwMakeContextCurrent(ctx.window);
     glfwSetWindowUserPointer(ctx.window, &ctx);
@@ -1071,9 +2409,72 @@ int main(void)
     // Initialize GUI
     ImGui_ImplGlfwGL3_Init(ctx.window, false /*do not install callbacks*/);
 
+    initProgramCache(&ctx.programCache, shaderCacheDir);
     init(ctx);
+    const ProgramCache &programCache = ctx.programCache;
+    if (programCache.dir.empty()) {
+        std::cout << "Program cache: off, " << programCache.misses << " programs compiled in "
+                  << programCache.loadTime << " ms" << std::endl;
+    } else {
+        std::cout << "Program cache: " << programCache.hits << " of "
+                  << programCache.hits + programCache.misses << " programs loaded from "
+                  << programCache.dir << ", " << programCache.loadTime << " ms" << std::endl;
+    }
 
-    presetFire(&ctx);
+    // Every emitter starts out with the preset
+    for (ctx.selected = 0; ctx.selected < numEmitters(ctx.emitters); ctx.selected++) {
+        applyPreset(&ctx, findPreset(preset));
+    }
+    ctx.selected = 0;
+    if (snapshot) {
+        if (!loadSnapshot(ctx.emitters, ctx.snapshotPath)) {
+            std::cerr << "Error: cannot load " << ctx.snapshotPath << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    } else {
+        prewarmSimulation(&ctx);
+    }
+    if (playPath != NULL) {
+        ctx.bakeReader = openBake(playPath);
+        if (ctx.bakeReader == NULL) {
+            std::cerr << "Error: cannot play " << playPath << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        restoreBakeEmitters(ctx.bakeReader, ctx.emitters);
+        ctx.instanceFormat = bakeFormat(ctx.bakeReader);
+    } else if (bakePath != NULL) {
+        ctx.instanceFormat = recordFormat;
+        ctx.bakeWriter = createBakeWriter(bakePath, ctx.emitters, recordFormat, bakeEncoding);
+        if (ctx.bakeWriter == NULL) {
+            std::cerr << "Error: cannot create " << bakePath << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (compareFrames > 0) {
+        compareUploadPaths(&ctx, compareFrames);
+        glfwSetWindowShouldClose(ctx.window, GL_TRUE);
+    }
+    if (compareOitFrames > 0) {
+        compareOitPaths(&ctx, compareOitFrames);
+        glfwSetWindowShouldClose(ctx.window, GL_TRUE);
+    }
+    if (compareResolutionFrames > 0) {
+        compareResolutions(&ctx, compareResolutionFrames);
+        glfwSetWindowShouldClose(ctx.window, GL_TRUE);
+    }
+    if (compareBillboardFrames > 0) {
+        compareBillboards(&ctx, compareBillboardFrames);
+        glfwSetWindowShouldClose(ctx.window, GL_TRUE);
+    }
+    if (compareDrawFrames > 0) {
+        compareDrawPaths(&ctx, compareDrawFrames);
+        glfwSetWindowShouldClose(ctx.window, GL_TRUE);
+    }
+
+    if (trace) {
+        startProfileTrace(ctx.profiler);
+    }
 
     // Start rendering loop
     while (!glfwWindowShouldClose(ctx.window)) {
@@ -1084,18 +2485,55 @@ int main(void)
         ctx.timeDelta = timeDelta;
         ImGui_ImplGlfwGL3_NewFrame();
 
-        gui(&ctx);
+        {
+            ProfileScope scope(PHASE_GUI);
+            gui(&ctx);
+        }
 
-        simulateParticles(&ctx);
+        if (ctx.bakeReader == NULL) {
+            stepSimulation(&ctx, ctx.timeDelta);
+        }
 
         display(&ctx);
 
-        ImGui::Render();
+        if (ctx.bakeReader != NULL) {
+            advanceBake(&ctx);
+        }
+
+        {
+            ProfileScope scope(PHASE_GUI);
+            beginGpuScope(&ctx.gpuProfiler, PHASE_GUI);
+            ImGui::Render();
+            endGpuScope(&ctx.gpuProfiler);
+        }
         glfwSwapBuffers(ctx.window);
+
+        endGpuFrame(&ctx.gpuProfiler);
+        endProfileFrame(ctx.profiler);
+    }
+
+    if (trace && !writeProfileTrace(ctx.profiler, ctx.tracePath)) {
+        std::cerr << "Error: cannot write " << ctx.tracePath << std::endl;
     }
 
     // Shutdown
-    delete ctx.particles;
+    if (ctx.bakeWriter != NULL && !closeBakeWriter(ctx.bakeWriter)) {
+        std::cerr << "Error: cannot write " << bakePath << std::endl;
+    }
+    if (ctx.bakeReader != NULL) {
+        closeBake(ctx.bakeReader);
+    }
+    destroyStreamRing(&ctx.ring);
+    destroyOitTargets(&ctx.oitTargets);
+    destroyOffscreenTarget(&ctx.offscreen);
+    glDeleteQueries(1, &ctx.passStats.timeQuery);
+    glDeleteQueries(MAX_PASS_DRAWS, ctx.passStats.samplesQueries);
+    destroyEmitterRegistry(ctx.emitters);
+    destroyAnalyticEmitter(ctx.analyticEmitter);
+    destroyFeedbackSimulation(&ctx.feedback);
+    destroyJobPool(ctx.jobPool);
+    destroyGpuProfiler(&ctx.gpuProfiler);
+    destroyProfiler(ctx.profiler);
     glfwDestroyWindow(ctx.window);
     glfwTerminate();
     std::exit(EXIT_SUCCESS);
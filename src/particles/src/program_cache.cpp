@@ -0,0 +1,157 @@
+#include "program_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PROGRAM_BINARY_MAGIC 0x47525042  // "BPRG"
+
+namespace {
+struct ProgramBinaryHeader {
+    uint32_t magic;
+    uint32_t format;  // Of glGetProgramBinary
+    uint64_t key;     // Checked against the file name's
+    uint32_t length;
+    uint32_t padding;
+};
+
+// 64-bit FNV-1a, continued from `hash`
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::string binaryPath(const ProgramCache *cache, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return cache->dir + "/" + name;
+}
+
+std::string glString(GLenum name)
+{
+    const GLubyte *string = glGetString(name);
+    return string != NULL ? reinterpret_cast<const char *>(string) : "";
+}
+} // namespace
+
+void initProgramCache(ProgramCache *cache, const std::string &dir)
+{
+    cache->dir.clear();
+    cache->driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" +
+                    glString(GL_VERSION) + "\n" + glString(GL_SHADING_LANGUAGE_VERSION);
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->loadTime = 0.0;
+
+    // Drivers may support the extension without any binary format
+    GLint formats = 0;
+    if (GLEW_ARB_get_program_binary) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+    if (dir.empty() || formats == 0) {
+        return;
+    }
+    struct stat status;
+    if (stat(dir.c_str(), &status) != 0 && mkdir(dir.c_str(), 0755) != 0) {
+        return;
+    }
+    cache->dir = dir;
+}
+
+uint64_t programKey(const ProgramCache *cache, const std::string *sources, int count)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hashBytes(hash, cache->driver.data(), cache->driver.size());
+    for (int i = 0; i < count; i++) {
+        // The length keeps the sources apart
+        uint64_t size = sources[i].size();
+        hash = hashBytes(hash, &size, sizeof(size));
+        hash = hashBytes(hash, sources[i].data(), size);
+    }
+    return hash;
+}
+
+GLuint loadProgramBinary(ProgramCache *cache, uint64_t key)
+{
+    if (cache->dir.empty()) {
+        return 0;
+    }
+    FILE *file = fopen(binaryPath(cache, key).c_str(), "rb");
+    if (file == NULL) {
+        return 0;
+    }
+
+    // The length comes from the file, check it against the file's size
+    // before allocating anything
+    struct stat status;
+    ProgramBinaryHeader header;
+    std::vector<char> binary;
+    bool read = fstat(fileno(file), &status) == 0 &&
+                fread(&header, sizeof(header), 1, file) == 1 &&
+                header.magic == PROGRAM_BINARY_MAGIC && header.key == key &&
+                uint64_t(status.st_size) - sizeof(header) == header.length;
+    if (read) {
+        binary.resize(header.length);
+        read = fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+    if (!read) {
+        return 0;
+    }
+
+    // The driver checks the binary against itself, an update turns it down
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), binary.size());
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void saveProgramBinary(ProgramCache *cache, uint64_t key, GLuint program)
+{
+    if (cache->dir.empty()) {
+        return;
+    }
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    ProgramBinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    header.magic = PROGRAM_BINARY_MAGIC;
+    header.format = format;
+    header.key = key;
+    header.length = length;
+
+    std::string path = binaryPath(cache, key);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d", int(getpid()));
+    std::string temporary = path + suffix;
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == NULL) {
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(binary.data(), 1, header.length, file) == header.length;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Linked programs cached on disk as program binaries
+// (GL_ARB_get_program_binary). A program is keyed by a hash of its sources,
+// defines included, and of the driver's vendor, renderer and version
+// strings, so an edited shader or another driver misses the cache and is
+// compiled again. A binary the driver turns down counts as a miss as well.
+//
+// Each program is a file named after its key in the cache directory,
+// written to a temporary name first so that a viewer starting at the same
+// time never reads half of one.
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <string>
+
+struct ProgramCache {
+    std::string dir;     // Empty when the cache is off or unsupported
+    std::string driver;  // Hashed into every key
+    int hits;
+    int misses;
+    double loadTime;  // Milliseconds spent linking or loading programs
+};
+
+// Cache the programs in `dir`, created when missing, or none with an empty
+// `dir`. Must be called with a current context.
+void initProgramCache(ProgramCache *cache, const std::string &dir);
+
+// Key of the program linked from `sources` on this driver
+uint64_t programKey(const ProgramCache *cache, const std::string *sources, int count);
+
+// A program loaded from the binary cached under `key`, or 0 when there is
+// none or the driver does not take it
+GLuint loadProgramBinary(ProgramCache *cache, uint64_t key);
+
+// Cache the binary of the linked `program` under `key`. It must have been
+// linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+void saveProgramBinary(ProgramCache *cache, uint64_t key, GLuint program);
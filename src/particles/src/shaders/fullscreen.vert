@@ -0,0 +1,9 @@
+// Vertex shader
+#version 150
+
+// One triangle that covers the screen, without any attributes
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2 - 1, 0, 1);
+}
@@ -0,0 +1,25 @@
+// Fragment shader
+#version 150
+
+// The weighted blended OIT targets, see oit.h
+uniform sampler2D accum_texture;
+uniform sampler2D weight_texture;
+
+out vec4 frag_color;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 accum = texelFetch(accum_texture, texel, 0);
+
+    // Nothing was drawn here
+    float revealage = accum.a;
+    if (revealage == 1) {
+        discard;
+    }
+
+    // The weighted average colour, covering all but the revealage of the
+    // background
+    float weight = texelFetch(weight_texture, texel, 0).r;
+    frag_color = vec4(accum.rgb / max(weight, 1e-5), revealage);
+}
@@ -1,23 +1,50 @@
 // Fragment shader
 #version 150
+#extension GL_ARB_explicit_attrib_location : require
+
+// Permutations, defined by the viewer before compiling:
+//   SHOW_QUADS  Draw the billboards' UVs instead of the particles
+//   FUZZ        Fuzzy edges, left out when no emitter of the draw has any
+//   OIT         Write the weighted blended OIT targets, see oit.h
 
 in vec2 UV;
 in vec3 pos_ws;
 in vec4 colour;
 in float size;
 in float life;
-in float max_life;
 
-uniform bool show_quads;
-uniform float alpha;
-uniform vec4 init_col;
-uniform vec4 final_col;
-uniform float init_fuzz;
-uniform float final_fuzz;
+// The emitter's, from the vertex shader
+flat in vec4 init_col;
+flat in vec4 final_col;
+flat in vec2 fuzz;
+
+// Per-frame constants, written once per frame. Must match FrameConstants
+// in particles.cpp.
+layout(std140) uniform FrameConstants {
+    mat4 vp;
+    vec4 camera_up;
+    vec4 camera_right;
+    float alpha;
+    // Simulated seconds and the selected emitter's forces, for the
+    // analytic particles
+    float time;
+    float gravity;
+    float wind;
+    // Pixels per world unit at unit view depth, and the size below which
+    // polygon billboards snap to quads
+    float pixel_scale;
+    float fitted_min_pixels;
+};
+
+// Drawn as point sprites, which have no UV
+uniform bool point_sprites;
 
-out vec4 frag_color;
+layout(location = 0) out vec4 frag_color;
+// The weight, only read in OIT mode
+layout(location = 1) out vec4 frag_weight;
 
-float age = 1 - life / max_life;
+float age = 1 - life;
+vec2 uv = point_sprites ? gl_PointCoord : UV;
 
 vec4 colour_over_life(float life)
 {
@@ -26,26 +53,43 @@ vec4 colour_over_life(float life)
 
 float fuzz_circle(vec2 centre, float radius, float fuzzyness)
 {
-    vec2 diff = UV - centre;
+    vec2 diff = uv - centre;
     float norm = length(diff) * 2;
     float dxy = fwidth(norm);
     float circle = 1-smoothstep((1-fuzzyness)*radius-dxy, radius+dxy, norm);
     return circle;
 }
-    
+
+// How much a fragment counts towards the average, falling off with the view
+// depth. Equation 7 of the paper, scaled for this scene's few units.
+float oit_weight(float a)
+{
+    float depth = 1 / gl_FragCoord.w;
+    return a * clamp(10 / (1e-5 + pow(depth / 5, 2) + pow(depth / 200, 6)), 1e-2, 3e3);
+}
 
 void main()
 {
-    if (show_quads) {
-        frag_color = vec4(UV, 0, alpha);
-    } else {
-        float n_life = 1-(max_life - life)/max_life;
+#ifdef SHOW_QUADS
+    vec4 result = vec4(uv, 0, alpha);
+#else
+#ifdef FUZZ
+    float fuzziness = (1-age) * fuzz.x + age * fuzz.y;
+#else
+    float fuzziness = 0;
+#endif
+    float circle = fuzz_circle(vec2(0.5, 0.5), 0.9, fuzziness);
 
-        float fuzz = (1-age) * init_fuzz + age * final_fuzz;
-        float circle = fuzz_circle(vec2(0.5, 0.5), 0.9, fuzz);
+    vec4 colour = colour_over_life(life);
 
-        vec4 colour = colour_over_life(life);
+    vec4 result = vec4(colour.rgb, circle * colour.a * alpha);
+#endif
 
-        frag_color = vec4(colour.rgb, circle * colour.a * alpha);
-    }
+#ifdef OIT
+    float weight = oit_weight(result.a);
+    frag_color = vec4(result.rgb * weight, result.a);
+    frag_weight = vec4(weight);
+#else
+    frag_color = result;
+#endif
 }
@@ -3,40 +3,114 @@
 #extension GL_ARB_explicit_attrib_location : require
 
 layout(location = 0) in vec3 billboard_vert_pos;
+// Relative to the emitter's origin
 layout(location = 1) in vec3 part_pos_ws;
-layout(location = 2) in float part_size;
-layout(location = 3) in float part_life;
-layout(location = 4) in vec4 particle_colour;
-layout(location = 5) in float part_max_life;
+// Remaining life over initial life
+layout(location = 2) in float part_life;
+layout(location = 3) in vec4 particle_colour;
 
 out vec2 UV;
 out vec3 pos_ws;
 out vec4 colour;
 out float size;
 out float life;
-out float max_life;
 
-uniform vec3 camera_up;
-uniform vec3 camera_right;
-uniform mat4 vp;
+// The emitter's colours and fuzziness, for the fragment shader
+flat out vec4 init_col;
+flat out vec4 final_col;
+flat out vec2 fuzz;
 
-vec4 billboard_position() {
-    vec3 pos  = part_pos_ws;
-         pos += camera_up * billboard_vert_pos.y * part_size * (0.5/0.9);
-         pos += camera_right * billboard_vert_pos.x * part_size * (0.5/0.9);
+// Per-frame constants, written once per frame. Must match FrameConstants
+// in particles.cpp.
+layout(std140) uniform FrameConstants {
+    mat4 vp;
+    vec4 camera_up;
+    vec4 camera_right;
+    float alpha;
+    // Simulated seconds and the selected emitter's forces, for the
+    // analytic particles
+    float time;
+    float gravity;
+    float wind;
+    // Pixels per world unit at unit view depth, and the size below which
+    // polygon billboards snap to quads
+    float pixel_scale;
+    float fitted_min_pixels;
+};
 
-    return vp * vec4(pos, 1);
+// One draw covers the emitters [segment_begin, segment_end) of the batch,
+// see core/emitters.h. Each has four texels in emitter_table: its origin,
+// its initial and final colour, and its initial and final size and
+// fuzziness. segment_first holds the first instance of each.
+uniform samplerBuffer emitter_table;
+uniform isamplerBuffer segment_first;
+uniform int segment_begin;
+uniform int segment_end;
+// Instance of the batch that gl_InstanceID 0 is
+uniform int instance_base;
+
+// The last segment that starts at or before `instance`
+int find_segment(int instance)
+{
+    int low = segment_begin;
+    int high = segment_end - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (texelFetch(segment_first, mid).x <= instance) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+// The corner of the billboard this vertex is at, around its centre in
+// billboard units. Polygon vertices (z = 1) grow by the margin fuzz_circle
+// antialiases over, about 1.5 pixels, but no further out than the quad's
+// edges, and snap to the quad's corners when the billboard is smaller than
+// fitted_min_pixels.
+vec2 billboard_corner(vec3 vertex, vec3 centre, float part_size)
+{
+    if (vertex.z == 0) {
+        return vertex.xy;
+    }
+    float depth = (vp * vec4(centre, 1)).w;
+    float pixels = part_size * (0.5/0.9) * pixel_scale / max(depth, 1e-5);
+    if (pixels < fitted_min_pixels) {
+        return sign(vertex.xy) * 0.5;
+    }
+    return vertex.xy * min(1 + 1.5 / (0.45 * max(pixels, 1)), 0.5 / 0.45);
 }
 
 void main()
 {
-    UV = billboard_vert_pos.xy + vec2(0.5, 0.5);
+    int segment = find_segment(instance_base + gl_InstanceID);
+    vec3 origin = texelFetch(emitter_table, 4 * segment).xyz;
+    vec4 shape = texelFetch(emitter_table, 4 * segment + 3);
+    init_col = texelFetch(emitter_table, 4 * segment + 1);
+    final_col = texelFetch(emitter_table, 4 * segment + 2);
+    fuzz = shape.zw;
+
+    // Same interpolation as the simulation uses for the size
+    float part_size = mix(shape.x, shape.y, 1 - part_life);
+
+    vec3 world_pos = origin + part_pos_ws;
+
+    vec2 corner = billboard_corner(billboard_vert_pos, world_pos, part_size);
+    UV = corner + vec2(0.5, 0.5);
     colour = particle_colour;
-    pos_ws = part_pos_ws;
+    pos_ws = world_pos;
     size = part_size;
     life = part_life;
 
-    max_life = part_max_life;
+    vec3 pos  = world_pos;
+         pos += camera_up.xyz * corner.y * part_size * (0.5/0.9);
+         pos += camera_right.xyz * corner.x * part_size * (0.5/0.9);
+    gl_Position = vp * vec4(pos, 1);
 
-    gl_Position = billboard_position();
+    // Dead particle, move the whole billboard outside the clip volume
+    if (part_life <= 0) {
+        gl_Position = vec4(2, 2, 2, 1);
+    }
 }
@@ -0,0 +1,99 @@
+// Vertex shader for stateless particles, see core/analytic.h. Everything
+// the simulation would integrate is evaluated from the spawn record.
+#version 150
+#extension GL_ARB_explicit_attrib_location : require
+
+layout(location = 0) in vec3 billboard_vert_pos;
+// Origin and spawn time
+layout(location = 1) in vec4 spawn_origin;
+// Initial velocity and lifetime
+layout(location = 2) in vec4 spawn_velocity;
+layout(location = 3) in vec4 particle_colour;
+
+out vec2 UV;
+out vec3 pos_ws;
+out vec4 colour;
+out float size;
+out float life;
+
+flat out vec4 init_col;
+flat out vec4 final_col;
+flat out vec2 fuzz;
+
+// Per-frame constants, written once per frame. Must match FrameConstants
+// in particles.cpp.
+layout(std140) uniform FrameConstants {
+    mat4 vp;
+    vec4 camera_up;
+    vec4 camera_right;
+    float alpha;
+    // Simulated seconds and the selected emitter's forces, for the
+    // analytic particles
+    float time;
+    float gravity;
+    float wind;
+    // Pixels per world unit at unit view depth, and the size below which
+    // polygon billboards snap to quads
+    float pixel_scale;
+    float fitted_min_pixels;
+};
+
+// The emitter's origin, colours, size and fuzziness, laid out as for
+// particle.vert with a single emitter
+uniform samplerBuffer emitter_table;
+
+// The corner of the billboard this vertex is at, around its centre in
+// billboard units. Polygon vertices (z = 1) grow by the margin fuzz_circle
+// antialiases over, about 1.5 pixels, but no further out than the quad's
+// edges, and snap to the quad's corners when the billboard is smaller than
+// fitted_min_pixels.
+vec2 billboard_corner(vec3 vertex, vec3 centre, float part_size)
+{
+    if (vertex.z == 0) {
+        return vertex.xy;
+    }
+    float depth = (vp * vec4(centre, 1)).w;
+    float pixels = part_size * (0.5/0.9) * pixel_scale / max(depth, 1e-5);
+    if (pixels < fitted_min_pixels) {
+        return sign(vertex.xy) * 0.5;
+    }
+    return vertex.xy * min(1 + 1.5 / (0.45 * max(pixels, 1)), 0.5 / 0.45);
+}
+
+void main()
+{
+    float part_age = time - spawn_origin.w;
+    float lifetime = spawn_velocity.w;
+    float n_age = part_age / lifetime;
+
+    // Gravity accelerates at half its value along z, as in the simulation,
+    // and the wind's speed grows linearly with the normalized age
+    vec3 origin = texelFetch(emitter_table, 0).xyz;
+    vec4 shape = texelFetch(emitter_table, 3);
+    init_col = texelFetch(emitter_table, 1);
+    final_col = texelFetch(emitter_table, 2);
+    fuzz = shape.zw;
+
+    vec3 part_pos_ws = origin + spawn_origin.xyz + spawn_velocity.xyz * part_age;
+    part_pos_ws.y += wind * part_age * part_age / (2 * lifetime);
+    part_pos_ws.z += gravity * part_age * part_age / 4;
+
+    float part_size = mix(shape.x, shape.y, n_age);
+
+    vec2 corner = billboard_corner(billboard_vert_pos, part_pos_ws, part_size);
+    UV = corner + vec2(0.5, 0.5);
+    colour = particle_colour;
+    pos_ws = part_pos_ws;
+    size = part_size;
+    life = 1 - n_age;
+
+    vec3 pos  = part_pos_ws;
+         pos += camera_up.xyz * corner.y * part_size * (0.5/0.9);
+         pos += camera_right.xyz * corner.x * part_size * (0.5/0.9);
+    gl_Position = vp * vec4(pos, 1);
+
+    // Dead particle, move the whole billboard outside the clip volume
+    if (n_age >= 1 || part_age < 0) {
+        gl_Position = vec4(2, 2, 2, 1);
+    }
+}
@@ -0,0 +1,136 @@
+// Vertex shader of the pulled draw paths. There are no attributes: each
+// vertex fetches its particle from the packed instances, see core/pack.h,
+// through buffer textures over the instance buffer.
+#version 150
+
+out vec2 UV;
+out vec3 pos_ws;
+out vec4 colour;
+out float size;
+out float life;
+
+// The emitter's colours and fuzziness, for the fragment shader
+flat out vec4 init_col;
+flat out vec4 final_col;
+flat out vec2 fuzz;
+
+// Per-frame constants, written once per frame. Must match FrameConstants
+// in particles.cpp.
+layout(std140) uniform FrameConstants {
+    mat4 vp;
+    vec4 camera_up;
+    vec4 camera_right;
+    float alpha;
+    // Simulated seconds and the selected emitter's forces, for the
+    // analytic particles
+    float time;
+    float gravity;
+    float wind;
+    // Pixels per world unit at unit view depth, and the size below which
+    // polygon billboards snap to quads
+    float pixel_scale;
+    float fitted_min_pixels;
+};
+
+// One draw covers the emitters [segment_begin, segment_end) of the batch,
+// see core/emitters.h. Each has four texels in emitter_table: its origin,
+// its initial and final colour, and its initial and final size and
+// fuzziness. segment_first holds the first instance of each.
+uniform samplerBuffer emitter_table;
+uniform isamplerBuffer segment_first;
+uniform int segment_begin;
+uniform int segment_end;
+// Instance of the batch that the draw's first particle is
+uniform int instance_base;
+
+// The last segment that starts at or before `instance`
+int find_segment(int instance)
+{
+    int low = segment_begin;
+    int high = segment_end - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (texelFetch(segment_first, mid).x <= instance) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+// Views of the instance buffer: the positions as 16 or 32-bit floats, the
+// life fractions as 16-bit and the colours as 8-bit normalized texels
+uniform samplerBuffer instance_positions;
+uniform samplerBuffer instance_lives;
+uniform samplerBuffer instance_colours;
+// The 4-byte word of the instance buffer the draw's first particle starts at
+uniform int instance_word;
+uniform bool half_positions;
+// One vertex per particle, drawn as a point sprite, instead of four
+uniform bool point_sprites;
+
+void main()
+{
+    int particle = point_sprites ? gl_VertexID : gl_VertexID / 4;
+
+    // InstanceHalf is 3 words long, InstanceFloat 5
+    vec3 part_pos_ws;
+    float part_life;
+    vec4 particle_colour;
+    if (half_positions) {
+        int word = instance_word + 3 * particle;
+        part_pos_ws = vec3(texelFetch(instance_positions, 2 * word).x,
+                           texelFetch(instance_positions, 2 * word + 1).x,
+                           texelFetch(instance_positions, 2 * word + 2).x);
+        part_life = texelFetch(instance_lives, 2 * word + 3).x;
+        particle_colour = texelFetch(instance_colours, word + 2);
+    } else {
+        int word = instance_word + 5 * particle;
+        part_pos_ws = vec3(texelFetch(instance_positions, word).x,
+                           texelFetch(instance_positions, word + 1).x,
+                           texelFetch(instance_positions, word + 2).x);
+        part_life = texelFetch(instance_lives, 2 * word + 6).x;
+        particle_colour = texelFetch(instance_colours, word + 4);
+    }
+
+    int segment = find_segment(instance_base + particle);
+    vec3 origin = texelFetch(emitter_table, 4 * segment).xyz;
+    vec4 shape = texelFetch(emitter_table, 4 * segment + 3);
+    init_col = texelFetch(emitter_table, 4 * segment + 1);
+    final_col = texelFetch(emitter_table, 4 * segment + 2);
+    fuzz = shape.zw;
+
+    // Same interpolation as the simulation uses for the size
+    float part_size = mix(shape.x, shape.y, 1 - part_life);
+
+    vec3 world_pos = origin + part_pos_ws;
+
+    colour = particle_colour;
+    pos_ws = world_pos;
+    size = part_size;
+    life = part_life;
+
+    if (point_sprites) {
+        // The fragment shader reads gl_PointCoord instead of UV. Points
+        // cover at least a pixel and at most the implementation's largest
+        // point size.
+        UV = vec2(0.5, 0.5);
+        gl_Position = vp * vec4(world_pos, 1);
+        gl_PointSize = max(part_size * (0.5/0.9) * pixel_scale / max(gl_Position.w, 1e-5), 1);
+    } else {
+        // The corners of the quad in the order of the billboard strip
+        vec2 corner = vec2(gl_VertexID & 1, (gl_VertexID >> 1) & 1) - vec2(0.5, 0.5);
+        UV = corner + vec2(0.5, 0.5);
+
+        vec3 pos  = world_pos;
+             pos += camera_up.xyz * corner.y * part_size * (0.5/0.9);
+             pos += camera_right.xyz * corner.x * part_size * (0.5/0.9);
+        gl_Position = vp * vec4(pos, 1);
+    }
+
+    // Dead particle, move it outside the clip volume
+    if (part_life <= 0) {
+        gl_Position = vec4(2, 2, 2, 1);
+    }
+}
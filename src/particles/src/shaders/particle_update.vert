@@ -0,0 +1,39 @@
+// Transform feedback update of one particle, see feedback.h. Performs the
+// same steps as integrateScalar.
+#version 150
+#extension GL_ARB_explicit_attrib_location : require
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in float life;
+layout(location = 2) in vec3 speed;
+layout(location = 3) in float init_life;
+layout(location = 4) in uint colour;
+
+out vec3 v_position;
+out float v_life;
+out vec3 v_speed;
+out float v_init_life;
+flat out uint v_colour;
+
+// Simulated seconds of the step, and gravity * delta / 2
+uniform float delta;
+uniform float gravity_step;
+uniform float wind;
+
+void main()
+{
+    v_position = position;
+    v_life = life - delta;
+    v_speed = speed;
+    v_init_life = init_life;
+    v_colour = colour;
+
+    // Normalized age
+    float age = (init_life - v_life) / init_life;
+
+    v_speed.z += gravity_step;
+
+    v_position.x += v_speed.x * delta;
+    v_position.y += (v_speed.y + wind * age) * delta;
+    v_position.z += v_speed.z * delta;
+}
@@ -0,0 +1,15 @@
+// Fragment shader
+#version 150
+
+// The reduced resolution particle pass, see offscreen.h
+uniform sampler2D particle_texture;
+// Size of the frame in pixels
+uniform vec2 screen_size;
+
+out vec4 frag_color;
+
+void main()
+{
+    // Premultiplied colour and transmittance both filter linearly
+    frag_color = texture(particle_texture, gl_FragCoord.xy / screen_size);
+}
@@ -0,0 +1,104 @@
+#include "stream.h"
+
+#include <GLFW/glfw3.h>
+
+#include <cstring>
+
+// GL_ARB_buffer_storage, missing from the bundled GLEW
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+
+typedef void (APIENTRY *BufferStorageProc)(GLenum target, GLsizeiptr size,
+                                           const void *data, GLbitfield flags);
+
+namespace {
+BufferStorageProc bufferStorage = NULL;
+} // namespace
+
+const char *uploadPathName(UploadPath path)
+{
+    switch (path) {
+    case UPLOAD_SUBDATA: return "glBufferSubData";
+    case UPLOAD_PERSISTENT: return "persistent ring";
+    default: return "unknown";
+    }
+}
+
+bool loadBufferStorage()
+{
+    GLint major = 0;
+    GLint minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    bool core = major > 4 || (major == 4 && minor >= 4);
+
+    if (!core && !glfwExtensionSupported("GL_ARB_buffer_storage")) {
+        return false;
+    }
+
+    bufferStorage = (BufferStorageProc)glfwGetProcAddress("glBufferStorage");
+    return bufferStorage != NULL;
+}
+
+bool createStreamRing(StreamRing *ring, size_t sectionSize)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    if (bufferStorage == NULL) {
+        return false;
+    }
+
+    // Keep every section aligned for the streaming writes
+    ring->sectionSize = (sectionSize + 255) / 256 * 256;
+
+    GLsizeiptr size = STREAM_RING_FRAMES * ring->sectionSize;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glGenBuffers(1, &ring->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, ring->buffer);
+    bufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+    ring->mapped = static_cast<unsigned char *>(
+        glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+
+    if (ring->mapped == NULL) {
+        destroyStreamRing(ring);
+        return false;
+    }
+    return true;
+}
+
+void destroyStreamRing(StreamRing *ring)
+{
+    for (int i = 0; i < STREAM_RING_FRAMES; i++) {
+        if (ring->fences[i] != NULL) {
+            glDeleteSync(ring->fences[i]);
+        }
+    }
+
+    // Deleting the buffer also unmaps it
+    if (ring->buffer != 0) {
+        glDeleteBuffers(1, &ring->buffer);
+    }
+    memset(ring, 0, sizeof(*ring));
+}
+
+size_t beginStreamFrame(StreamRing *ring)
+{
+    GLsync fence = ring->fences[ring->section];
+    if (fence != NULL) {
+        // Flush on the first wait so the fence is guaranteed to signal
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED) {
+            flags = 0;
+        }
+        glDeleteSync(fence);
+        ring->fences[ring->section] = NULL;
+    }
+    return ring->section * ring->sectionSize;
+}
+
+void endStreamFrame(StreamRing *ring)
+{
+    ring->fences[ring->section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring->section = (ring->section + 1) % STREAM_RING_FRAMES;
+}
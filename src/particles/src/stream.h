@@ -0,0 +1,48 @@
+#pragma once
+
+// Streaming of the particle instance data to the GPU through a persistently
+// mapped ring buffer (GL_ARB_buffer_storage). The ring holds
+// STREAM_RING_FRAMES copies of the instance data; the CPU fills one while
+// the GPU may still be reading the others, and a fence per section keeps
+// the CPU from overwriting data that is still in use.
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+#define STREAM_RING_FRAMES 3
+
+// How the particle data reaches the GPU
+enum UploadPath {
+    UPLOAD_SUBDATA,     // Orphan the instance buffer and glBufferSubData it
+    UPLOAD_PERSISTENT,  // Write into the mapped ring
+    NUM_UPLOAD_PATHS
+};
+
+const char *uploadPathName(UploadPath path);
+
+struct StreamRing {
+    GLuint buffer;
+    unsigned char *mapped;
+    size_t sectionSize;
+    int section;  // The section the current frame writes
+    GLsync fences[STREAM_RING_FRAMES];
+};
+
+// Load glBufferStorage, which GLEW does not know about. Must be called with
+// a current context. Returns false when persistent mapping is unsupported.
+bool loadBufferStorage();
+
+// Create a ring whose sections hold `sectionSize` bytes each. Returns false,
+// leaving the ring empty, when the buffer cannot be created or mapped.
+bool createStreamRing(StreamRing *ring, size_t sectionSize);
+
+void destroyStreamRing(StreamRing *ring);
+
+// Wait until the GPU is done with the next section and return the offset
+// of that section in the ring buffer
+size_t beginStreamFrame(StreamRing *ring);
+
+// Fence the section written since beginStreamFrame, after the draw calls
+// that read it
+void endStreamFrame(StreamRing *ring);
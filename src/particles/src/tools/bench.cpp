@@ -0,0 +1,780 @@
+// Microbenchmarks for the particle hot paths. Every suite prints a table,
+// and --json also writes the measurements for tools/compare_bench.py.
+
+#include "core/arena.h"
+#include "core/integrate.h"
+#include "core/jobs.h"
+#include "core/pack.h"
+#include "core/presets.h"
+#include "core/simulation.h"
+#include "core/spawn.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct Options {
+    std::vector<std::string> suites;
+    std::vector<int> counts;
+    std::vector<int> threads;
+    std::vector<float> fills;  // Empty for each suite's default
+    double seconds;
+    bool hugePages;
+    const char *jsonPath;  // NULL for none
+};
+
+// One measurement. Cases are told apart by suite, name, particles, fill
+// and threads.
+struct BenchResult {
+    std::string suite;
+    std::string name;
+    int particles;
+    float fill;
+    int threads;
+    double rate;  // Million particles per second, higher is better
+};
+
+typedef std::vector<BenchResult> BenchResults;
+
+void addResult(BenchResults *results, const char *suite, const std::string &name,
+               int particles, float fill, int threads, double rate)
+{
+    BenchResult result = { suite, name, particles, fill, threads, rate / 1e6 };
+    results->push_back(result);
+}
+
+void usage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  --suite NAME,...  Suites to run: integrate, threads, sort, pack, spawn,\n"
+           "                    hotpaths (default: all)\n"
+           "  --counts N,N,...  Particle counts (default: 10000,1000000,10000000)\n"
+           "  --threads N,...   Thread counts for the threads suite (default: 1, 2, 4, ... cores)\n"
+           "  --seconds S       Minimum time per measurement (default: 0.5)\n"
+           "  --fill F,F,...    Fractions of live particles (default: 1.0, and\n"
+           "                    0.1,0.5,0.9 for the hotpaths suite)\n"
+           "  --no-huge-pages   Do not ask for huge pages for large pools\n"
+           "  --json FILE       Also write the measurements as JSON\n",
+           program);
+}
+
+std::vector<int> parseIntList(char *list)
+{
+    std::vector<int> values;
+    while (*list) {
+        values.push_back(strtol(list, &list, 10));
+        if (*list == ',') {
+            list++;
+        }
+    }
+    return values;
+}
+
+std::vector<float> parseFloatList(char *list)
+{
+    std::vector<float> values;
+    while (*list) {
+        values.push_back(strtof(list, &list));
+        if (*list == ',') {
+            list++;
+        }
+    }
+    return values;
+}
+
+std::vector<std::string> parseNameList(const std::string &list)
+{
+    std::vector<std::string> names;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = std::min(list.find(',', start), list.size());
+        names.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return names;
+}
+
+bool parseOptions(int argc, char **argv, Options *options)
+{
+    options->suites.clear();
+    options->counts.clear();
+    options->threads.clear();
+    options->fills.clear();
+    options->seconds = 0.5;
+    options->hugePages = true;
+    options->jsonPath = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--suite") == 0 && hasValue) {
+            options->suites = parseNameList(argv[++i]);
+        } else if (strcmp(argv[i], "--counts") == 0 && hasValue) {
+            options->counts = parseIntList(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            options->threads = parseIntList(argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && hasValue) {
+            options->seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--fill") == 0 && hasValue) {
+            options->fills = parseFloatList(argv[++i]);
+        } else if (strcmp(argv[i], "--no-huge-pages") == 0) {
+            options->hugePages = false;
+        } else if (strcmp(argv[i], "--json") == 0 && hasValue) {
+            options->jsonPath = argv[++i];
+        } else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    if (options->counts.empty()) {
+        options->counts.push_back(10000);
+        options->counts.push_back(1000000);
+        options->counts.push_back(10000000);
+    }
+
+    if (options->threads.empty()) {
+        int cores = std::max(1u, std::thread::hardware_concurrency());
+        for (int threads = 1; threads < cores; threads *= 2) {
+            options->threads.push_back(threads);
+        }
+        options->threads.push_back(cores);
+    }
+
+    return true;
+}
+
+// Fill every slot with a particle that stays alive for the whole benchmark.
+// A `1 - fill` fraction of them is dead instead, which the simulation never
+// leaves inside the pool but shows what the kernels do with masked lanes.
+void fillParticles(Particles *particles, float fill)
+{
+    mt19937 eng(1);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    int count = particles->capacity;
+    for (int i = 0; i < count; i++) {
+        particles->speedX[i] = unit(eng) - 0.5f;
+        particles->speedY[i] = unit(eng) - 0.5f;
+        particles->speedZ[i] = unit(eng);
+        particles->posX[i] = 0.0f;
+        particles->posY[i] = 0.0f;
+        particles->posZ[i] = 0.0f;
+        particles->initLives[i] = 1000.0f;
+        particles->lives[i] = unit(eng) < fill ? 1000.0f * unit(eng) + 1.0f : -1.0f;
+    }
+    particles->numParticles = count;
+}
+
+// The arrays an integration step writes
+struct IntegrateState {
+    std::vector<float> arrays[7];
+};
+
+float **stateArrays(Particles *particles, float **arrays)
+{
+    arrays[0] = particles->lives;
+    arrays[1] = particles->speedZ;
+    arrays[2] = particles->posX;
+    arrays[3] = particles->posY;
+    arrays[4] = particles->posZ;
+    arrays[5] = particles->sizes;
+    arrays[6] = particles->cameraDistance;
+    return arrays;
+}
+
+void saveState(Particles *particles, IntegrateState *state)
+{
+    float *arrays[7];
+    stateArrays(particles, arrays);
+    for (int i = 0; i < 7; i++) {
+        state->arrays[i].assign(arrays[i], arrays[i] + particles->capacity);
+    }
+}
+
+void restoreState(Particles *particles, const IntegrateState &state)
+{
+    float *arrays[7];
+    stateArrays(particles, arrays);
+    for (int i = 0; i < 7; i++) {
+        memcpy(arrays[i], &state.arrays[i][0], particles->capacity * sizeof(float));
+    }
+}
+
+bool sameState(const IntegrateState &a, const IntegrateState &b)
+{
+    for (int i = 0; i < 7; i++) {
+        if (memcmp(&a.arrays[i][0], &b.arrays[i][0], a.arrays[i].size() * sizeof(float)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The fill ratios to run, `fallback` when none were given
+std::vector<float> fillsOr(const Options &options, std::vector<float> fallback)
+{
+    return options.fills.empty() ? fallback : options.fills;
+}
+
+// Particles per second for the integration kernel at every supported level
+void benchIntegrate(const Options &options, BenchResults *results)
+{
+    IntegrateParams params;
+    params.delta = 0.0016f;
+    params.gravity = -9.82f;
+    params.wind = 0.2f;
+    params.initSize = 0.01f;
+    params.finalSize = 0.1f;
+    params.cameraX = 4.0f;
+    params.cameraY = 0.0f;
+    params.cameraZ = 0.0f;
+
+    std::vector<float> fills = fillsOr(options, std::vector<float>(1, 1.0f));
+    printf("Integration kernel, best level on this CPU: %s\n",
+           simdLevelName(detectSimdLevel()));
+    printf("%10s %5s  %-8s %14s %12s %9s  %s\n",
+           "particles", "live", "isa", "Mparticles/s", "ns/particle", "speedup",
+           "matches scalar");
+
+    for (size_t run = 0; run < options.counts.size() * fills.size(); run++) {
+        int count = options.counts[run / fills.size()];
+        float fill = fills[run % fills.size()];
+        Particles *particles = createParticles(1, count, options.hugePages);
+        fillParticles(particles, fill);
+
+        IntegrateState initial;
+        IntegrateState reference;
+        IntegrateState result;
+        saveState(particles, &initial);
+
+        double scalarRate = 0.0;
+
+        for (int level = SIMD_SCALAR; level <= detectSimdLevel(); level++) {
+            IntegrateKernel kernel = integrateKernel(SimdLevel(level));
+
+            // One step from the same initial state to compare with scalar
+            restoreState(particles, initial);
+            kernel(particles, 0, count, params);
+            saveState(particles, level == SIMD_SCALAR ? &reference : &result);
+            bool matches = level == SIMD_SCALAR || sameState(reference, result);
+
+            long long steps = 0;
+            double elapsed = 0.0;
+            auto start = chrono::steady_clock::now();
+            while (elapsed < options.seconds) {
+                kernel(particles, 0, count, params);
+                steps++;
+                elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            }
+
+            double rate = double(count) * steps / elapsed;
+            if (level == SIMD_SCALAR) {
+                scalarRate = rate;
+            }
+
+            printf("%10d %4.0f%%  %-8s %14.1f %12.3f %8.2fx  %s\n",
+                   count, fill * 100.0f, simdLevelName(SimdLevel(level)), rate / 1e6,
+                   1e9 / rate, rate / scalarRate, matches ? "yes" : "NO");
+            addResult(results, "integrate", simdLevelName(SimdLevel(level)), count, fill, 1,
+                      rate);
+        }
+
+        destroyParticles(particles);
+    }
+}
+
+// Throughput of the threaded simulation passes for every thread count
+void benchThreads(const Options &options, BenchResults *results)
+{
+    EmitterParams params;
+    presetFountain(&params);
+    glm::vec3 cameraPos(4.0f, 0.0f, 0.0f);
+
+    printf("Thread scaling, %s kernel, %d hardware threads\n",
+           simdLevelName(activeSimdLevel()),
+           std::thread::hardware_concurrency());
+    printf("%10s %8s %22s %9s %22s %9s\n",
+           "particles", "threads", "integrate Mparticles/s", "speedup",
+           "permute Mparticles/s", "speedup");
+
+    for (size_t c = 0; c < options.counts.size(); c++) {
+        int count = options.counts[c];
+        Particles *particles = createParticles(1, count, options.hugePages);
+
+        // A random order, the worst case for the gathers of the permute
+        std::vector<int> indices(count);
+        for (int i = 0; i < count; i++) {
+            indices[i] = i;
+        }
+        std::shuffle(indices.begin(), indices.end(), mt19937(1));
+
+        double integrateBase = 0.0;
+        double permuteBase = 0.0;
+
+        for (size_t t = 0; t < options.threads.size(); t++) {
+            JobPool *pool = createJobPool(options.threads[t]);
+            particles->jobPool = pool;
+
+            fillParticles(particles, 1.0f);
+
+            long long steps = 0;
+            double elapsed = 0.0;
+            auto start = chrono::steady_clock::now();
+            while (elapsed < options.seconds) {
+                particles->numParticles = count;
+                integrateParticles(particles, params, cameraPos, 0.0016f);
+                steps++;
+                elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            }
+            double integrateRate = double(count) * steps / elapsed;
+
+            steps = 0;
+            elapsed = 0.0;
+            start = chrono::steady_clock::now();
+            while (elapsed < options.seconds) {
+                permuteParticles(particles, &indices[0], count);
+                steps++;
+                elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            }
+            double permuteRate = double(count) * steps / elapsed;
+
+            if (t == 0) {
+                integrateBase = integrateRate;
+                permuteBase = permuteRate;
+            }
+
+            printf("%10d %8d %22.1f %8.2fx %22.1f %8.2fx\n",
+                   count, options.threads[t],
+                   integrateRate / 1e6, integrateRate / integrateBase,
+                   permuteRate / 1e6, permuteRate / permuteBase);
+            addResult(results, "threads", "integrate", count, 1.0f, options.threads[t],
+                      integrateRate);
+            addResult(results, "threads", "permute", count, 1.0f, options.threads[t],
+                      permuteRate);
+
+            particles->jobPool = NULL;
+            destroyJobPool(pool);
+        }
+
+        destroyParticles(particles);
+    }
+}
+
+// Time of each depth sort mode over a number of coherent frames: the
+// particles drift a little between sorts like they do in the viewer
+void benchSort(const Options &options, BenchResults *results)
+{
+    const int frames = 20;
+
+    EmitterParams params;
+    presetFountain(&params);
+    glm::vec3 cameraPos(4.0f, 0.0f, 0.0f);
+
+    printf("Depth sort, mean of %d coherent frames\n", frames);
+    printf("%10s  %-12s %10s %14s %9s  %s\n",
+           "particles", "mode", "ms/sort", "Mparticles/s", "speedup", "matches std::sort");
+
+    for (size_t c = 0; c < options.counts.size(); c++) {
+        int count = options.counts[c];
+        Particles *particles = createParticles(1, count, options.hugePages);
+
+        double comparisonTime = 0.0;
+        std::vector<float> reference;
+
+        for (int mode = 0; mode < NUM_SORT_MODES; mode++) {
+            // Every mode starts from the same scattered cloud
+            fillParticles(particles, 1.0f);
+            mt19937 eng(2);
+            uniform_real_distribution<float> unit(-1.0f, 1.0f);
+            for (int i = 0; i < count; i++) {
+                particles->posX[i] = unit(eng);
+                particles->posY[i] = unit(eng);
+                particles->posZ[i] = unit(eng);
+            }
+            particles->sortMode = SortMode(mode);
+
+            double total = 0.0;
+            for (int frame = 0; frame < frames; frame++) {
+                integrateParticles(particles, params, cameraPos, 0.0016f);
+                sortParticles(particles);
+                total += particles->sortTime;
+            }
+
+            // All modes produce the same order, so the particles end up in
+            // the same slots
+            std::vector<float> order(particles->posX, particles->posX + particles->numParticles);
+
+            double time = total / frames;
+            if (mode == SORT_COMPARISON) {
+                comparisonTime = time;
+                reference = order;
+            }
+
+            printf("%10d  %-12s %10.3f %14.1f %8.2fx  %s\n",
+                   count, sortModeName(SortMode(mode)), time,
+                   particles->numParticles / (time * 1000.0), comparisonTime / time,
+                   order == reference ? "yes" : "NO");
+            addResult(results, "sort", sortModeName(SortMode(mode)), count, 1.0f, 1,
+                      particles->numParticles / (time * 1e-3));
+        }
+
+        destroyParticles(particles);
+    }
+}
+
+// Bytes written per frame to get the particles to the GPU: the separate
+// float arrays the viewer used to upload against the packed instances
+void benchPack(const Options &options, BenchResults *results)
+{
+    printf("Instance upload data, %s kernel\n", simdLevelName(activeSimdLevel()));
+    printf("%10s  %-16s %6s %14s %10s\n",
+           "particles", "layout", "bytes", "Mparticles/s", "GB/s");
+
+    for (size_t c = 0; c < options.counts.size(); c++) {
+        int count = options.counts[c];
+        Particles *particles = createParticles(1, count, options.hugePages);
+        fillParticles(particles, 1.0f);
+
+        // The old layout: position planes, size, life, initial life and
+        // colour, 28 bytes per particle
+        const int separateBytes = 7 * 4;
+        std::vector<unsigned char> output(count * std::max(separateBytes, instanceStride(INSTANCE_FLOAT)));
+
+        for (int layout = -1; layout < NUM_INSTANCE_FORMATS; layout++) {
+            int bytes = layout < 0 ? separateBytes : instanceStride(InstanceFormat(layout));
+
+            long long steps = 0;
+            double elapsed = 0.0;
+            auto start = chrono::steady_clock::now();
+            while (elapsed < options.seconds) {
+                if (layout < 0) {
+                    size_t plane = count * sizeof(float);
+                    unsigned char *out = &output[0];
+                    memcpy(out, particles->posX, plane);
+                    memcpy(out + plane, particles->posY, plane);
+                    memcpy(out + 2 * plane, particles->posZ, plane);
+                    memcpy(out + 3 * plane, particles->sizes, plane);
+                    memcpy(out + 4 * plane, particles->lives, plane);
+                    memcpy(out + 5 * plane, particles->initLives, plane);
+                    memcpy(out + 6 * plane, particles->colours, plane);
+                } else {
+                    packParticles(particles, InstanceFormat(layout), &output[0]);
+                }
+                steps++;
+                elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            }
+
+            double rate = double(count) * steps / elapsed;
+            printf("%10d  %-16s %6d %14.1f %10.2f\n",
+                   count, layout < 0 ? "separate arrays" : instanceFormatName(InstanceFormat(layout)),
+                   bytes, rate / 1e6, rate * bytes / 1e9);
+            addResult(results, "pack",
+                      layout < 0 ? "separate" : instanceFormatName(InstanceFormat(layout)),
+                      count, 1.0f, 1, rate);
+        }
+
+        destroyParticles(particles);
+    }
+}
+
+// The emission spawnParticles did before the batch kernels: a Mersenne
+// Twister, a distribution call per property and libm sines and cosines
+void spawnMersenne(Particles *particles, int count, const EmitterParams &params,
+                   std::mt19937 &eng)
+{
+    uniform_real_distribution<> azimuth(0, 2 * 3.14159265358979);
+    uniform_real_distribution<> polar(0, params.spread);
+    uniform_real_distribution<> speed(params.min_speed, params.max_speed);
+    uniform_real_distribution<> rlife(params.min_life, params.max_life);
+    uniform_int_distribution<> rand255(0, 255);
+
+    for (int i = 0; i < count; i++) {
+        particles->lives[i] = rlife(eng) * STRETCH;
+        particles->initLives[i] = particles->lives[i];
+
+        float phi = azimuth(eng);
+        float theta = polar(eng);
+        float r = speed(eng);
+        particles->speedX[i] = r * sin(theta) * cos(phi);
+        particles->speedY[i] = r * sin(theta) * sin(phi);
+        particles->speedZ[i] = r * cos(theta);
+
+        unsigned char *colour = &particles->colours[4*i];
+        colour[0] = rand255(eng);
+        colour[1] = rand255(eng);
+        colour[2] = rand255(eng);
+        colour[3] = rand255(eng) / 3;
+
+        particles->posX[i] = 0.0f;
+        particles->posY[i] = 0.0f;
+        particles->posZ[i] = 0.0f;
+        particles->sizes[i] = params.initSize;
+    }
+}
+
+bool sameSpawn(const Particles *a, const Particles *b, int count)
+{
+    size_t size = count * sizeof(float);
+    return memcmp(a->lives, b->lives, size) == 0 &&
+           memcmp(a->speedX, b->speedX, size) == 0 &&
+           memcmp(a->speedY, b->speedY, size) == 0 &&
+           memcmp(a->speedZ, b->speedZ, size) == 0 &&
+           memcmp(a->colours, b->colours, 4 * count) == 0;
+}
+
+// Emission rate of the spawn kernels against the old generator, on one
+// thread
+void benchSpawn(const Options &options, BenchResults *results)
+{
+    EmitterParams params;
+    presetFire(&params);
+
+    SpawnParams spawn;
+    spawn.key[0] = 1;
+    spawn.key[1] = 0;
+    spawn.firstId = 0;
+    spawn.first = 0;
+    spawn.spread = params.spread;
+    spawn.minSpeed = params.min_speed;
+    spawn.speedRange = params.max_speed - params.min_speed;
+    spawn.minLife = params.min_life * STRETCH;
+    spawn.lifeRange = (params.max_life - params.min_life) * STRETCH;
+    spawn.initSize = params.initSize;
+
+    printf("Particle emission, best level on this CPU: %s\n", simdLevelName(detectSimdLevel()));
+    printf("%10s  %-10s %14s %12s %9s  %s\n",
+           "particles", "generator", "Mparticles/s", "ns/particle", "speedup", "matches scalar");
+
+    for (size_t c = 0; c < options.counts.size(); c++) {
+        int count = options.counts[c];
+        Particles *particles = createParticles(1, count, options.hugePages);
+        Particles *reference = createParticles(1, count, options.hugePages);
+        spawnScalar(reference, 0, count, spawn);
+        std::mt19937 eng(1);
+
+        double baseRate = 0.0;
+        for (int level = -1; level <= detectSimdLevel(); level++) {
+            // Only the levels with a kernel of their own
+            if (level >= 0 && level != SIMD_SCALAR && spawnKernel(SimdLevel(level)) ==
+                spawnKernel(SimdLevel(level - 1))) {
+                continue;
+            }
+            SpawnKernel kernel = level < 0 ? NULL : spawnKernel(SimdLevel(level));
+
+            long long steps = 0;
+            double elapsed = 0.0;
+            auto start = chrono::steady_clock::now();
+            while (elapsed < options.seconds) {
+                if (kernel == NULL) {
+                    spawnMersenne(particles, count, params, eng);
+                } else {
+                    kernel(particles, 0, count, spawn);
+                }
+                steps++;
+                elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            }
+
+            double rate = double(count) * steps / elapsed;
+            if (level < 0) {
+                baseRate = rate;
+            }
+
+            const char *matches = "-";
+            if (kernel != NULL) {
+                matches = sameSpawn(particles, reference, count) ? "yes" : "NO";
+            }
+            printf("%10d  %-10s %14.1f %12.3f %8.2fx  %s\n",
+                   count, level < 0 ? "mt19937" : simdLevelName(SimdLevel(level)),
+                   rate / 1e6, 1e9 / rate, rate / baseRate, matches);
+            addResult(results, "spawn",
+                      level < 0 ? "mt19937" : simdLevelName(SimdLevel(level)), count, 1.0f, 1,
+                      rate);
+        }
+
+        destroyParticles(reference);
+        destroyParticles(particles);
+    }
+}
+
+// Spawn `target - numParticles` more particles of `params` in one call
+void spawnTo(Particles *particles, EmitterParams params, int target)
+{
+    params.spawnRate = (target - particles->numParticles + 0.5f) / 1000.0f;
+    particles->spawnRemainder = 0.0f;
+    spawnParticles(particles, params, 1.0f);
+}
+
+// Copy every array and the spawn state of `from` to `to`, a pool of the
+// same capacity
+void copyParticles(const Particles *from, Particles *to)
+{
+    memcpy(to->arena->data, from->arena->data, from->arena->size);
+    to->numParticles = from->numParticles;
+    to->spawnRemainder = from->spawnRemainder;
+    to->nextId = from->nextId;
+}
+
+// Seconds per call of `run` on a fresh copy of `state`, over at least
+// `seconds` of calls. The copy is not timed.
+template <typename Fn>
+double timePerCall(const Options &options, const Particles *state, Particles *work, Fn run)
+{
+    long long calls = 0;
+    double elapsed = 0.0;
+    while (elapsed < options.seconds) {
+        copyParticles(state, work);
+        auto start = chrono::steady_clock::now();
+        run(work);
+        elapsed += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        calls++;
+    }
+    return elapsed / calls;
+}
+
+// The four passes a CPU frame spends its time in, each on its own and on
+// one thread, with the parameters of every preset: emitting into the free
+// slots, integrating, sorting and packing the live particles for upload.
+// The pool holds `fill` of its capacity in live particles of mixed ages.
+void benchHotPaths(const Options &options, BenchResults *results)
+{
+    static const float DEFAULT_FILLS[] = { 0.1f, 0.5f, 0.9f };
+    std::vector<float> fills = fillsOr(options, std::vector<float>(DEFAULT_FILLS,
+                                                                   DEFAULT_FILLS + 3));
+    glm::vec3 cameraPos(4.0f, 0.0f, 0.0f);
+    const char *passes[] = { "spawn", "integrate", "sort", "pack" };
+
+    printf("Hot paths per preset, %s kernel, one thread\n", simdLevelName(activeSimdLevel()));
+    printf("%-10s %10s %5s  %-10s %14s %12s\n",
+           "preset", "particles", "live", "pass", "Mparticles/s", "ms/call");
+
+    for (int p = 0; p < NUM_PRESETS; p++) {
+        EmitterParams params;
+        PRESETS[p].apply(&params);
+
+        for (size_t run = 0; run < options.counts.size() * fills.size(); run++) {
+            int count = options.counts[run / fills.size()];
+            float fill = fills[run % fills.size()];
+            int live = int(count * fill);
+
+            // A few rounds of topping up and stepping, so that the ages and
+            // positions are spread out, then exactly `live` particles
+            Particles *state = createParticles(1, count, options.hugePages);
+            for (int round = 0; round < 4; round++) {
+                spawnTo(state, params, live);
+                integrateParticles(state, params, cameraPos, 0.05f);
+            }
+            spawnTo(state, params, live);
+            integrateParticles(state, params, cameraPos, 0.0f);
+
+            Particles *work = createParticles(1, count, options.hugePages);
+            std::vector<unsigned char> instances(count * instanceStride(INSTANCE_HALF));
+
+            for (int pass = 0; pass < 4; pass++) {
+                int particles = pass == 0 ? count - state->numParticles : state->numParticles;
+                if (particles == 0) {
+                    continue;
+                }
+                double time = timePerCall(options, state, work, [&](Particles *pool) {
+                    switch (pass) {
+                    case 0: spawnTo(pool, params, count); break;
+                    case 1: integrateParticles(pool, params, cameraPos, 0.0016f); break;
+                    case 2: sortParticles(pool); break;
+                    default: packParticles(pool, INSTANCE_HALF, &instances[0]); break;
+                    }
+                });
+
+                double rate = particles / time;
+                printf("%-10s %10d %4.0f%%  %-10s %14.1f %12.3f\n",
+                       PRESETS[p].name, count, fill * 100.0f, passes[pass], rate / 1e6,
+                       time * 1e3);
+                addResult(results, "hotpaths", std::string(PRESETS[p].name) + "/" + passes[pass],
+                          count, fill, 1, rate);
+            }
+
+            destroyParticles(work);
+            destroyParticles(state);
+        }
+    }
+}
+
+// Write `results` with what they were measured on, for compare_bench.py
+bool writeResults(const Options &options, const BenchResults &results)
+{
+    FILE *file = fopen(options.jsonPath, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "{\n  \"simd\": \"%s\",\n  \"hardware_threads\": %u,\n"
+                  "  \"seconds\": %g,\n  \"results\": [",
+            simdLevelName(activeSimdLevel()), std::thread::hardware_concurrency(),
+            options.seconds);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &result = results[i];
+        fprintf(file, "%s\n    {\"suite\": \"%s\", \"name\": \"%s\", \"particles\": %d, "
+                      "\"fill\": %g, \"threads\": %d, \"mparticles_per_s\": %.3f}",
+                i == 0 ? "" : ",", result.suite.c_str(), result.name.c_str(),
+                result.particles, result.fill, result.threads, result.rate);
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    return fclose(file) == 0;
+}
+
+bool runSuite(const Options &options, const std::string &name)
+{
+    if (options.suites.empty()) {
+        return true;
+    }
+    return std::find(options.suites.begin(), options.suites.end(), name) != options.suites.end();
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, &options)) {
+        return EXIT_FAILURE;
+    }
+
+    BenchResults results;
+
+    if (runSuite(options, "integrate")) {
+        benchIntegrate(options, &results);
+    }
+
+    if (runSuite(options, "threads")) {
+        benchThreads(options, &results);
+    }
+
+    if (runSuite(options, "sort")) {
+        benchSort(options, &results);
+    }
+
+    if (runSuite(options, "pack")) {
+        benchPack(options, &results);
+    }
+
+    if (runSuite(options, "spawn")) {
+        benchSpawn(options, &results);
+    }
+
+    if (runSuite(options, "hotpaths")) {
+        benchHotPaths(options, &results);
+    }
+
+    if (options.jsonPath != NULL && !writeResults(options, results)) {
+        fprintf(stderr, "Cannot write %s\n", options.jsonPath);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
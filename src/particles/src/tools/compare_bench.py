@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Compare two particles_bench --json files and flag regressions.
+
+    ./compare_bench.py BASELINE CURRENT [--tolerance 0.1] [--suite NAME]
+
+Every case of BASELINE that CURRENT also measured is listed with the ratio
+of their rates. A case slower than the baseline by more than the
+tolerance is a regression, and the script exits with status 1 if there is
+any. Cases only one of the files has are listed but do not fail.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    cases = {}
+    for result in data["results"]:
+        key = (result["suite"], result["name"], result["particles"], result["fill"],
+               result["threads"])
+        cases[key] = result["mparticles_per_s"]
+    return data, cases
+
+
+def describe(key):
+    suite, name, particles, fill, threads = key
+    text = "%-9s %-20s %10d %4.0f%%" % (suite, name, particles, fill * 100)
+    if threads != 1:
+        text += " %2d threads" % threads
+    return text
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flag particles_bench regressions")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--tolerance", type=float, default=0.1,
+                        help="slowdown accepted before a case fails (default: 0.1)")
+    parser.add_argument("--suite", action="append",
+                        help="only compare this suite, may be repeated")
+    args = parser.parse_args()
+
+    baseline_data, baseline = load(args.baseline)
+    current_data, current = load(args.current)
+    for field in ("simd", "hardware_threads"):
+        if baseline_data.get(field) != current_data.get(field):
+            print("Warning: %s differs, %s against %s" %
+                  (field, baseline_data.get(field), current_data.get(field)))
+
+    def selected(key):
+        return args.suite is None or key[0] in args.suite
+
+    regressions = 0
+    print("%-47s %12s %12s %8s" % ("case", "baseline", "current", "ratio"))
+    for key in sorted(k for k in baseline if selected(k)):
+        if key not in current:
+            print("%-47s %12.1f %12s" % (describe(key), baseline[key], "missing"))
+            continue
+        ratio = current[key] / baseline[key] if baseline[key] > 0 else float("inf")
+        flag = ""
+        if ratio < 1.0 - args.tolerance:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif ratio > 1.0 + args.tolerance:
+            flag = "  faster"
+        print("%-47s %12.1f %12.1f %7.2fx%s" %
+              (describe(key), baseline[key], current[key], ratio, flag))
+    for key in sorted(k for k in current if selected(k) and k not in baseline):
+        print("%-47s %12s %12.1f" % (describe(key), "new", current[key]))
+
+    print("%d regressions beyond %.0f%%" % (regressions, args.tolerance * 100))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,506 @@
+// Steps a preset for a fixed number of frames without opening a window and
+// prints timing and live particle statistics.
+
+#include "core/analytic.h"
+#include "core/arena.h"
+#include "core/bake.h"
+#include "core/cull.h"
+#include "core/emitters.h"
+#include "core/integrate.h"
+#include "core/jobs.h"
+#include "core/presets.h"
+#include "core/simulation.h"
+#include "core/snapshot.h"
+#include "core/timestep.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct Options {
+    std::string preset;
+    int frames;
+    float dt;
+    float step;
+    int maxSubsteps;
+    unsigned seed;
+    SimdLevel simd;
+    int threads;
+    SortMode sort;
+    int capacity;
+    int emitters;
+    float zoom;
+    bool hugePages;
+    bool analytic;
+    float prewarm;
+    std::string loadSnapshot;  // Empty for none
+    std::string saveSnapshot;
+    std::string bake;  // Empty for none
+    InstanceFormat bakeFormat;
+    BakeEncoding bakeEncoding;
+    std::string verifyBake;  // Empty for none
+};
+
+void usage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  --preset NAME   Preset to simulate (default: fire)\n"
+           "  --frames N      Number of frames to step (default: 1000)\n"
+           "  --dt SECONDS    Fixed frame time (default: 0.016)\n"
+           "  --step SECONDS  Simulate in fixed steps of this length, 0 steps once\n"
+           "                  per frame (default: 0)\n"
+           "  --max-substeps N  Steps per frame before the backlog is dropped\n"
+           "                  (default: 8)\n"
+           "  --seed N        Random seed (default: 1)\n"
+           "  --simd LEVEL    scalar, sse2, avx2 or avx512 (default: best supported)\n"
+           "  --threads N     Simulation threads, 1 for a single thread (default: all cores)\n"
+           "  --sort MODE     std::sort, radix or incremental (default: radix)\n"
+           "  --capacity N    Maximum number of particles per emitter (default: 10000)\n"
+           "  --emitters N    Emitters of the preset on a grid, simulated together\n"
+           "                  (default: 1)\n"
+           "  --zoom Z        Zoom of the view culling is measured against, smaller\n"
+           "                  is tighter (default: 0.3, as the viewer starts)\n"
+           "  --no-huge-pages Do not ask for huge pages for large pools\n"
+           "  --analytic      Only write spawn records, as the viewer does for\n"
+           "                  additive presets, instead of simulating\n"
+           "  --prewarm SECONDS  Fast-forward the emitters before the first frame\n"
+           "                  (default: 0)\n"
+           "  --load-snapshot FILE  Start from the emitters in FILE instead of the\n"
+           "                  preset\n"
+           "  --save-snapshot FILE  Write the emitters to FILE after the last frame\n"
+           "  --bake FILE     Record the packed instances of every frame to FILE,\n"
+           "                  without culling\n"
+           "  --bake-format FORMAT  half or float (default: half)\n"
+           "  --bake-encoding ENCODING  raw or delta (default: raw)\n"
+           "  --verify-bake FILE  Read every frame of the bake in FILE in order,\n"
+           "                  backwards and at random and check it against the\n"
+           "                  recorded checksums, after recording with --bake or\n"
+           "                  without simulating\n"
+           "  --list          List the available presets\n",
+           program);
+}
+
+bool parseOptions(int argc, char **argv, Options *options)
+{
+    options->preset = "fire";
+    options->frames = 1000;
+    options->dt = 0.016f;
+    options->step = 0.0f;
+    options->maxSubsteps = DEFAULT_MAX_SUBSTEPS;
+    options->seed = 1;
+    options->simd = detectSimdLevel();
+    options->threads = std::max(1u, std::thread::hardware_concurrency());
+    options->sort = SORT_RADIX;
+    options->capacity = DEFAULT_CAPACITY;
+    options->emitters = 1;
+    options->zoom = 0.3f;
+    options->hugePages = true;
+    options->analytic = false;
+    options->prewarm = 0.0f;
+    options->bakeFormat = INSTANCE_HALF;
+    options->bakeEncoding = BAKE_RAW;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--preset") == 0 && hasValue) {
+            options->preset = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            options->frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dt") == 0 && hasValue) {
+            options->dt = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--step") == 0 && hasValue) {
+            options->step = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-substeps") == 0 && hasValue) {
+            options->maxSubsteps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            options->seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            options->threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--capacity") == 0 && hasValue) {
+            options->capacity = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--emitters") == 0 && hasValue) {
+            options->emitters = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--zoom") == 0 && hasValue) {
+            options->zoom = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--no-huge-pages") == 0) {
+            options->hugePages = false;
+        } else if (strcmp(argv[i], "--analytic") == 0) {
+            options->analytic = true;
+        } else if (strcmp(argv[i], "--prewarm") == 0 && hasValue) {
+            options->prewarm = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--load-snapshot") == 0 && hasValue) {
+            options->loadSnapshot = argv[++i];
+        } else if (strcmp(argv[i], "--save-snapshot") == 0 && hasValue) {
+            options->saveSnapshot = argv[++i];
+        } else if (strcmp(argv[i], "--bake") == 0 && hasValue) {
+            options->bake = argv[++i];
+        } else if (strcmp(argv[i], "--verify-bake") == 0 && hasValue) {
+            options->verifyBake = argv[++i];
+        } else if (strcmp(argv[i], "--bake-format") == 0 && hasValue) {
+            const char *name = argv[++i];
+            if (strcmp(name, "half") == 0) {
+                options->bakeFormat = INSTANCE_HALF;
+            } else if (strcmp(name, "float") == 0) {
+                options->bakeFormat = INSTANCE_FLOAT;
+            } else {
+                fprintf(stderr, "Error: unknown instance format '%s'\n", name);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--bake-encoding") == 0 && hasValue) {
+            const char *name = argv[++i];
+            options->bakeEncoding = NUM_BAKE_ENCODINGS;
+            for (int encoding = 0; encoding < NUM_BAKE_ENCODINGS; encoding++) {
+                if (strcmp(name, bakeEncodingName(BakeEncoding(encoding))) == 0) {
+                    options->bakeEncoding = BakeEncoding(encoding);
+                }
+            }
+            if (options->bakeEncoding == NUM_BAKE_ENCODINGS) {
+                fprintf(stderr, "Error: unknown bake encoding '%s'\n", name);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--sort") == 0 && hasValue) {
+            const char *name = argv[++i];
+            options->sort = NUM_SORT_MODES;
+            for (int mode = 0; mode < NUM_SORT_MODES; mode++) {
+                if (strcmp(name, sortModeName(SortMode(mode))) == 0) {
+                    options->sort = SortMode(mode);
+                }
+            }
+            if (options->sort == NUM_SORT_MODES) {
+                fprintf(stderr, "Error: unknown sort mode '%s'\n", name);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--simd") == 0 && hasValue) {
+            const char *name = argv[++i];
+            options->simd = NUM_SIMD_LEVELS;
+            for (int level = 0; level < NUM_SIMD_LEVELS; level++) {
+                if (strcmp(name, simdLevelName(SimdLevel(level))) == 0) {
+                    options->simd = SimdLevel(level);
+                }
+            }
+            if (options->simd == NUM_SIMD_LEVELS) {
+                fprintf(stderr, "Error: unknown SIMD level '%s'\n", name);
+                return false;
+            }
+            if (options->simd > detectSimdLevel()) {
+                fprintf(stderr, "Error: this CPU only supports up to %s\n",
+                        simdLevelName(detectSimdLevel()));
+                return false;
+            }
+        } else if (strcmp(argv[i], "--list") == 0) {
+            for (int j = 0; j < NUM_PRESETS; j++) {
+                printf("%-10s %s\n", PRESETS[j].name, PRESETS[j].label);
+            }
+            exit(EXIT_SUCCESS);
+        } else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+
+    if (options->frames <= 0 || options->dt <= 0.0f || options->threads <= 0 ||
+        options->capacity <= 0 || options->maxSubsteps <= 0 || options->emitters <= 0 ||
+        options->zoom <= 0.0f) {
+        fprintf(stderr, "Error: --frames, --dt, --threads, --capacity, --emitters, --zoom"
+                " and --max-substeps must be positive\n");
+        return false;
+    }
+    if (options->step < 0.0f || options->prewarm < 0.0f) {
+        fprintf(stderr, "Error: --step and --prewarm must not be negative\n");
+        return false;
+    }
+    if (options->analytic && !options->bake.empty()) {
+        fprintf(stderr, "Error: --bake records the emitters, not --analytic\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Read every frame of the bake at `path` forwards, backwards and in a
+// random order, as seeking in the viewer does, and compare each with the
+// checksum it was recorded with. Returns false when the bake cannot be
+// read or any frame differs.
+bool verifyBake(const char *path, unsigned seed)
+{
+    BakeReader *reader = openBake(path);
+    if (reader == NULL) {
+        fprintf(stderr, "Error: cannot read bake '%s'\n", path);
+        return false;
+    }
+    int frames = bakeFrames(reader);
+    size_t stride = instanceStride(bakeFormat(reader));
+
+    const char *passNames[] = { "forward", "backward", "random" };
+    std::vector<int> orders[3];
+    std::mt19937 random(seed);
+    for (int i = 0; i < frames; i++) {
+        orders[0].push_back(i);
+        orders[1].push_back(frames - 1 - i);
+        orders[2].push_back(std::uniform_int_distribution<int>(0, frames - 1)(random));
+    }
+
+    printf("Verify:            %s, %s, %s, %d frames\n", path,
+           instanceFormatName(bakeFormat(reader)), bakeEncodingName(bakeEncoding(reader)),
+           frames);
+    EmitterBatches batches;
+    int mismatched = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        int passMismatched = 0;
+        int firstMismatch = -1;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < orders[pass].size(); i++) {
+            int frame = orders[pass][i];
+            const void *instances = readBakeFrame(reader, frame, &batches);
+            if (bakeChecksum(instances, batches.numInstances * stride) !=
+                bakeFrameChecksum(reader, frame)) {
+                passMismatched++;
+                if (firstMismatch < 0 || frame < firstMismatch) {
+                    firstMismatch = frame;
+                }
+            }
+        }
+        auto end = chrono::steady_clock::now();
+        double time = chrono::duration<double, milli>(end - start).count();
+        printf("  %-9s        mean %.4f ms per frame, ", passNames[pass], time / frames);
+        if (passMismatched == 0) {
+            printf("all match\n");
+        } else {
+            printf("%d differ, the first at frame %d\n", passMismatched, firstMismatch);
+        }
+        mismatched += passMismatched;
+    }
+
+    closeBake(reader);
+    return mismatched == 0;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, &options)) {
+        return EXIT_FAILURE;
+    }
+
+    // Only check a bake recorded before
+    if (!options.verifyBake.empty() && options.bake.empty()) {
+        return verifyBake(options.verifyBake.c_str(), options.seed) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    const Preset *preset = findPreset(options.preset);
+    if (preset == NULL) {
+        fprintf(stderr, "Error: unknown preset '%s', use --list\n", options.preset.c_str());
+        return EXIT_FAILURE;
+    }
+
+    EmitterParams params;
+    preset->apply(&params);
+
+    setActiveSimdLevel(options.simd);
+
+    // Same camera as the viewer starts with
+    glm::vec3 cameraPos(4.0f, 0.0f, 0.0f);
+    glm::mat4 view = glm::lookAt(cameraPos, glm::vec3(0.0f, 0.0f, 0.2f),
+                                 glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 projection = glm::perspective(0.5f * options.zoom, 1.0f, 0.1f, 100.0f);
+    Frustum frustum;
+    extractFrustum(projection * view, &frustum);
+    EmitterBatches batches;
+
+    JobPool *jobPool = createJobPool(options.threads);
+    EmitterRegistry *registry = createEmitterRegistry(options.seed, jobPool);
+    registry->sortMode = options.sort;
+    for (int i = 0; i < options.emitters; i++) {
+        addEmitter(registry, params, emitterGridPosition(i, options.emitters, 0.5f),
+                   options.capacity, options.hugePages);
+    }
+    if (!options.loadSnapshot.empty()) {
+        if (!loadSnapshot(registry, options.loadSnapshot.c_str(), options.hugePages)) {
+            fprintf(stderr, "Error: cannot load snapshot '%s'\n", options.loadSnapshot.c_str());
+            return EXIT_FAILURE;
+        }
+        options.emitters = numEmitters(registry);
+        params = registry->emitters[0].params;
+    }
+    AnalyticEmitter *analytic = createAnalyticEmitter(options.seed, options.capacity);
+
+    auto prewarmStart = chrono::steady_clock::now();
+    prewarmEmitters(registry, cameraPos, options.prewarm);
+    auto prewarmEnd = chrono::steady_clock::now();
+    double prewarmTime = chrono::duration<double, milli>(prewarmEnd - prewarmStart).count();
+
+    BakeWriter *bake = NULL;
+    if (!options.bake.empty()) {
+        bake = createBakeWriter(options.bake.c_str(), registry, options.bakeFormat,
+                                options.bakeEncoding);
+        if (bake == NULL) {
+            fprintf(stderr, "Error: cannot create bake '%s'\n", options.bake.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    EmitterBatches bakeBatches;
+    std::vector<char> bakeInstances;
+    double totalBakeTime = 0.0;
+
+    Timestep timestep;
+    initTimestep(&timestep, options.step, options.maxSubsteps);
+
+    std::vector<double> frameTimes(options.frames);
+    double totalSortTime = 0.0;
+    double totalCullTime = 0.0;
+    long long culledParticles = 0;
+    long long culledChunks = 0;
+    long long totalChunks = 0;
+    std::vector<int> liveCounts(options.frames);
+
+    for (int frame = 0; frame < options.frames; frame++) {
+        if (options.analytic) {
+            auto start = chrono::steady_clock::now();
+            spawnAnalytic(analytic, params, options.dt);
+            auto end = chrono::steady_clock::now();
+
+            frameTimes[frame] = chrono::duration<double, milli>(end - start).count();
+            liveCounts[frame] = countAnalyticLive(analytic);
+            continue;
+        }
+
+        auto start = chrono::steady_clock::now();
+        if (options.step > 0.0f) {
+            simulateEmittersFixed(registry, cameraPos, &timestep, options.dt);
+        } else {
+            simulateEmitters(registry, cameraPos, options.dt);
+        }
+        auto end = chrono::steady_clock::now();
+
+        frameTimes[frame] = chrono::duration<double, milli>(end - start).count();
+        liveCounts[frame] = countEmitterParticles(registry);
+        totalSortTime += registry->sortTime;
+
+        // What the viewer would leave out of the upload, timed apart from
+        // the simulation
+        start = chrono::steady_clock::now();
+        batchEmitters(registry, cameraPos, &batches, &frustum);
+        end = chrono::steady_clock::now();
+
+        totalCullTime += chrono::duration<double, milli>(end - start).count();
+        culledParticles += batches.numCulled;
+        culledChunks += batches.numCulledChunks;
+        totalChunks += batches.numChunks;
+
+        // Every live particle, as the viewer records them
+        if (bake != NULL) {
+            start = chrono::steady_clock::now();
+            batchEmitters(registry, cameraPos, &bakeBatches);
+            bakeInstances.resize(std::max(bakeBatches.numInstances, 1) *
+                                 instanceStride(options.bakeFormat));
+            packEmitters(registry, bakeBatches, options.bakeFormat, bakeInstances.data());
+            writeBakeFrame(bake, bakeBatches, bakeInstances.data());
+            end = chrono::steady_clock::now();
+
+            totalBakeTime += chrono::duration<double, milli>(end - start).count();
+        }
+    }
+
+    uint64_t bakeWritten = 0;
+    uint64_t bakeRaw = 0;
+    if (bake != NULL) {
+        if (!closeBakeWriter(bake, &bakeWritten, &bakeRaw)) {
+            fprintf(stderr, "Error: cannot write bake '%s'\n", options.bake.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    double totalTime = 0.0;
+    long long totalParticles = 0;
+    for (int frame = 0; frame < options.frames; frame++) {
+        totalTime += frameTimes[frame];
+        totalParticles += liveCounts[frame];
+    }
+
+    std::vector<double> sortedTimes(frameTimes);
+    std::sort(sortedTimes.begin(), sortedTimes.end());
+
+    int minLive = *std::min_element(liveCounts.begin(), liveCounts.end());
+    int maxLive = *std::max_element(liveCounts.begin(), liveCounts.end());
+
+    printf("Preset:            %s\n", preset->label);
+    if (options.analytic) {
+        printf("Integration:       analytic, %d spawn records of %d bytes\n",
+               analytic->capacity, int(sizeof(SpawnRecord)));
+    } else {
+        printf("Integration:       %s on %d thread(s)\n", simdLevelName(activeSimdLevel()),
+               jobPoolThreads(jobPool));
+    }
+    if (params.sortParticles && !options.analytic) {
+        printf("Sorting:           %s, mean %.4f ms\n", sortModeName(options.sort),
+               totalSortTime / options.frames);
+    } else {
+        printf("Sorting:           off\n");
+    }
+    Particles *particles = registry->emitters[0].particles;
+    if (options.emitters > 1) {
+        printf("Emitters:          %d on a grid 0.5 apart, %d particles in total\n",
+               options.emitters, emitterCapacity(registry));
+    }
+    if (!options.analytic) {
+        printf("Culling:           %.1f%% of particles, %lld of %lld chunks at zoom %.2f,"
+               " mean %.4f ms\n", totalParticles > 0 ? 100.0 * culledParticles / totalParticles : 0.0,
+               culledChunks, totalChunks, options.zoom, totalCullTime / options.frames);
+    }
+    printf("Pool:              %d particles, %.1f MB, huge pages %s%s\n",
+           particles->capacity, particlesMemory(particles) / (1024.0 * 1024.0),
+           particles->arena->hugePages ? "yes" : "no",
+           options.emitters > 1 ? " (per emitter)" : "");
+    if (options.prewarm > 0.0f) {
+        printf("Pre-warm:          %.2f s in steps of %.3f s, %.3f ms\n",
+               options.prewarm, PREWARM_SUBSTEP, prewarmTime);
+    }
+    if (!options.bake.empty()) {
+        printf("Bake:              %s, %s, %.2f MB of %.2f MB unencoded (%.1f%%),"
+               " mean %.4f ms per frame\n", instanceFormatName(options.bakeFormat),
+               bakeEncodingName(options.bakeEncoding), bakeWritten / (1024.0 * 1024.0),
+               bakeRaw / (1024.0 * 1024.0), bakeRaw > 0 ? 100.0 * bakeWritten / bakeRaw : 0.0,
+               totalBakeTime / options.frames);
+    }
+    printf("Frames:            %d at dt = %.4f s (%.2f s simulated)\n",
+           options.frames, options.dt, options.frames * options.dt);
+    if (options.step > 0.0f) {
+        printf("Steps:             %lld of %.4f s, %lld dropped (at most %d per frame)\n",
+               timestep.steps, options.step, timestep.droppedSteps, options.maxSubsteps);
+    }
+    printf("Total time:        %.3f ms\n", totalTime);
+    printf("Frame time:        mean %.4f ms, min %.4f ms, median %.4f ms, max %.4f ms\n",
+           totalTime / options.frames, sortedTimes.front(),
+           sortedTimes[options.frames / 2], sortedTimes.back());
+    printf("Live particles:    mean %.1f, min %d, max %d, final %d (capacity %d)\n",
+           double(totalParticles) / options.frames, minLive, maxLive,
+           liveCounts.back(), emitterCapacity(registry));
+    printf("Throughput:        %.3f M particle updates/s\n",
+           totalTime > 0.0 ? totalParticles / (totalTime * 1000.0) : 0.0);
+
+    if (!options.saveSnapshot.empty() &&
+        !saveSnapshot(registry, options.saveSnapshot.c_str())) {
+        fprintf(stderr, "Error: cannot write snapshot '%s'\n", options.saveSnapshot.c_str());
+        return EXIT_FAILURE;
+    }
+
+    destroyEmitterRegistry(registry);
+    destroyAnalyticEmitter(analytic);
+    destroyJobPool(jobPool);
+
+    if (!options.verifyBake.empty() && !verifyBake(options.verifyBake.c_str(), options.seed)) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,8 +1,11 @@
 #pragma once
 
+#include "program_cache.h"
+
 #include <GL/glew.h>
 #include <lodepng.h>
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -38,12 +41,23 @@ void showProgramInfoLog(GLuint program)
     std::cerr << infoLogStr << std::endl;
 }
 
-GLuint loadShaderProgram(const std::string &vertexShaderFilename,
-                         const std::string &fragmentShaderFilename)
+// `source` with `defines` after its #version line, which has to come first
+std::string addDefines(const std::string &source, const std::string &defines)
+{
+    if (defines.empty()) {
+        return source;
+    }
+    size_t version = source.find("#version");
+    size_t end = version == std::string::npos ? 0 : source.find('\n', version);
+    end = end == std::string::npos ? source.size() : end + 1;
+    return source.substr(0, end) + defines + source.substr(end);
+}
+
+GLuint linkShaderProgram(const std::string &vertexShaderSource,
+                         const std::string &fragmentShaderSource)
 {
-    // Load and compile vertex shader
+    // Compile vertex shader
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    std::string vertexShaderSource = readShaderSource(vertexShaderFilename);
     const char *vertexShaderSourcePtr = vertexShaderSource.c_str();
     glShaderSource(vertexShader, 1, &vertexShaderSourcePtr, nullptr);
 
@@ -57,9 +71,8 @@ GLuint loadShaderProgram(const std::string &vertexShaderFilename,
         return 0;
     }
 
-    // Load and compile fragment shader
+    // Compile fragment shader
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    std::string fragmentShaderSource = readShaderSource(fragmentShaderFilename);
     const char *fragmentShaderSourcePtr = fragmentShaderSource.c_str();
     glShaderSource(fragmentShader, 1, &fragmentShaderSourcePtr, nullptr);
 
@@ -81,6 +94,11 @@ GLuint loadShaderProgram(const std::string &vertexShaderFilename,
     glAttachShader(program, vertexShader);
     glAttachShader(program, fragmentShader);
 
+    // Keep the binary around for the program cache
+    if (GLEW_ARB_get_program_binary) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
     // Link program
     glLinkProgram(program);
 
@@ -99,6 +117,107 @@ GLuint loadShaderProgram(const std::string &vertexShaderFilename,
     // Clean up
     glDetachShader(program, vertexShader);
     glDetachShader(program, fragmentShader);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    return program;
+}
+
+// Compile and link the shaders in the two files, with `defines` (lines of
+// #define) added to both
+GLuint loadShaderProgram(const std::string &vertexShaderFilename,
+                         const std::string &fragmentShaderFilename,
+                         const std::string &defines = "")
+{
+    return linkShaderProgram(addDefines(readShaderSource(vertexShaderFilename), defines),
+                             addDefines(readShaderSource(fragmentShaderFilename), defines));
+}
+
+// loadShaderProgram, or the binary `cache` has of the same sources and
+// defines
+GLuint loadCachedProgram(ProgramCache *cache, const std::string &vertexShaderFilename,
+                         const std::string &fragmentShaderFilename,
+                         const std::string &defines = "")
+{
+    auto start = std::chrono::steady_clock::now();
+    std::string sources[] = {
+        addDefines(readShaderSource(vertexShaderFilename), defines),
+        addDefines(readShaderSource(fragmentShaderFilename), defines)
+    };
+    uint64_t key = programKey(cache, sources, 2);
+    GLuint program = loadProgramBinary(cache, key);
+    if (program != 0) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+        program = linkShaderProgram(sources[0], sources[1]);
+        if (program != 0) {
+            saveProgramBinary(cache, key, program);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    cache->loadTime += std::chrono::duration<double, std::milli>(end - start).count();
+    return program;
+}
+
+GLuint loadFeedbackProgram(const std::string &vertexShaderFilename,
+                           const std::string &geometryShaderFilename,
+                           const std::vector<const char *> &varyings)
+{
+    const std::string filenames[] = { vertexShaderFilename, geometryShaderFilename };
+    const GLenum types[] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER };
+    GLuint shaders[2];
+
+    // Load and compile the vertex and geometry shaders
+    for (int i = 0; i < 2; i++) {
+        shaders[i] = glCreateShader(types[i]);
+        std::string source = readShaderSource(filenames[i]);
+        const char *sourcePtr = source.c_str();
+        glShaderSource(shaders[i], 1, &sourcePtr, nullptr);
+
+        glCompileShader(shaders[i]);
+        GLint compiled = 0;
+        glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+        if (!compiled) {
+            std::cerr << filenames[i] << " compilation failed:" << std::endl;
+            showShaderInfoLog(shaders[i]);
+            for (int j = 0; j <= i; j++) {
+                glDeleteShader(shaders[j]);
+            }
+            return 0;
+        }
+    }
+
+    // Create program object
+    GLuint program = glCreateProgram();
+    glAttachShader(program, shaders[0]);
+    glAttachShader(program, shaders[1]);
+
+    // The captured outputs have to be known before linking
+    glTransformFeedbackVaryings(program, varyings.size(),
+                                const_cast<const GLchar **>(&varyings[0]),
+                                GL_INTERLEAVED_ATTRIBS);
+
+    // Link program
+    glLinkProgram(program);
+
+    // Check linking status
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        std::cerr << "Linking failed:" << std::endl;
+        showProgramInfoLog(program);
+        glDeleteProgram(program);
+        glDeleteShader(shaders[0]);
+        glDeleteShader(shaders[1]);
+        return 0;
+    }
+
+    // Clean up
+    glDetachShader(program, shaders[0]);
+    glDetachShader(program, shaders[1]);
+    glDeleteShader(shaders[0]);
+    glDeleteShader(shaders[1]);
 
     return program;
 }